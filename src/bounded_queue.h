@@ -0,0 +1,189 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#pragma once
+#include <iostream>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include "util.h"
+#include "timer.h"
+
+
+namespace yskip {
+
+
+//
+// Blocking FIFO queue holding at most `capacity` items.
+// The time producers/consumers spend blocked on a full/empty queue
+// is accumulated so that pipeline stalls can be reported.
+// Consumers may call task_done() after processing a popped item, so
+// that join() can wait until every pushed item has been processed, and
+// wait_unfinished() until only a few are left, bounding the items in the
+// queue and in the hands of the consumers together.
+//
+template<class T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(const size_t capacity);
+  ~BoundedQueue() {};
+  bool push(T&& item);
+  bool pop(T& item);
+  void task_done();
+  void join();
+  void wait_unfinished(const size_t max_num);
+  void close();
+  size_t capacity() const;
+  double push_wait_time() const;
+  double pop_wait_time() const;
+
+ private:
+  size_t                  capacity_;
+  bool                    closed_;
+  size_t                  unfinished_num_;
+  std::deque<T>           items_;
+  std::mutex              mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+  std::condition_variable all_done_;
+  std::condition_variable task_done_;
+  double                  push_wait_time_;
+  double                  pop_wait_time_;
+  DISALLOW_COPY_AND_ASSIGN(BoundedQueue);
+};
+
+
+template<class T>
+inline BoundedQueue<T>::BoundedQueue(const size_t capacity) {
+
+#ifdef __YSKIP_DEBUG__
+  assert(0 < capacity);
+#endif
+
+  capacity_       = capacity;
+  closed_         = false;
+  unfinished_num_ = 0;
+  push_wait_time_ = 0.0;
+  pop_wait_time_  = 0.0;
+}
+
+
+// blocks while the queue is full; returns false if the queue has been closed
+template<class T>
+inline bool BoundedQueue<T>::push(T&& item) {
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (items_.size() == capacity_ && !closed_) {
+      Timer timer;
+      not_full_.wait(lock, [this]{ return items_.size() < capacity_ || closed_; });
+      timer.stop();
+      push_wait_time_ += timer.elapsed_time();
+    }
+    if (closed_) {
+      return false;
+    }
+    items_.push_back(std::move(item));
+    ++unfinished_num_;
+  }
+  not_empty_.notify_one();
+  return true;
+}
+
+
+// blocks while the queue is empty; returns false once the queue is closed and drained
+template<class T>
+inline bool BoundedQueue<T>::pop(T& item) {
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (items_.empty() && !closed_) {
+      Timer timer;
+      not_empty_.wait(lock, [this]{ return !items_.empty() || closed_; });
+      timer.stop();
+      pop_wait_time_ += timer.elapsed_time();
+    }
+    if (items_.empty()) {
+      return false;
+    }
+    item = std::move(items_.front());
+    items_.pop_front();
+  }
+  not_full_.notify_one();
+  return true;
+}
+
+
+template<class T>
+inline void BoundedQueue<T>::task_done() {
+
+  std::unique_lock<std::mutex> lock(mutex_);
+#ifdef __YSKIP_DEBUG__
+  assert(0 < unfinished_num_);
+#endif
+  --unfinished_num_;
+  if (unfinished_num_ == 0) {
+    all_done_.notify_all();
+  }
+  task_done_.notify_all();
+}
+
+
+// blocks until task_done() has been called for every pushed item
+template<class T>
+inline void BoundedQueue<T>::join() {
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  all_done_.wait(lock, [this]{ return unfinished_num_ == 0; });
+}
+
+
+// blocks until fewer than max_num pushed items are unfinished, i.e. waiting in the queue or being processed;
+// the time is added to push_wait_time()
+template<class T>
+inline void BoundedQueue<T>::wait_unfinished(const size_t max_num) {
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (max_num <= unfinished_num_) {
+    Timer timer;
+    task_done_.wait(lock, [this, max_num]{ return unfinished_num_ < max_num; });
+    timer.stop();
+    push_wait_time_ += timer.elapsed_time();
+  }
+}
+
+
+template<class T>
+inline void BoundedQueue<T>::close() {
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    closed_ = true;
+  }
+  not_full_.notify_all();
+  not_empty_.notify_all();
+}
+
+
+template<class T>
+inline size_t BoundedQueue<T>::capacity() const {
+
+  return capacity_;
+}
+
+
+template<class T>
+inline double BoundedQueue<T>::push_wait_time() const {
+
+  return push_wait_time_;
+}
+
+
+template<class T>
+inline double BoundedQueue<T>::pop_wait_time() const {
+
+  return pop_wait_time_;
+}
+
+
+}
@@ -0,0 +1,250 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#pragma once
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include "util.h"
+
+
+namespace yskip {
+
+
+//
+// Binary file of encoded sentences used to avoid re-reading a text corpus.
+// The file starts with a header (magic, version, number of sentences and
+// number of stored indices) followed by the word indices of each sentence
+// as 32-bit integers, each sentence terminated by -1.
+//
+const char     CORPUS_CACHE_MAGIC[4]  = {'Y', 'S', 'K', 'C'};
+const uint32_t CORPUS_CACHE_VERSION   = 1;
+const int      CORPUS_CACHE_EOS       = -1;
+
+
+struct CorpusCacheHeader {
+  char     magic[4];
+  uint32_t version;
+  uint64_t sent_num;
+  uint64_t data_size;
+};
+
+
+class CorpusCacheWriter {
+ public:
+  CorpusCacheWriter();
+  ~CorpusCacheWriter();
+  int open(const char* filename);
+  int write(const std::vector<int>& text);
+  int close();
+  bool is_open() const;
+  uint64_t sent_num() const;
+
+ private:
+  FILE*             os_;
+  CorpusCacheHeader header_;
+  DISALLOW_COPY_AND_ASSIGN(CorpusCacheWriter);
+};
+
+
+class CorpusCache {
+ public:
+  CorpusCache();
+  ~CorpusCache();
+  int open(const char* filename);
+  void close();
+  const int* begin() const;
+  const int* end() const;
+  uint64_t sent_num() const;
+  void partition(const int n, std::vector<const int*>& bounds) const;
+
+ private:
+  void*    map_;
+  size_t   map_size_;
+  uint64_t sent_num_;
+  const int* begin_;
+  const int* end_;
+  DISALLOW_COPY_AND_ASSIGN(CorpusCache);
+};
+
+
+inline CorpusCacheWriter::CorpusCacheWriter() {
+
+  os_ = NULL;
+}
+
+
+inline CorpusCacheWriter::~CorpusCacheWriter() {
+
+  if (os_ != NULL) {
+    close();
+  }
+}
+
+
+inline int CorpusCacheWriter::open(const char* filename) {
+
+  os_ = fopen(filename, "wb");
+  if (os_ == NULL) {
+    std::fprintf(stderr, HERE "cannot open %s\n", filename);
+    return FAILURE;
+  }
+  setvbuf(os_, NULL, _IOFBF, BUFF_SIZE);
+  std::copy(CORPUS_CACHE_MAGIC, CORPUS_CACHE_MAGIC + 4, header_.magic);
+  header_.version   = CORPUS_CACHE_VERSION;
+  header_.sent_num  = 0;
+  header_.data_size = 0;
+  if (fwrite(&header_, sizeof(header_), 1, os_) != 1) { // rewritten by close()
+    return FAILURE;
+  }
+  return SUCCESS;
+}
+
+
+inline int CorpusCacheWriter::write(const std::vector<int>& text) {
+
+  if (!text.empty() && fwrite(text.data(), sizeof(int), text.size(), os_) != text.size()) {
+    return FAILURE;
+  }
+  if (fwrite(&CORPUS_CACHE_EOS, sizeof(int), 1, os_) != 1) {
+    return FAILURE;
+  }
+  header_.sent_num  += 1;
+  header_.data_size += text.size() + 1;
+  return SUCCESS;
+}
+
+
+inline int CorpusCacheWriter::close() {
+
+  int status = SUCCESS;
+  if (fseek(os_, 0, SEEK_SET) != 0 || fwrite(&header_, sizeof(header_), 1, os_) != 1) {
+    status = FAILURE;
+  }
+  if (fclose(os_) != 0) {
+    status = FAILURE;
+  }
+  os_ = NULL;
+  return status;
+}
+
+
+inline bool CorpusCacheWriter::is_open() const {
+
+  return os_ != NULL;
+}
+
+
+inline uint64_t CorpusCacheWriter::sent_num() const {
+
+  return header_.sent_num;
+}
+
+
+inline CorpusCache::CorpusCache() {
+
+  map_      = NULL;
+  map_size_ = 0;
+  sent_num_ = 0;
+  begin_    = NULL;
+  end_      = NULL;
+}
+
+
+inline CorpusCache::~CorpusCache() {
+
+  close();
+}
+
+
+inline int CorpusCache::open(const char* filename) {
+
+  close();
+  int fd = ::open(filename, O_RDONLY);
+  if (fd == -1) {
+    std::fprintf(stderr, HERE "cannot open %s\n", filename);
+    return FAILURE;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(CorpusCacheHeader)) {
+    std::fprintf(stderr, HERE "invalid corpus cache: %s\n", filename);
+    ::close(fd);
+    return FAILURE;
+  }
+  map_size_ = st.st_size;
+  map_ = mmap(NULL, map_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (map_ == MAP_FAILED) {
+    map_ = NULL;
+    std::fprintf(stderr, HERE "cannot map %s\n", filename);
+    return FAILURE;
+  }
+  madvise(map_, map_size_, MADV_SEQUENTIAL);
+
+  //
+  const CorpusCacheHeader* header = static_cast<const CorpusCacheHeader*>(map_);
+  if (!std::equal(CORPUS_CACHE_MAGIC, CORPUS_CACHE_MAGIC + 4, header->magic) || header->version != CORPUS_CACHE_VERSION || sizeof(CorpusCacheHeader) + sizeof(int)*header->data_size != map_size_) {
+    std::fprintf(stderr, HERE "invalid corpus cache: %s\n", filename);
+    close();
+    return FAILURE;
+  }
+  sent_num_ = header->sent_num;
+  begin_    = reinterpret_cast<const int*>(header + 1);
+  end_      = begin_ + header->data_size;
+  return SUCCESS;
+}
+
+
+inline void CorpusCache::close() {
+
+  if (map_ != NULL) {
+    munmap(map_, map_size_);
+  }
+  map_      = NULL;
+  map_size_ = 0;
+  sent_num_ = 0;
+  begin_    = NULL;
+  end_      = NULL;
+}
+
+
+inline const int* CorpusCache::begin() const {
+
+  return begin_;
+}
+
+
+inline const int* CorpusCache::end() const {
+
+  return end_;
+}
+
+
+inline uint64_t CorpusCache::sent_num() const {
+
+  return sent_num_;
+}
+
+
+// split the data into n ranges of roughly equal size; each of bounds[i], bounds[i+1] starts at a sentence boundary
+inline void CorpusCache::partition(const int n, std::vector<const int*>& bounds) const {
+
+  bounds.resize(n + 1);
+  bounds[0] = begin_;
+  for (int i = 1; i < n; ++i) {
+    const int* it = std::max(bounds[i-1], begin_ + (end_ - begin_)*i/n);
+    while (it != begin_ && it != end_ && *(it - 1) != CORPUS_CACHE_EOS) {
+      ++it;
+    }
+    bounds[i] = it;
+  }
+  bounds[n] = end_;
+}
+
+
+}
@@ -4,103 +4,271 @@
 #pragma once
 #include <stdio.h>
 #include <stdlib.h> //
+#include <stdint.h> // uintptr_t
+#include <sys/mman.h>
+#include <unistd.h>  // sysconf
+#include <cstring>  // memcpy
 #include <numeric>  // accumulate
 #include <iostream>
+#include <vector>
 #include <unordered_set>
 #include <cassert>
 #include "util.h"
+#include "simd.h"
+#include "numa.h"
 
 
 namespace yskip {
 
 
+//
+// Element type in which a matrix is stored. Computation is always done in
+// real_t: rows of FP16/BF16 matrices are converted by get() and set().
+// FP16 keeps more precision but only reaches about 6e-8..65504, so BF16,
+// which has the range of float, suits squared gradient sums.
+//
+enum StorageType {
+  FP32 = 0,
+  FP16 = 1,
+  BF16 = 2,
+};
+
+
+inline size_t storage_size(const int type) {
+
+  return type == FP32 ? sizeof(real_t) : sizeof(uint16_t);
+}
+
+
+// matrices of at least this size are aligned to it, so that their rows can be backed by transparent huge pages
+const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+
+//
+// Rows are stored `stride` elements apart. A matrix normally owns its rows,
+// packed (stride equals col_num) or padded to a multiple of row_alignment
+// bytes so that no two rows share a cache line. view() instead makes it a
+// window on some columns of another matrix, e.g. to keep two matrices
+// interleaved row by row. Copies keep the padding but not the view, and
+// saved files are always packed. Offsets are computed in size_t, so that
+// row_num*stride may exceed 2^31, e.g. 10M rows of 300 columns.
+//
 class DenseMatrix {
  public:
   DenseMatrix();
   DenseMatrix(const DenseMatrix& other);
-  DenseMatrix(const int row_num, const int col_num, const real_t val=0.0);
+  DenseMatrix(const int row_num, const int col_num, const real_t val=0.0, const int type=FP32, const int row_alignment=0);
   ~DenseMatrix();
   DenseMatrix& operator=(const DenseMatrix& other);
-  const real_t* operator[](const int row) const;
-  real_t* operator[](const int row);
+  const real_t* operator[](const int row) const; // FP32 only
+  real_t* operator[](const int row);             // FP32 only
+  void get(const int row, real_t* v) const;
+  void set(const int row, const real_t* v);
   void reduce(const std::unordered_set<int>& reserved_rows);
+  void permute(const std::vector<int>& order);
+  void view(DenseMatrix& base, const int col_offset, const int col_num);
+  void advise_huge_pages(const int row_num) const;
+  int interleave(const NumaTopology& numa) const;
+  int bind(const NumaTopology& numa, const int first, const int last, const int node) const;
   int row_num() const;
   int col_num() const;
-  int load(FILE* is);
+  int stride() const;
+  int type() const;
+  int row_alignment() const;
+  int load(FILE* is, const int type=FP32, const int row_alignment=0);
   int save(FILE* os) const;
-  
-  
- private:
-  int     row_num_;
-  int     col_num_;
-  real_t* data_;
+
+
+ protected:
+  char* row_data(const int row) const;
+  void set_stride();
+  void allocate();
+  void release();
+  void copy(const DenseMatrix& other);
+
+  int   row_num_;
+  int   col_num_;
+  int   stride_;
+  int   type_;
+  int   row_alignment_;
+  char* data_;
+  bool  owner_;
 };
 
 
 inline DenseMatrix::DenseMatrix() {
 
-  row_num_ = 1;
-  col_num_ = 1;
-  posix_memalign((void**)&data_, 128, sizeof(real_t)*row_num_*col_num_);
-  std::fill(data_, data_ + row_num_*col_num_, 0.0);
+  row_num_       = 1;
+  col_num_       = 1;
+  type_          = FP32;
+  row_alignment_ = 0;
+  allocate();
+  std::fill((real_t*)data_, (real_t*)data_ + static_cast<size_t>(row_num_)*col_num_, 0.0);
 }
 
 
-inline DenseMatrix::DenseMatrix(const int row_num, const int col_num, const real_t val) {
+inline DenseMatrix::DenseMatrix(const int row_num, const int col_num, const real_t val, const int type, const int row_alignment) {
 
 #ifdef __YSKIP_DEBUG__
   assert(0 < row_num);
   assert(0 < col_num);
+  assert(0 <= row_alignment && row_alignment <= 128 && 128 % (row_alignment == 0 ? 1 : row_alignment) == 0);
 #endif
-  
-  row_num_ = row_num;
-  col_num_ = col_num;
-  posix_memalign((void**)&data_, 128, sizeof(real_t)*row_num_*col_num_);
-  std::fill(data_, data_ + row_num_*col_num_, val);
+
+  row_num_       = row_num;
+  col_num_       = col_num;
+  type_          = type;
+  row_alignment_ = row_alignment;
+  allocate();
+  if (type_ == FP32) {
+    std::fill((real_t*)data_, (real_t*)data_ + static_cast<size_t>(row_num_)*stride_, val);
+  }else {
+    std::vector<real_t> row(col_num_, val);
+    for (int i = 0; i < row_num_; ++i) {
+      set(i, &row[0]);
+    }
+  }
 }
 
 
 inline DenseMatrix::DenseMatrix(const DenseMatrix& other) {
 
-  row_num_ = other.row_num();
-  col_num_ = other.col_num();
-  posix_memalign((void**)&data_, 128, sizeof(real_t)*row_num_*col_num_);
-  for (int i = 0; i < row_num_; ++i) {
-    std::copy(other[i], other[i] + col_num_, data_+col_num_*i);
-  }
+  copy(other);
 }
 
 
 inline DenseMatrix::~DenseMatrix() {
 
-  free(data_);
+  release();
 }
 
 
 inline DenseMatrix& DenseMatrix::operator=(const DenseMatrix& other) {
 
   if (this != &other) {
-    row_num_ = other.row_num();
-    col_num_ = other.col_num();
+    release();
+    copy(other);
+  }
+  return *this;
+}
+
+
+inline void DenseMatrix::set_stride() {
+
+  const size_t element_size = storage_size(type_);
+  stride_ = col_num_;
+  if (0 < row_alignment_) {
+    const size_t row_size = (element_size*col_num_ + row_alignment_ - 1)/row_alignment_*row_alignment_;
+    stride_ = row_size/element_size;
+  }
+}
+
+
+// allocates rows for the current size, type and alignment
+inline void DenseMatrix::allocate() {
+
+  set_stride();
+  owner_ = true;
+  const size_t size = storage_size(type_)*row_num_*static_cast<size_t>(stride_);
+  posix_memalign((void**)&data_, HUGE_PAGE_SIZE <= size ? HUGE_PAGE_SIZE : 128, size);
+}
+
+
+inline void DenseMatrix::release() {
+
+  if (owner_) {
     free(data_);
-    posix_memalign((void**)&data_, 128, sizeof(real_t)*row_num_*col_num_);
+  }
+}
+
+
+inline void DenseMatrix::copy(const DenseMatrix& other) {
+
+  row_num_       = other.row_num();
+  col_num_       = other.col_num();
+  type_          = other.type();
+  row_alignment_ = other.row_alignment();
+  allocate();
+  if (other.stride() == stride_) {
+    memcpy(data_, other.data_, storage_size(type_)*row_num_*static_cast<size_t>(stride_));
+  }else {
     for (int i = 0; i < row_num_; ++i) {
-      std::copy(other[i], other[i] + col_num_, data_+col_num_*i);
+      memcpy(row_data(i), other.row_data(i), storage_size(type_)*col_num_);
     }
   }
-  return *this;
+}
+
+
+// makes this matrix a view on the columns [col_offset, col_offset + col_num) of base,
+// which must outlive it
+inline void DenseMatrix::view(DenseMatrix& base, const int col_offset, const int col_num) {
+
+#ifdef __YSKIP_DEBUG__
+  assert(0 <= col_offset && col_offset + col_num <= base.col_num());
+#endif
+  release();
+  row_num_       = base.row_num();
+  col_num_       = col_num;
+  stride_        = base.stride();
+  type_          = base.type();
+  row_alignment_ = 0;
+  data_          = base.row_data(0) + storage_size(type_)*col_offset;
+  owner_         = false;
+}
+
+
+inline char* DenseMatrix::row_data(const int row) const {
+
+  return data_ + storage_size(type_)*stride_*static_cast<size_t>(row);
 }
 
 
 inline const real_t* DenseMatrix::operator[](const int row) const {
-  
-  return data_ + col_num_*row;
+
+#ifdef __YSKIP_DEBUG__
+  assert(type_ == FP32);
+#endif
+  return (const real_t*)data_ + static_cast<size_t>(stride_)*row;
 }
 
 
 inline real_t* DenseMatrix::operator[](const int row) {
 
-  return data_ + col_num_*row;
+#ifdef __YSKIP_DEBUG__
+  assert(type_ == FP32);
+#endif
+  return (real_t*)data_ + static_cast<size_t>(stride_)*row;
+}
+
+
+// copies the row to v, converting it to real_t
+inline void DenseMatrix::get(const int row, real_t* v) const {
+
+  switch (type_) {
+  case FP16:
+    vec_kernels().fp16_to_fp32((const uint16_t*)row_data(row), v, col_num_);
+    break;
+  case BF16:
+    vec_kernels().bf16_to_fp32((const uint16_t*)row_data(row), v, col_num_);
+    break;
+  default:
+    memcpy(v, row_data(row), sizeof(real_t)*col_num_);
+  }
+}
+
+
+inline void DenseMatrix::set(const int row, const real_t* v) {
+
+  switch (type_) {
+  case FP16:
+    vec_kernels().fp32_to_fp16(v, (uint16_t*)row_data(row), col_num_);
+    break;
+  case BF16:
+    vec_kernels().fp32_to_bf16(v, (uint16_t*)row_data(row), col_num_);
+    break;
+  default:
+    memcpy(row_data(row), v, sizeof(real_t)*col_num_);
+  }
 }
 
 
@@ -108,42 +276,130 @@ inline int DenseMatrix::row_num() const {
 
   return row_num_;
 }
- 
+
 
 inline int DenseMatrix::col_num() const {
-  
+
   return col_num_;
 }
 
 
+inline int DenseMatrix::stride() const {
+
+  return stride_;
+}
+
+
+inline int DenseMatrix::type() const {
+
+  return type_;
+}
+
+
+inline int DenseMatrix::row_alignment() const {
+
+  return row_alignment_;
+}
+
+
 inline void DenseMatrix::reduce(const std::unordered_set<int>& reserved_rows) {
 
+  const size_t row_size = storage_size(type_)*col_num_;
   int j = 0;
   for (int i = 0; i < row_num_; ++i) {
     if (reserved_rows.find(i) != reserved_rows.end()) {
-      std::copy(data_ + i * col_num_, data_ + (i+1) * col_num_, data_ + j * col_num_);
+      memmove(row_data(j), row_data(i), row_size);
       ++j;
     }
   }
 }
 
 
-inline int DenseMatrix::load(FILE* is) {
+// row i takes the place of row order[i] for i < order.size(), which must be a permutation;
+// rows are moved in place along the cycles of the permutation
+inline void DenseMatrix::permute(const std::vector<int>& order) {
 
-  if (fread(&row_num_, sizeof(int), 1, is) != 1) {
-    return FAILURE;
+  const size_t row_size = storage_size(type_)*col_num_;
+  std::vector<char> row(row_size);
+  std::vector<bool> done(order.size(), false);
+  for (size_t i = 0; i < order.size(); ++i) {
+    if (done[i]) {
+      continue;
+    }
+    memcpy(&row[0], row_data(i), row_size);
+    size_t j = i;
+    while (static_cast<size_t>(order[j]) != i) {
+      memcpy(row_data(j), row_data(order[j]), row_size);
+      done[j] = true;
+      j = order[j];
+    }
+    memcpy(row_data(j), &row[0], row_size);
+    done[j] = true;
+  }
+}
+
+
+// asks the kernel to back the first row_num rows with transparent huge pages,
+// e.g. the rows of frequent words; only whole huge pages are affected
+inline void DenseMatrix::advise_huge_pages(const int row_num) const {
+
+#ifdef MADV_HUGEPAGE
+  const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  const uintptr_t begin     = reinterpret_cast<uintptr_t>(row_data(0));
+  const uintptr_t first     = (begin + HUGE_PAGE_SIZE - 1)/HUGE_PAGE_SIZE*HUGE_PAGE_SIZE;
+  const uintptr_t last      = std::min((reinterpret_cast<uintptr_t>(row_data(std::min(row_num, row_num_))) + HUGE_PAGE_SIZE - 1)/HUGE_PAGE_SIZE*HUGE_PAGE_SIZE,
+				       reinterpret_cast<uintptr_t>(row_data(row_num_))/page_size*page_size);
+  if (first < last) {
+    madvise(reinterpret_cast<void*>(first), last - first, MADV_HUGEPAGE);
   }
-  if (fread(&col_num_, sizeof(int), 1, is) != 1) {
+#endif
+}
+
+
+// spreads the pages of the rows over the NUMA nodes
+inline int DenseMatrix::interleave(const NumaTopology& numa) const {
+
+  return numa.interleave(row_data(0), row_data(row_num_) - row_data(0));
+}
+
+
+// places the rows [first, last) on a NUMA node; pages shared with other rows are left as they are
+inline int DenseMatrix::bind(const NumaTopology& numa, const int first, const int last, const int node) const {
+
+  return numa.bind(row_data(first), row_data(last) - row_data(first), node);
+}
+
+
+// the element type is not stored in the file, so it must be given by the caller
+// as well as the padding of the rows; a view becomes a matrix of its own
+inline int DenseMatrix::load(FILE* is, const int type, const int row_alignment) {
+
+  release();
+  row_alignment_ = row_alignment;
+  if (fread(&row_num_, sizeof(int), 1, is) != 1 || fread(&col_num_, sizeof(int), 1, is) != 1) {
+    row_num_ = 1;
+    col_num_ = 1;
+    type_    = FP32;
+    allocate();
     return FAILURE;
   }
-  free(data_);
-  posix_memalign((void**)&data_, 128, sizeof(real_t)*row_num_*col_num_);
-  if (fread(data_, sizeof(real_t), static_cast<size_t>(row_num_*col_num_), is) != static_cast<size_t>(row_num_*col_num_)) {
+  type_ = type;
+  allocate();
+  if (stride_ != col_num_) {
+    for (int i = 0; i < row_num_; ++i) {
+      if (fread(row_data(i), storage_size(type_), static_cast<size_t>(col_num_), is) != static_cast<size_t>(col_num_)) {
+	return FAILURE;
+      }
+    }
+    return SUCCESS;
+  }
+  const size_t size = static_cast<size_t>(row_num_)*col_num_;
+  if (fread(data_, storage_size(type_), size, is) != size) {
     return FAILURE;
   }
   return SUCCESS;
 }
- 
+
 
 inline int DenseMatrix::save(FILE* os) const {
 
@@ -152,8 +408,17 @@ inline int DenseMatrix::save(FILE* os) const {
   }
   if (fwrite(&col_num_, sizeof(int), 1, os) != 1) {
     return FAILURE;
-  }  
-  if (fwrite(data_, sizeof(real_t), static_cast<size_t>(row_num_*col_num_), os) != static_cast<size_t>(row_num_*col_num_)) {
+  }
+  if (stride_ != col_num_) {
+    for (int i = 0; i < row_num_; ++i) {
+      if (fwrite(row_data(i), storage_size(type_), static_cast<size_t>(col_num_), os) != static_cast<size_t>(col_num_)) {
+	return FAILURE;
+      }
+    }
+    return SUCCESS;
+  }
+  const size_t size = static_cast<size_t>(row_num_)*col_num_;
+  if (fwrite(data_, storage_size(type_), size, os) != size) {
     return FAILURE;
   }
   return SUCCESS;
@@ -165,9 +430,12 @@ inline bool operator==(const DenseMatrix& m1, const DenseMatrix& m2) {
   if (m1.col_num() != m2.col_num() || m1.row_num() != m2.row_num()) {
     return false;
   }
+  std::vector<real_t> v1(m1.col_num()), v2(m2.col_num());
   for (int i = 0; i < m1.row_num(); ++i) {
+    m1.get(i, &v1[0]);
+    m2.get(i, &v2[0]);
     for (int j = 0; j < m1.col_num(); ++j) {
-      if (approx_equal(m1[i][j], m2[i][j]) == false) {
+      if (approx_equal(v1[j], v2[j]) == false) {
 	return false;
       }
     }
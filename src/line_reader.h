@@ -0,0 +1,108 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#pragma once
+#include <stdio.h>
+#include <cstring> // memchr, memmove
+#include <vector>
+#include "util.h"
+
+
+namespace yskip {
+
+
+//
+// Reads the lines of a text file in blocks of block_size bytes, finding each
+// newline with one memchr(), which the C library scans with SIMD, rather than
+// with fgets() and strlen() per line. A line longer than a block is returned
+// whole, the buffer growing to hold it, and a last line without a newline is
+// returned as it is.
+//
+// A line is a span of the reader's buffer without its newline, which is
+// replaced by a null character so that the line is also a C string. It is
+// valid until the next call of next().
+//
+class LineReader {
+ public:
+  explicit LineReader(FILE* is, const size_t block_size=BUFF_SIZE);
+  ~LineReader() {};
+  bool next(Span& line);
+
+ private:
+  void fill();
+
+  FILE*             is_;
+  size_t            block_size_;
+  std::vector<char> buff_;    // always has a spare byte after end_
+  size_t            begin_;   // the first byte not returned yet
+  size_t            scanned_; // [begin_, scanned_) has no newline
+  size_t            end_;     // the end of the bytes read
+  bool              eof_;
+  DISALLOW_COPY_AND_ASSIGN(LineReader);
+};
+
+
+inline LineReader::LineReader(FILE* is, const size_t block_size) : buff_(block_size + 1) {
+
+#ifdef __YSKIP_DEBUG__
+  assert(0 < block_size);
+#endif
+  is_         = is;
+  block_size_ = block_size;
+  begin_      = 0;
+  scanned_    = 0;
+  end_        = 0;
+  eof_        = false;
+}
+
+
+// returns false at the end of the file
+inline bool LineReader::next(Span& line) {
+
+  while (1) {
+    char* newline = static_cast<char*>(memchr(&buff_[scanned_], '\n', end_ - scanned_));
+    if (newline != NULL) {
+      *newline   = '\0';
+      line.begin = &buff_[begin_];
+      line.end   = newline;
+      begin_     = newline - &buff_[0] + 1;
+      scanned_   = begin_;
+      return true;
+    }
+    scanned_ = end_;
+    if (eof_) {
+      if (begin_ == end_) {
+	return false;
+      }
+      buff_[end_] = '\0';
+      line.begin  = &buff_[begin_];
+      line.end    = &buff_[end_];
+      begin_      = end_;
+      scanned_    = end_;
+      return true;
+    }
+    fill();
+  }
+}
+
+
+// moves the rest of the current line to the front and reads the next block after it
+inline void LineReader::fill() {
+
+  const size_t rest = end_ - begin_;
+  memmove(&buff_[0], &buff_[begin_], rest);
+  scanned_ -= begin_;
+  begin_    = 0;
+  end_      = rest;
+  if (buff_.size() < end_ + block_size_ + 1) {
+    buff_.resize(end_ + block_size_ + 1);
+  }
+  const size_t n = fread(&buff_[end_], sizeof(char), block_size_, is_);
+  end_ += n;
+  if (n < block_size_) {
+    eof_ = true;
+  }
+}
+
+
+}
@@ -0,0 +1,227 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#pragma once
+#include <stdio.h>
+#include <stdint.h>    // uintptr_t
+#include <stdlib.h>    // strtol
+#include <unistd.h>    // sysconf, syscall
+#include <pthread.h>
+#include <sched.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <thread>
+#include "util.h"
+
+
+namespace yskip {
+
+
+// how the parameters are placed on the NUMA nodes (see NumaTopology)
+enum NumaMode {
+  NUMA_OFF        = 0, // where the thread that first touches a page runs, i.e. the main thread
+  NUMA_INTERLEAVE = 1, // pages spread round-robin over the nodes
+  NUMA_PARTITION  = 2, // contiguous ranges of rows, one per node
+};
+
+
+// parses a list of CPUs or nodes such as "0-3,8,10-11" as found in sysfs; returns an empty list if it is malformed
+inline std::vector<int> parse_cpu_list(const char* s) {
+
+  std::vector<int> cpus;
+  char* end;
+  while (*s != '\0' && *s != '\n') {
+    const long first = strtol(s, &end, 10);
+    if (end == s || first < 0) {
+      return std::vector<int>();
+    }
+    long last = first;
+    s = end;
+    if (*s == '-') {
+      ++s;
+      last = strtol(s, &end, 10);
+      if (end == s || last < first) {
+	return std::vector<int>();
+      }
+      s = end;
+    }
+    for (long cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+    if (*s == ',') {
+      ++s;
+    }else if (*s != '\0' && *s != '\n') {
+      return std::vector<int>();
+    }
+  }
+  return cpus;
+}
+
+
+//
+// NUMA nodes of the machine and their CPUs, read from sysfs. Nodes without
+// CPUs are left out. A machine without NUMA, or whose sysfs cannot be read,
+// is a single node, on which pinning and placement do nothing, so that the
+// NUMA options are safe everywhere.
+//
+// Workers are spread over the nodes in contiguous blocks of ids, worker i
+// of n running on node i*node_num()/n, and within a node on its CPUs in turn.
+//
+class NumaTopology {
+ public:
+  explicit NumaTopology(const char* node_dir="/sys/devices/system/node");
+  ~NumaTopology() {};
+  int node_num() const;
+  const std::vector<int>& cpus(const int node) const;
+  int worker_node(const int id, const int worker_num) const;
+  int worker_cpu(const int id, const int worker_num) const;
+  int pin_worker(const int id, const int worker_num) const;
+  int interleave(const void* addr, const size_t size) const;
+  int bind(const void* addr, const size_t size, const int node) const;
+
+ private:
+  std::vector<int>              ids_;  // node ids of the kernel
+  std::vector<std::vector<int>> cpus_;
+};
+
+
+// returns the list in the first line of a sysfs file, or an empty list if it cannot be read
+inline std::vector<int> read_cpu_list(const std::string& path) {
+
+  std::vector<int> list;
+  FILE* is = fopen(path.c_str(), "r");
+  if (is == NULL) {
+    return list;
+  }
+  char line[BUFF_SIZE];
+  if (fgets(line, BUFF_SIZE, is) != NULL) {
+    list = parse_cpu_list(line);
+  }
+  fclose(is);
+  return list;
+}
+
+
+inline NumaTopology::NumaTopology(const char* node_dir) {
+
+  const std::vector<int> nodes = read_cpu_list(std::string(node_dir) + "/online");
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    const std::vector<int> cpus = read_cpu_list(std::string(node_dir) + "/node" + std::to_string(nodes[i]) + "/cpulist");
+    if (!cpus.empty()) {
+      ids_.push_back(nodes[i]);
+      cpus_.push_back(cpus);
+    }
+  }
+  if (cpus_.size() <= 1) {
+    ids_.assign(1, 0);
+    cpus_.assign(1, std::vector<int>());
+    for (unsigned int cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu) {
+      cpus_[0].push_back(cpu);
+    }
+  }
+}
+
+
+inline int NumaTopology::node_num() const {
+
+  return cpus_.size();
+}
+
+
+inline const std::vector<int>& NumaTopology::cpus(const int node) const {
+
+  return cpus_[node];
+}
+
+
+inline int NumaTopology::worker_node(const int id, const int worker_num) const {
+
+  return static_cast<int64_t>(id)*node_num()/worker_num;
+}
+
+
+inline int NumaTopology::worker_cpu(const int id, const int worker_num) const {
+
+  const int node = worker_node(id, worker_num);
+  int first = 0; // the first worker on the node
+  while (worker_node(first, worker_num) != node) {
+    ++first;
+  }
+  return cpus_[node][(id - first)%cpus_[node].size()];
+}
+
+
+// pins the calling thread, worker `id` of worker_num, to its CPU
+inline int NumaTopology::pin_worker(const int id, const int worker_num) const {
+
+  if (node_num() == 1) {
+    return SUCCESS;
+  }
+#ifdef __linux__
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(worker_cpu(id, worker_num), &cpu_set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0) {
+    return FAILURE;
+  }
+#endif
+  return SUCCESS;
+}
+
+
+// mbind(2) on the whole pages of [addr, addr + size); pages already touched are moved
+inline int mbind_pages(const void* addr, const size_t size, const int mode, const std::vector<int>& nodes) {
+
+#if defined(__linux__) && defined(SYS_mbind)
+  const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  const uintptr_t first = (reinterpret_cast<uintptr_t>(addr) + page_size - 1)/page_size*page_size;
+  const uintptr_t last  = (reinterpret_cast<uintptr_t>(addr) + size)/page_size*page_size;
+  if (last <= first) {
+    return SUCCESS;
+  }
+  std::vector<unsigned long> mask(1 + *std::max_element(nodes.begin(), nodes.end())/(8*sizeof(unsigned long)), 0);
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    mask[nodes[i]/(8*sizeof(unsigned long))] |= 1ul << (nodes[i]%(8*sizeof(unsigned long)));
+  }
+  if (syscall(SYS_mbind, first, last - first, mode, &mask[0], 8*sizeof(unsigned long)*mask.size() + 1, MPOL_MF_MOVE) != 0) {
+    return FAILURE;
+  }
+#endif
+  return SUCCESS;
+}
+
+
+// spreads the pages of [addr, addr + size) over all nodes
+inline int NumaTopology::interleave(const void* addr, const size_t size) const {
+
+  if (node_num() == 1) {
+    return SUCCESS;
+  }
+#ifdef __linux__
+  return mbind_pages(addr, size, MPOL_INTERLEAVE, ids_);
+#else
+  return SUCCESS;
+#endif
+}
+
+
+// places the pages of [addr, addr + size) on `node` if it has free memory
+inline int NumaTopology::bind(const void* addr, const size_t size, const int node) const {
+
+  if (node_num() == 1) {
+    return SUCCESS;
+  }
+#ifdef __linux__
+  return mbind_pages(addr, size, MPOL_PREFERRED, std::vector<int>(1, ids_[node]));
+#else
+  return SUCCESS;
+#endif
+}
+
+
+}
@@ -0,0 +1,258 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#pragma once
+#include <vector>
+#include <memory>
+#include <atomic>
+#include "util.h"
+#include "spsc_queue.h"
+
+
+namespace yskip {
+
+
+// output row `row` is to be updated with the gradient g times the input vector of `word`
+struct OutputUpdate {
+  int    row;
+  int    word;
+  real_t g;
+};
+typedef std::vector<OutputUpdate> OutputUpdateBatch;
+
+
+//
+// Output rows partitioned among part_num workers by word index, row w being
+// owned by worker w % part_num, so that the hottest rows of a vocabulary
+// sorted by frequency are spread evenly. Only the owner of a row writes it;
+// the other workers send it their updates in batches through one lock-free
+// queue per (sender, owner) pair.
+//
+// The workers must call arrive() once each at the end of a task, after their
+// last send, and keep receiving until all_arrived(round) for their round.
+//
+class OutputPartition {
+ public:
+  OutputPartition(const int part_num, const int batch_size=256, const int queue_capacity=8);
+  ~OutputPartition() {};
+  int part_num() const;
+  int batch_size() const;
+  int owner(const int row) const;
+  bool push(const int from, const int to, OutputUpdateBatch& batch);
+  bool pop(const int from, const int to, OutputUpdateBatch& batch);
+  void arrive();
+  bool all_arrived(const uint64_t round) const;
+
+ private:
+  typedef SpscQueue<OutputUpdateBatch> Queue;
+  int                                 part_num_;
+  int                                 batch_size_;
+  std::vector<std::unique_ptr<Queue>> queues_; // queues_[to*part_num_ + from]
+  std::atomic<uint64_t>               arrived_num_;
+  DISALLOW_COPY_AND_ASSIGN(OutputPartition);
+};
+
+
+inline OutputPartition::OutputPartition(const int part_num, const int batch_size, const int queue_capacity) : arrived_num_(0) {
+
+#ifdef __YSKIP_DEBUG__
+  assert(0 < part_num);
+  assert(0 < batch_size);
+#endif
+  part_num_   = part_num;
+  batch_size_ = batch_size;
+  for (int i = 0; i < part_num_*part_num_; ++i) {
+    queues_.push_back(std::unique_ptr<Queue>(new Queue(queue_capacity)));
+  }
+}
+
+
+inline int OutputPartition::part_num() const {
+
+  return part_num_;
+}
+
+
+inline int OutputPartition::batch_size() const {
+
+  return batch_size_;
+}
+
+
+inline int OutputPartition::owner(const int row) const {
+
+  return row%part_num_;
+}
+
+
+// returns false if the queue is full, leaving batch as it is
+inline bool OutputPartition::push(const int from, const int to, OutputUpdateBatch& batch) {
+
+  return queues_[to*part_num_ + from]->push(batch);
+}
+
+
+// batch should be empty, since it is handed back to the sender
+inline bool OutputPartition::pop(const int from, const int to, OutputUpdateBatch& batch) {
+
+  return queues_[to*part_num_ + from]->pop(batch);
+}
+
+
+inline void OutputPartition::arrive() {
+
+  arrived_num_.fetch_add(1, std::memory_order_acq_rel);
+}
+
+
+// whether every worker has arrived `round` times, i.e. sent everything of the round-th task
+inline bool OutputPartition::all_arrived(const uint64_t round) const {
+
+  return round*part_num_ <= arrived_num_.load(std::memory_order_acquire);
+}
+
+
+//
+// A worker's end of an OutputPartition: its outgoing batches, one per owner,
+// the batch it received last and a buffer for applying it (see
+// Skipgram::receive_updates()).
+// A router without a partition, or with a partition of one, is disabled and
+// the worker updates every row itself.
+//
+class OutputRouter {
+ public:
+  OutputRouter();
+  ~OutputRouter() {};
+  void initialize(const std::shared_ptr<OutputPartition>& partition, const int id, const int vec_size);
+  bool enabled() const;
+  int part_num() const;
+  int owner(const int row) const;
+  bool owns(const int row) const;
+  bool add(const OutputUpdate& update);
+  bool flush(const int to);
+  const OutputUpdateBatch* receive();
+  void arrive();
+  bool all_arrived() const;
+  real_t* buffer();
+
+ private:
+  std::shared_ptr<OutputPartition> partition_;
+  int                              id_;
+  int                              next_sender_;
+  uint64_t                         round_;
+  std::vector<OutputUpdateBatch>   outgoing_;
+  OutputUpdateBatch                incoming_;
+  std::vector<real_t>              buffer_;
+  DISALLOW_COPY_AND_ASSIGN(OutputRouter);
+};
+
+
+inline OutputRouter::OutputRouter() {
+
+  id_          = 0;
+  next_sender_ = 0;
+  round_       = 0;
+}
+
+
+inline void OutputRouter::initialize(const std::shared_ptr<OutputPartition>& partition, const int id, const int vec_size) {
+
+  partition_   = partition;
+  id_          = id;
+  next_sender_ = 0;
+  round_       = 0;
+  outgoing_.clear();
+  outgoing_.resize(partition_->part_num());
+  for (size_t i = 0; i < outgoing_.size(); ++i) {
+    outgoing_[i].reserve(partition_->batch_size());
+  }
+  buffer_.resize(vec_size);
+}
+
+
+inline bool OutputRouter::enabled() const {
+
+  return partition_ && 1 < partition_->part_num();
+}
+
+
+inline int OutputRouter::part_num() const {
+
+  return partition_->part_num();
+}
+
+
+inline int OutputRouter::owner(const int row) const {
+
+  return partition_->owner(row);
+}
+
+
+inline bool OutputRouter::owns(const int row) const {
+
+  return partition_->owner(row) == id_;
+}
+
+
+// queues an update for the owner of its row; returns true if the batch to that owner is full and should be flushed
+inline bool OutputRouter::add(const OutputUpdate& update) {
+
+  OutputUpdateBatch& batch = outgoing_[owner(update.row)];
+  batch.push_back(update);
+  return partition_->batch_size() <= static_cast<int>(batch.size());
+}
+
+
+// sends the batch to worker `to` unless it is empty; returns false if its queue is full
+inline bool OutputRouter::flush(const int to) {
+
+  OutputUpdateBatch& batch = outgoing_[to];
+  if (batch.empty()) {
+    return true;
+  }
+  if (!partition_->push(id_, to, batch)) {
+    return false;
+  }
+  batch.clear(); // the buffer of a batch the owner has applied
+  return true;
+}
+
+
+// takes a batch sent to this worker, visiting the senders in turn; returns NULL if there is none
+inline const OutputUpdateBatch* OutputRouter::receive() {
+
+  const int n = partition_->part_num();
+  incoming_.clear();
+  for (int i = 0; i < n; ++i) {
+    const int from = next_sender_;
+    next_sender_ = next_sender_ + 1 == n ? 0 : next_sender_ + 1;
+    if (partition_->pop(from, id_, incoming_)) {
+      return &incoming_;
+    }
+  }
+  return NULL;
+}
+
+
+// tells the other workers that this one has flushed all of its batches of the current task
+inline void OutputRouter::arrive() {
+
+  ++round_;
+  partition_->arrive();
+}
+
+
+inline bool OutputRouter::all_arrived() const {
+
+  return partition_->all_arrived(round_);
+}
+
+
+// vec_size elements of working memory for the owner
+inline real_t* OutputRouter::buffer() {
+
+  return &buffer_[0];
+}
+
+
+}
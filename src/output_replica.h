@@ -0,0 +1,216 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#pragma once
+#include <algorithm>
+#include "util.h"
+#include "dense_matrix.h"
+
+
+namespace yskip {
+
+
+//
+// Rows of a shared matrix, of which the first row_num() are private copies.
+// pull() copies the shared rows and keeps a snapshot of them; push() adds
+// what changed locally since then (local - snapshot) to the shared rows, so
+// that the updates other threads made in the meantime are kept.
+//
+class ReplicatedRows {
+ public:
+  ReplicatedRows();
+  ~ReplicatedRows() {};
+  void initialize(DenseMatrix& shared, const int capacity);
+  real_t* operator[](const int row);
+  int row_num() const;
+  void pull(const int row_num);
+  void push();
+  void bind(const NumaTopology& numa, const int node);
+
+ private:
+  DenseMatrix* shared_;
+  DenseMatrix  local_;
+  DenseMatrix  snapshot_;
+  int          capacity_;
+  int          row_num_;
+  DISALLOW_COPY_AND_ASSIGN(ReplicatedRows);
+};
+
+
+inline ReplicatedRows::ReplicatedRows() {
+
+  shared_   = NULL;
+  capacity_ = 0;
+  row_num_  = 0;
+}
+
+
+// at most `capacity` rows of `shared`, an FP32 matrix, are to be replicated
+inline void ReplicatedRows::initialize(DenseMatrix& shared, const int capacity) {
+
+#ifdef __YSKIP_DEBUG__
+  assert(shared.type() == FP32);
+#endif
+  shared_   = &shared;
+  capacity_ = std::min(capacity, shared.row_num());
+  row_num_  = 0;
+  if (0 < capacity_) {
+    local_    = DenseMatrix(capacity_, shared.col_num());
+    snapshot_ = DenseMatrix(capacity_, shared.col_num());
+  }
+}
+
+
+inline real_t* ReplicatedRows::operator[](const int row) {
+
+  return row < row_num_ ? local_[row] : (*shared_)[row];
+}
+
+
+inline int ReplicatedRows::row_num() const {
+
+  return row_num_;
+}
+
+
+// replicates the first row_num rows (at most the capacity)
+inline void ReplicatedRows::pull(const int row_num) {
+
+  row_num_ = std::min(row_num, capacity_);
+  const size_t row_size = sizeof(real_t)*shared_->col_num();
+  for (int i = 0; i < row_num_; ++i) {
+    memcpy(local_[i], (*shared_)[i], row_size);
+    memcpy(snapshot_[i], local_[i], row_size);
+  }
+}
+
+
+// adds the local changes to the shared rows; rows are not replicated until the next pull()
+inline void ReplicatedRows::push() {
+
+  const int n = shared_ == NULL ? 0 : shared_->col_num();
+  for (int i = 0; i < row_num_; ++i) {
+    real_t* x = (*shared_)[i];
+    const real_t* y = local_[i];
+    const real_t* y0 = snapshot_[i];
+    for (int j = 0; j < n; ++j) {
+      x[j] += y[j] - y0[j];
+    }
+  }
+  row_num_ = 0;
+}
+
+
+// places the copies on a NUMA node, i.e. that of the worker using them
+inline void ReplicatedRows::bind(const NumaTopology& numa, const int node) {
+
+  if (0 < capacity_) {
+    local_.bind(numa, 0, capacity_, node);
+    snapshot_.bind(numa, 0, capacity_, node);
+  }
+}
+
+
+//
+// A worker's private copies of the first rows of the output vectors and of
+// their optimizer state, i.e. of the most frequent words if the vocabulary
+// is sorted by frequency (see Skipgram::sort_vocab()). These words are drawn
+// as negative samples by every thread all the time, so in Hogwild training
+// their cache lines keep moving between cores; with replicas each thread
+// updates its own copies and merges them into the shared rows every
+// sync_interval updates.
+//
+// Only the thread owning a replica may use it, except that push() may be
+// called by another thread while the owner is known to be idle, e.g. after
+// a mini-batch. The replica is then pulled again before its next use.
+//
+class OutputReplica {
+ public:
+  ReplicatedRows output;
+  ReplicatedRows squared_output;
+
+  OutputReplica();
+  ~OutputReplica() {};
+  void initialize(DenseMatrix& output, DenseMatrix& squared_output, const int row_num, const int sync_interval);
+  bool enabled() const;
+  bool pulled() const;
+  void pull(const int row_num);
+  void push();
+  bool count_update();
+  void bind(const NumaTopology& numa, const int node);
+
+ private:
+  int  capacity_;
+  int  sync_interval_;
+  int  update_num_;
+  bool pulled_;
+  DISALLOW_COPY_AND_ASSIGN(OutputReplica);
+};
+
+
+inline OutputReplica::OutputReplica() {
+
+  capacity_      = 0;
+  sync_interval_ = 0;
+  update_num_    = 0;
+  pulled_        = false;
+}
+
+
+// squared_output is not replicated if it has fewer rows than output, i.e. if the optimizer keeps no state
+inline void OutputReplica::initialize(DenseMatrix& output, DenseMatrix& squared_output, const int row_num, const int sync_interval) {
+
+  capacity_      = row_num;
+  sync_interval_ = sync_interval;
+  update_num_    = 0;
+  pulled_        = false;
+  this->output.initialize(output, row_num);
+  this->squared_output.initialize(squared_output, squared_output.row_num() < output.row_num() ? 0 : row_num);
+}
+
+
+inline bool OutputReplica::enabled() const {
+
+  return 0 < capacity_;
+}
+
+
+inline bool OutputReplica::pulled() const {
+
+  return pulled_;
+}
+
+
+// replicates the first row_num rows, e.g. those of the words in the vocabulary
+inline void OutputReplica::pull(const int row_num) {
+
+  output.pull(row_num);
+  squared_output.pull(row_num);
+  update_num_ = 0;
+  pulled_     = true;
+}
+
+
+inline void OutputReplica::push() {
+
+  output.push();
+  squared_output.push();
+  pulled_ = false;
+}
+
+
+// returns true if the replica is due for a push() and pull()
+inline bool OutputReplica::count_update() {
+
+  return sync_interval_ <= ++update_num_;
+}
+
+
+inline void OutputReplica::bind(const NumaTopology& numa, const int node) {
+
+  output.bind(numa, node);
+  squared_output.bind(numa, node);
+}
+
+
+}
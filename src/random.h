@@ -3,50 +3,127 @@
  *******************************************/
 #pragma once
 #include <math.h> // ceil, floor
-#include <random> // mt19937
+#include <random>
+#include <limits>
 #include "util.h"
 
 
 namespace yskip {
 
 
+//
+// xoshiro256** generator.
+// Random(seed, stream) gives statistically independent streams for the
+// same seed, e.g. one per worker thread, so that each thread owns its
+// generator and runs stay reproducible for a fixed seed.
+//
 class Random {
  public:
   Random();
   Random(const int seed);
+  Random(const int seed, const uint64_t stream);
   ~Random() {};
+  void seed(const int seed, const uint64_t stream=0);
+  uint64_t next();
   int uniform(const int min, const int max);
+  int64_t uniform(const int64_t min, const int64_t max);
   template<class T> T uniform(const T min, const T max);
-  template<class T> int round(const T x);
-  
+  template<class T> int64_t round(const T x);
+  void fill(int* first, int* last, const int min, const int max);
+  template<class T> void fill(T* first, T* last, const T min, const T max);
+
  private:
   DISALLOW_COPY_AND_ASSIGN(Random);
-  std::mt19937 mt_;
+  uint64_t state_[4];
 };
 
 
+inline uint64_t splitmix64(uint64_t& x) {
+
+  uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+
+inline uint64_t rotl(const uint64_t x, const int k) {
+
+  return (x << k) | (x >> (64 - k));
+}
+
+
 inline Random::Random() {
 
-  mt_ = std::mt19937(0);
+  seed(0);
 }
 
 
 inline Random::Random(const int seed) {
 
-  mt_ = std::mt19937(seed);
+  this->seed(seed);
 }
- 
 
+
+inline Random::Random(const int seed, const uint64_t stream) {
+
+  this->seed(seed, stream);
+}
+
+
+inline void Random::seed(const int seed, const uint64_t stream) {
+
+  uint64_t x = static_cast<uint64_t>(static_cast<uint32_t>(seed));
+  x = splitmix64(x) ^ stream;
+  for (int i = 0; i < 4; ++i) {
+    state_[i] = splitmix64(x);
+  }
+}
+
+
+inline uint64_t Random::next() {
+
+  const uint64_t result = rotl(state_[1] * 5, 7) * 9;
+  const uint64_t t = state_[1] << 17;
+  state_[2] ^= state_[0];
+  state_[3] ^= state_[1];
+  state_[1] ^= state_[2];
+  state_[0] ^= state_[3];
+  state_[2] ^= t;
+  state_[3] = rotl(state_[3], 45);
+  return result;
+}
+
+
+// uniform integer in [min, max), using multiply-shift instead of modulo
 inline int Random::uniform(const int min, const int max) {
 
 #ifdef __YSKIP_DEBUG__
   assert(min < max);
 #endif
-  
-  return min + mt_()%(max - min);
+
+  const uint64_t range = static_cast<uint32_t>(max - min);
+  return min + static_cast<int>(((next() >> 32) * range) >> 32);
 }
 
 
+// same as above for ranges of 2^32 or more, e.g. indices of huge tables;
+// smaller ranges give the same numbers as the int version
+inline int64_t Random::uniform(const int64_t min, const int64_t max) {
+
+#ifdef __YSKIP_DEBUG__
+  assert(min < max);
+#endif
+
+  const uint64_t range = static_cast<uint64_t>(max - min);
+  if (range <= 0xffffffffULL) {
+    return min + static_cast<int64_t>(((next() >> 32) * range) >> 32);
+  }
+  return min + static_cast<int64_t>((static_cast<unsigned __int128>(next()) * range) >> 64);
+}
+
+
+// uniform real number in [min, max)
 template<class T>
 inline T Random::uniform(const T min, const T max) {
 
@@ -54,15 +131,17 @@ inline T Random::uniform(const T min, const T max) {
   assert(min < max);
 #endif
 
-  return min + (max - min)*static_cast<T>(mt_())/static_cast<T>(mt_.max() - mt_.min());
+  const int digits = std::numeric_limits<T>::digits;
+  const T scale = static_cast<T>(1.0)/static_cast<T>(static_cast<uint64_t>(1) << digits);
+  return min + (max - min)*static_cast<T>(next() >> (64 - digits))*scale;
 }
 
 
 template<class T>
-inline int Random::round(const T x) {
+inline int64_t Random::round(const T x) {
 
-  int c = ceil(x);
-  int f = floor(x);
+  int64_t c = ceil(x);
+  int64_t f = floor(x);
   if (uniform(0.0, 1.0) < x - static_cast<double>(f)) {
     return c;
   }else {
@@ -70,5 +149,22 @@ inline int Random::round(const T x) {
   }
 }
 
- 
+
+inline void Random::fill(int* first, int* last, const int min, const int max) {
+
+  for (int* it = first; it != last; ++it) {
+    *it = uniform(min, max);
+  }
+}
+
+
+template<class T>
+inline void Random::fill(T* first, T* last, const T min, const T max) {
+
+  for (T* it = first; it != last; ++it) {
+    *it = uniform(min, max);
+  }
+}
+
+
 }
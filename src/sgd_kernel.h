@@ -0,0 +1,195 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#pragma once
+#include <cstring> // strcmp
+#include <algorithm>
+#include "util.h"
+#include "simd.h"
+#include "fast_sigmoid.h"
+#include "dense_matrix.h"
+
+
+namespace yskip {
+
+
+//
+// Optimizers and the state they keep for every parameter vector:
+//  ADAGRAD:     squared gradient sum of each coordinate (the same size as the vector)
+//  ROW_ADAGRAD: mean squared gradient sum of the row (a single value)
+//  SGD:         nothing; the learning rate is decayed linearly instead
+//
+enum Optimizer {
+  ADAGRAD     = 0,
+  ROW_ADAGRAD = 1,
+  SGD         = 2,
+};
+
+
+// number of elements of optimizer state per row
+inline int optimizer_state_size(const int optimizer, const int vec_size) {
+
+  switch (optimizer) {
+  case ADAGRAD:
+    return vec_size;
+  case ROW_ADAGRAD:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+
+//
+// SGD update for one (target, context, negative samples) tuple, i.e. the body
+// of Skipgram::sgd(), specialized on the dimensionality D of the vectors and
+// on the optimizer O.
+// With D fixed at compile time the kernels of simd.h are inlined with a
+// constant length, so their loops are fully unrolled and the vectors can be
+// kept in registers. SgdKernel<0, O> takes the length from the matrices and
+// handles any other dimensionality.
+//
+// The template is instantiated once per instruction set, since the kernels
+// can only be inlined into a function compiled for the same target.
+//
+// The output rows are taken from any Output with real_t* operator[](int),
+// e.g. a worker's replicas of the hottest rows (see output_replica.h).
+//
+// eta: learning rate
+// squared_input, squared_output: optimizer state (unused by SGD)
+//
+template<class Output>
+struct SgdFunctionOf {
+  typedef void (*type)(const real_t eta, const int t, const int c, const int* neg_samples, const int neg_sample_num, DenseMatrix& input, Output& output, DenseMatrix& squared_input, Output& squared_output, real_t* grad);
+};
+typedef SgdFunctionOf<DenseMatrix>::type SgdFunction;
+
+
+#define YSKIP_SGD_KERNEL(TARGET)					\
+  template<int D, int O>						\
+  struct SgdKernel {							\
+    template<class Output>						\
+    TARGET static void update(const real_t eta, const int t, const int c, const int* neg_samples, const int neg_sample_num, DenseMatrix& input, Output& output, DenseMatrix& squared_input, Output& squared_output, real_t* grad) { \
+									\
+      const int n = D == 0 ? input.col_num() : D;			\
+      const real_t* x = input[t];					\
+      const real_t xx = O == ROW_ADAGRAD ? dot(x, x, n)/n : 0.0;	\
+      std::fill(grad, grad + n, 0.0);					\
+									\
+      /* positive example, then negative examples */			\
+      for (int k = -1; k < neg_sample_num; ++k) {			\
+	const int v = k == -1 ? c : neg_samples[k];			\
+	const double g = sigmoid(dot(x, output[v], n)) - (k == -1 ? 1.0 : 0.0); \
+	if (O == ADAGRAD) {						\
+	  update_output(g, g*g, eta*g, x, output[v], squared_output[v], grad, n); \
+	}else if (O == ROW_ADAGRAD) {					\
+	  real_t& s = squared_output[v][0];				\
+	  s += g*g*xx;							\
+	  update_output_sgd(g, eta*yskip::invsqrt(s)*g, x, output[v], grad, n); \
+	}else {								\
+	  update_output_sgd(g, eta*g, x, output[v], grad, n);		\
+	}								\
+      }									\
+									\
+      if (O == ADAGRAD) {						\
+	update_input(eta, grad, squared_input[t], input[t], n);		\
+      }else if (O == ROW_ADAGRAD) {					\
+	real_t& s = squared_input[t][0];				\
+	s += dot(grad, grad, n)/n;					\
+	axpy(-eta*yskip::invsqrt(s), grad, input[t], n);		\
+      }else {								\
+	axpy(-eta, grad, input[t], n);					\
+      }									\
+    }									\
+  };
+
+
+namespace scalar {
+YSKIP_SGD_KERNEL()
+}
+
+
+#ifdef YSKIP_X86
+namespace sse {
+YSKIP_SGD_KERNEL(__attribute__((target("sse2"))))
+}
+
+
+namespace avx2 {
+YSKIP_SGD_KERNEL(__attribute__((target("avx2,fma"))))
+}
+
+
+namespace avx512 {
+YSKIP_SGD_KERNEL(__attribute__((target("avx512f"))))
+}
+#endif
+
+
+#undef YSKIP_SGD_KERNEL
+
+
+template<template<int, int> class Kernel, int O, class Output>
+inline typename SgdFunctionOf<Output>::type find_sgd_kernel(const int vec_size) {
+
+  switch (vec_size) {
+  case 100:
+    return &Kernel<100, O>::template update<Output>;
+  case 200:
+    return &Kernel<200, O>::template update<Output>;
+  case 300:
+    return &Kernel<300, O>::template update<Output>;
+  default:
+    return &Kernel<0, O>::template update<Output>;
+  }
+}
+
+
+template<template<int, int> class Kernel, class Output>
+inline typename SgdFunctionOf<Output>::type find_sgd_kernel(const int vec_size, const int optimizer) {
+
+  switch (optimizer) {
+  case ADAGRAD:
+    return find_sgd_kernel<Kernel, ADAGRAD, Output>(vec_size);
+  case ROW_ADAGRAD:
+    return find_sgd_kernel<Kernel, ROW_ADAGRAD, Output>(vec_size);
+  default:
+    return find_sgd_kernel<Kernel, SGD, Output>(vec_size);
+  }
+}
+
+
+// returns NULL if the instruction set is unknown or not supported by this CPU
+template<class Output=DenseMatrix>
+inline typename SgdFunctionOf<Output>::type find_sgd_kernel(const char* isa, const int vec_size, const int optimizer=ADAGRAD) {
+
+  if (find_vec_kernels(isa) == NULL) {
+    return NULL;
+  }
+  if (strcmp(isa, "scalar") == 0) {
+    return find_sgd_kernel<scalar::SgdKernel, Output>(vec_size, optimizer);
+  }
+#ifdef YSKIP_X86
+  if (strcmp(isa, "sse") == 0) {
+    return find_sgd_kernel<sse::SgdKernel, Output>(vec_size, optimizer);
+  }
+  if (strcmp(isa, "avx2") == 0) {
+    return find_sgd_kernel<avx2::SgdKernel, Output>(vec_size, optimizer);
+  }
+  if (strcmp(isa, "avx512") == 0) {
+    return find_sgd_kernel<avx512::SgdKernel, Output>(vec_size, optimizer);
+  }
+#endif
+  return NULL;
+}
+
+
+// kernel for the instruction set selected by vec_kernels()
+template<class Output=DenseMatrix>
+inline typename SgdFunctionOf<Output>::type sgd_kernel(const int vec_size, const int optimizer=ADAGRAD) {
+
+  return find_sgd_kernel<Output>(vec_kernels().name, vec_size, optimizer);
+}
+
+
+}
@@ -0,0 +1,906 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#pragma once
+#include <stdlib.h> // getenv
+#include <cstring>  // strcmp, memcpy
+#include <cmath>    // nearbyint
+#include "util.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define YSKIP_X86 1
+#include <immintrin.h>
+#endif
+
+
+namespace yskip {
+
+
+//
+// Vector kernels used in SGD, implemented for several instruction sets.
+// One set is chosen at startup from the CPU features (see vec_kernels()).
+//
+//  dot:      returns sum_i x[i]*y[i]
+//  axpy:     y[i] += a*x[i]
+//  mul_add:  z[i] += x[i]*y[i]
+//  mul_add2: z[i] += a*x[i]*y[i]
+//  adagrad:  p[i] -= eta*invsqrt(s[i])*g[i]
+//
+//  update_output: fused AdaGrad update of an output vector o (with squared
+//                 gradient sum s) against the input vector x, which also
+//                 accumulates the input gradient; in a single pass it does
+//                   grad[i] += g*o[i]; s[i] += gg*x[i]*x[i]; o[i] -= eta_g*invsqrt(s[i])*x[i]
+//                 i.e. axpy, mul_add2 and adagrad applied in this order
+//  update_input:  fused AdaGrad update of the input vector x with grad;
+//                   s[i] += grad[i]*grad[i]; x[i] -= eta*invsqrt(s[i])*grad[i]
+//  dots:     z[j] = dot(x, ys[j]) for j < m; x is loaded once for a block of rows
+//  update_output_sgd: same as update_output with a learning rate that does not
+//                 depend on i (plain SGD and row-wise AdaGrad);
+//                   grad[i] += g*o[i]; o[i] -= a*x[i]
+//  fp16_to_fp32, fp32_to_fp16, bf16_to_fp32, fp32_to_bf16:
+//            conversion of n values between real_t and 16-bit storage formats
+//            (IEEE half precision and bfloat16), rounding to nearest even
+//
+struct VecKernels {
+  const char* name;
+  real_t (*dot)(const real_t* x, const real_t* y, const int n);
+  void   (*axpy)(const real_t a, const real_t* x, real_t* y, const int n);
+  void   (*mul_add)(const real_t* x, const real_t* y, real_t* z, const int n);
+  void   (*mul_add2)(const real_t a, const real_t* x, const real_t* y, real_t* z, const int n);
+  void   (*adagrad)(const real_t eta, const real_t* g, const real_t* s, real_t* p, const int n);
+  void   (*update_output)(const real_t g, const real_t gg, const real_t eta_g, const real_t* x, real_t* o, real_t* s, real_t* grad, const int n);
+  void   (*update_input)(const real_t eta, const real_t* grad, real_t* s, real_t* x, const int n);
+  void   (*dots)(const real_t* x, const real_t* const* ys, const int m, real_t* z, const int n);
+  void   (*update_output_sgd)(const real_t g, const real_t a, const real_t* x, real_t* o, real_t* grad, const int n);
+  void   (*fp16_to_fp32)(const uint16_t* x, real_t* y, const int n);
+  void   (*fp32_to_fp16)(const real_t* x, uint16_t* y, const int n);
+  void   (*bf16_to_fp32)(const uint16_t* x, real_t* y, const int n);
+  void   (*fp32_to_bf16)(const real_t* x, uint16_t* y, const int n);
+};
+
+
+namespace scalar {
+
+
+inline real_t dot(const real_t* x, const real_t* y, const int n) {
+
+  real_t sum = 0.0;
+  for (int i = 0; i < n; ++i) {
+    sum += x[i] * y[i];
+  }
+  return sum;
+}
+
+
+inline void axpy(const real_t a, const real_t* x, real_t* y, const int n) {
+
+  for (int i = 0; i < n; ++i) {
+    y[i] += a * x[i];
+  }
+}
+
+
+inline void mul_add(const real_t* x, const real_t* y, real_t* z, const int n) {
+
+  for (int i = 0; i < n; ++i) {
+    z[i] += x[i] * y[i];
+  }
+}
+
+
+inline void mul_add2(const real_t a, const real_t* x, const real_t* y, real_t* z, const int n) {
+
+  for (int i = 0; i < n; ++i) {
+    z[i] += a * x[i] * y[i];
+  }
+}
+
+
+inline void adagrad(const real_t eta, const real_t* g, const real_t* s, real_t* p, const int n) {
+
+  for (int i = 0; i < n; ++i) {
+    p[i] -= eta * invsqrt(s[i]) * g[i];
+  }
+}
+
+
+inline void update_output(const real_t g, const real_t gg, const real_t eta_g, const real_t* x, real_t* o, real_t* s, real_t* grad, const int n) {
+
+  for (int i = 0; i < n; ++i) {
+    grad[i] += g * o[i];
+    s[i]    += gg * x[i] * x[i];
+    o[i]    -= eta_g * invsqrt(s[i]) * x[i];
+  }
+}
+
+
+inline void update_input(const real_t eta, const real_t* grad, real_t* s, real_t* x, const int n) {
+
+  for (int i = 0; i < n; ++i) {
+    s[i] += grad[i] * grad[i];
+    x[i] -= eta * invsqrt(s[i]) * grad[i];
+  }
+}
+
+
+inline void dots(const real_t* x, const real_t* const* ys, const int m, real_t* z, const int n) {
+
+  for (int j = 0; j < m; ++j) {
+    z[j] = dot(x, ys[j], n);
+  }
+}
+
+
+inline void update_output_sgd(const real_t g, const real_t a, const real_t* x, real_t* o, real_t* grad, const int n) {
+
+  for (int i = 0; i < n; ++i) {
+    grad[i] += g * o[i];
+    o[i]    -= a * x[i];
+  }
+}
+
+
+inline real_t half_to_float(const uint16_t h) {
+
+  const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+  uint32_t exponent = (h >> 10) & 0x1f;
+  uint32_t mantissa = h & 0x3ff;
+  uint32_t u;
+  if (exponent == 0x1f) { // inf, nan
+    u = sign | 0x7f800000 | (mantissa << 13);
+  }else if (exponent != 0) {
+    u = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  }else if (mantissa == 0) {
+    u = sign;
+  }else { // subnormal
+    exponent = 113;
+    while ((mantissa & 0x400) == 0) {
+      mantissa <<= 1;
+      --exponent;
+    }
+    u = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+  }
+  real_t f;
+  memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+
+inline uint16_t float_to_half(const real_t f) {
+
+  uint32_t u;
+  memcpy(&u, &f, sizeof(u));
+  const uint16_t sign = (u >> 16) & 0x8000;
+  const uint32_t abs = u & 0x7fffffff;
+  if (0x7f800000 < abs) { // nan
+    return sign | 0x7e00 | ((abs >> 13) & 0x3ff);
+  }
+  if (0x477ff000 <= abs) { // rounds to inf
+    return sign | 0x7c00;
+  }
+  if (abs < 0x38800000) { // subnormal: multiples of 2^-24
+    real_t a;
+    memcpy(&a, &abs, sizeof(a));
+    return sign | static_cast<uint16_t>(nearbyint(a*16777216.0f));
+  }
+  uint32_t h = (abs >> 13) - (112 << 10);
+  const uint32_t rest = abs & 0x1fff;
+  if (0x1000 < rest || (rest == 0x1000 && (h & 1))) {
+    ++h;
+  }
+  return sign | static_cast<uint16_t>(h);
+}
+
+
+inline real_t bf16_to_float(const uint16_t b) {
+
+  const uint32_t u = static_cast<uint32_t>(b) << 16;
+  real_t f;
+  memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+
+inline uint16_t float_to_bf16(const real_t f) {
+
+  uint32_t u;
+  memcpy(&u, &f, sizeof(u));
+  u += 0x7fff + ((u >> 16) & 1);
+  return static_cast<uint16_t>(u >> 16);
+}
+
+
+inline void fp16_to_fp32(const uint16_t* x, real_t* y, const int n) {
+
+  for (int i = 0; i < n; ++i) {
+    y[i] = half_to_float(x[i]);
+  }
+}
+
+
+inline void fp32_to_fp16(const real_t* x, uint16_t* y, const int n) {
+
+  for (int i = 0; i < n; ++i) {
+    y[i] = float_to_half(x[i]);
+  }
+}
+
+
+inline void bf16_to_fp32(const uint16_t* x, real_t* y, const int n) {
+
+  for (int i = 0; i < n; ++i) {
+    y[i] = bf16_to_float(x[i]);
+  }
+}
+
+
+inline void fp32_to_bf16(const real_t* x, uint16_t* y, const int n) {
+
+  for (int i = 0; i < n; ++i) {
+    y[i] = float_to_bf16(x[i]);
+  }
+}
+
+
+}
+
+
+#ifdef YSKIP_X86
+namespace sse {
+
+
+// same bit trick as invsqrt() in util.h, four lanes at a time
+__attribute__((target("sse2")))
+inline __m128 invsqrt(const __m128 x) {
+
+  const __m128i i = _mm_sub_epi32(_mm_set1_epi32(0x5f3759df), _mm_srli_epi32(_mm_castps_si128(x), 1));
+  return _mm_castsi128_ps(i);
+}
+
+
+__attribute__((target("sse2")))
+inline real_t dot(const real_t* x, const real_t* y, const int n) {
+
+  __m128 sum0 = _mm_setzero_ps();
+  __m128 sum1 = _mm_setzero_ps();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i)));
+    sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(x + i + 4), _mm_loadu_ps(y + i + 4)));
+  }
+  for (; i + 4 <= n; i += 4) {
+    sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i)));
+  }
+  sum0 = _mm_add_ps(sum0, sum1);
+  sum0 = _mm_add_ps(sum0, _mm_movehl_ps(sum0, sum0));
+  sum0 = _mm_add_ss(sum0, _mm_shuffle_ps(sum0, sum0, 1));
+  return _mm_cvtss_f32(sum0) + scalar::dot(x + i, y + i, n - i);
+}
+
+
+__attribute__((target("sse2")))
+inline void axpy(const real_t a, const real_t* x, real_t* y, const int n) {
+
+  const __m128 va = _mm_set1_ps(a);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(va, _mm_loadu_ps(x + i))));
+  }
+  scalar::axpy(a, x + i, y + i, n - i);
+}
+
+
+__attribute__((target("sse2")))
+inline void mul_add(const real_t* x, const real_t* y, real_t* z, const int n) {
+
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps(z + i, _mm_add_ps(_mm_loadu_ps(z + i), _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i))));
+  }
+  scalar::mul_add(x + i, y + i, z + i, n - i);
+}
+
+
+__attribute__((target("sse2")))
+inline void mul_add2(const real_t a, const real_t* x, const real_t* y, real_t* z, const int n) {
+
+  const __m128 va = _mm_set1_ps(a);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps(z + i, _mm_add_ps(_mm_loadu_ps(z + i), _mm_mul_ps(_mm_mul_ps(va, _mm_loadu_ps(x + i)), _mm_loadu_ps(y + i))));
+  }
+  scalar::mul_add2(a, x + i, y + i, z + i, n - i);
+}
+
+
+__attribute__((target("sse2")))
+inline void adagrad(const real_t eta, const real_t* g, const real_t* s, real_t* p, const int n) {
+
+  const __m128 veta = _mm_set1_ps(eta);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m128 step = _mm_mul_ps(_mm_mul_ps(veta, invsqrt(_mm_loadu_ps(s + i))), _mm_loadu_ps(g + i));
+    _mm_storeu_ps(p + i, _mm_sub_ps(_mm_loadu_ps(p + i), step));
+  }
+  scalar::adagrad(eta, g + i, s + i, p + i, n - i);
+}
+
+
+__attribute__((target("sse2")))
+inline void update_output(const real_t g, const real_t gg, const real_t eta_g, const real_t* x, real_t* o, real_t* s, real_t* grad, const int n) {
+
+  const __m128 vg     = _mm_set1_ps(g);
+  const __m128 vgg    = _mm_set1_ps(gg);
+  const __m128 veta_g = _mm_set1_ps(eta_g);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m128 vx = _mm_loadu_ps(x + i);
+    const __m128 vo = _mm_loadu_ps(o + i);
+    const __m128 vs = _mm_add_ps(_mm_loadu_ps(s + i), _mm_mul_ps(_mm_mul_ps(vgg, vx), vx));
+    _mm_storeu_ps(grad + i, _mm_add_ps(_mm_loadu_ps(grad + i), _mm_mul_ps(vg, vo)));
+    _mm_storeu_ps(s + i, vs);
+    _mm_storeu_ps(o + i, _mm_sub_ps(vo, _mm_mul_ps(_mm_mul_ps(veta_g, invsqrt(vs)), vx)));
+  }
+  scalar::update_output(g, gg, eta_g, x + i, o + i, s + i, grad + i, n - i);
+}
+
+
+__attribute__((target("sse2")))
+inline void update_input(const real_t eta, const real_t* grad, real_t* s, real_t* x, const int n) {
+
+  const __m128 veta = _mm_set1_ps(eta);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m128 vg = _mm_loadu_ps(grad + i);
+    const __m128 vs = _mm_add_ps(_mm_loadu_ps(s + i), _mm_mul_ps(vg, vg));
+    _mm_storeu_ps(s + i, vs);
+    _mm_storeu_ps(x + i, _mm_sub_ps(_mm_loadu_ps(x + i), _mm_mul_ps(_mm_mul_ps(veta, invsqrt(vs)), vg)));
+  }
+  scalar::update_input(eta, grad + i, s + i, x + i, n - i);
+}
+
+
+__attribute__((target("sse2")))
+inline void dots(const real_t* x, const real_t* const* ys, const int m, real_t* z, const int n) {
+
+  for (int j = 0; j < m; ++j) {
+    z[j] = dot(x, ys[j], n);
+  }
+}
+
+
+__attribute__((target("sse2")))
+inline void update_output_sgd(const real_t g, const real_t a, const real_t* x, real_t* o, real_t* grad, const int n) {
+
+  const __m128 vg = _mm_set1_ps(g);
+  const __m128 va = _mm_set1_ps(a);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m128 vo = _mm_loadu_ps(o + i);
+    _mm_storeu_ps(grad + i, _mm_add_ps(_mm_loadu_ps(grad + i), _mm_mul_ps(vg, vo)));
+    _mm_storeu_ps(o + i, _mm_sub_ps(vo, _mm_mul_ps(va, _mm_loadu_ps(x + i))));
+  }
+  scalar::update_output_sgd(g, a, x + i, o + i, grad + i, n - i);
+}
+
+
+}
+
+
+namespace avx2 {
+
+
+__attribute__((target("avx2")))
+inline __m256 invsqrt(const __m256 x) {
+
+  const __m256i i = _mm256_sub_epi32(_mm256_set1_epi32(0x5f3759df), _mm256_srli_epi32(_mm256_castps_si256(x), 1));
+  return _mm256_castsi256_ps(i);
+}
+
+
+__attribute__((target("avx2,fma")))
+inline real_t dot(const real_t* x, const real_t* y, const int n) {
+
+  __m256 sum0 = _mm256_setzero_ps();
+  __m256 sum1 = _mm256_setzero_ps();
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), sum0);
+    sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8), sum1);
+  }
+  for (; i + 8 <= n; i += 8) {
+    sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), sum0);
+  }
+  sum0 = _mm256_add_ps(sum0, sum1);
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(sum0), _mm256_extractf128_ps(sum0, 1));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+  return _mm_cvtss_f32(sum) + scalar::dot(x + i, y + i, n - i);
+}
+
+
+__attribute__((target("avx2,fma")))
+inline void axpy(const real_t a, const real_t* x, real_t* y, const int n) {
+
+  const __m256 va = _mm256_set1_ps(a);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+  }
+  scalar::axpy(a, x + i, y + i, n - i);
+}
+
+
+__attribute__((target("avx2,fma")))
+inline void mul_add(const real_t* x, const real_t* y, real_t* z, const int n) {
+
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(z + i, _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), _mm256_loadu_ps(z + i)));
+  }
+  scalar::mul_add(x + i, y + i, z + i, n - i);
+}
+
+
+__attribute__((target("avx2,fma")))
+inline void mul_add2(const real_t a, const real_t* x, const real_t* y, real_t* z, const int n) {
+
+  const __m256 va = _mm256_set1_ps(a);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(z + i, _mm256_fmadd_ps(_mm256_mul_ps(va, _mm256_loadu_ps(x + i)), _mm256_loadu_ps(y + i), _mm256_loadu_ps(z + i)));
+  }
+  scalar::mul_add2(a, x + i, y + i, z + i, n - i);
+}
+
+
+__attribute__((target("avx2,fma")))
+inline void adagrad(const real_t eta, const real_t* g, const real_t* s, real_t* p, const int n) {
+
+  const __m256 veta = _mm256_set1_ps(eta);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 rate = _mm256_mul_ps(veta, invsqrt(_mm256_loadu_ps(s + i)));
+    _mm256_storeu_ps(p + i, _mm256_fnmadd_ps(rate, _mm256_loadu_ps(g + i), _mm256_loadu_ps(p + i)));
+  }
+  scalar::adagrad(eta, g + i, s + i, p + i, n - i);
+}
+
+
+__attribute__((target("avx2,fma")))
+inline void update_output(const real_t g, const real_t gg, const real_t eta_g, const real_t* x, real_t* o, real_t* s, real_t* grad, const int n) {
+
+  const __m256 vg     = _mm256_set1_ps(g);
+  const __m256 vgg    = _mm256_set1_ps(gg);
+  const __m256 veta_g = _mm256_set1_ps(eta_g);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 vx = _mm256_loadu_ps(x + i);
+    const __m256 vo = _mm256_loadu_ps(o + i);
+    const __m256 vs = _mm256_fmadd_ps(_mm256_mul_ps(vgg, vx), vx, _mm256_loadu_ps(s + i));
+    _mm256_storeu_ps(grad + i, _mm256_fmadd_ps(vg, vo, _mm256_loadu_ps(grad + i)));
+    _mm256_storeu_ps(s + i, vs);
+    _mm256_storeu_ps(o + i, _mm256_fnmadd_ps(_mm256_mul_ps(veta_g, invsqrt(vs)), vx, vo));
+  }
+  scalar::update_output(g, gg, eta_g, x + i, o + i, s + i, grad + i, n - i);
+}
+
+
+__attribute__((target("avx2,fma")))
+inline void update_input(const real_t eta, const real_t* grad, real_t* s, real_t* x, const int n) {
+
+  const __m256 veta = _mm256_set1_ps(eta);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 vg = _mm256_loadu_ps(grad + i);
+    const __m256 vs = _mm256_fmadd_ps(vg, vg, _mm256_loadu_ps(s + i));
+    _mm256_storeu_ps(s + i, vs);
+    _mm256_storeu_ps(x + i, _mm256_fnmadd_ps(_mm256_mul_ps(veta, invsqrt(vs)), vg, _mm256_loadu_ps(x + i)));
+  }
+  scalar::update_input(eta, grad + i, s + i, x + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+inline real_t hsum(const __m256 x) {
+
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+  return _mm_cvtss_f32(sum);
+}
+
+
+// four rows at a time, so that each load of x feeds four FMAs
+__attribute__((target("avx2,fma")))
+inline void dots(const real_t* x, const real_t* const* ys, const int m, real_t* z, const int n) {
+
+  int j = 0;
+  for (; j + 4 <= m; j += 4) {
+    const real_t* y0 = ys[j];
+    const real_t* y1 = ys[j + 1];
+    const real_t* y2 = ys[j + 2];
+    const real_t* y3 = ys[j + 3];
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    __m256 sum2 = _mm256_setzero_ps();
+    __m256 sum3 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+      const __m256 vx = _mm256_loadu_ps(x + i);
+      sum0 = _mm256_fmadd_ps(vx, _mm256_loadu_ps(y0 + i), sum0);
+      sum1 = _mm256_fmadd_ps(vx, _mm256_loadu_ps(y1 + i), sum1);
+      sum2 = _mm256_fmadd_ps(vx, _mm256_loadu_ps(y2 + i), sum2);
+      sum3 = _mm256_fmadd_ps(vx, _mm256_loadu_ps(y3 + i), sum3);
+    }
+    z[j]     = hsum(sum0) + scalar::dot(x + i, y0 + i, n - i);
+    z[j + 1] = hsum(sum1) + scalar::dot(x + i, y1 + i, n - i);
+    z[j + 2] = hsum(sum2) + scalar::dot(x + i, y2 + i, n - i);
+    z[j + 3] = hsum(sum3) + scalar::dot(x + i, y3 + i, n - i);
+  }
+  for (; j < m; ++j) {
+    z[j] = dot(x, ys[j], n);
+  }
+}
+
+
+__attribute__((target("avx2,fma")))
+inline void update_output_sgd(const real_t g, const real_t a, const real_t* x, real_t* o, real_t* grad, const int n) {
+
+  const __m256 vg = _mm256_set1_ps(g);
+  const __m256 va = _mm256_set1_ps(a);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 vo = _mm256_loadu_ps(o + i);
+    _mm256_storeu_ps(grad + i, _mm256_fmadd_ps(vg, vo, _mm256_loadu_ps(grad + i)));
+    _mm256_storeu_ps(o + i, _mm256_fnmadd_ps(va, _mm256_loadu_ps(x + i), vo));
+  }
+  scalar::update_output_sgd(g, a, x + i, o + i, grad + i, n - i);
+}
+
+
+__attribute__((target("avx2,f16c")))
+inline void fp16_to_fp32(const uint16_t* x, real_t* y, const int n) {
+
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(y + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i))));
+  }
+  scalar::fp16_to_fp32(x + i, y + i, n - i);
+}
+
+
+__attribute__((target("avx2,f16c")))
+inline void fp32_to_fp16(const real_t* x, uint16_t* y, const int n) {
+
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(y + i), _mm256_cvtps_ph(_mm256_loadu_ps(x + i), _MM_FROUND_TO_NEAREST_INT));
+  }
+  scalar::fp32_to_fp16(x + i, y + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+inline void bf16_to_fp32(const uint16_t* x, real_t* y, const int n) {
+
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256i u = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i)));
+    _mm256_storeu_ps(y + i, _mm256_castsi256_ps(_mm256_slli_epi32(u, 16)));
+  }
+  scalar::bf16_to_fp32(x + i, y + i, n - i);
+}
+
+
+// same rounding as scalar::float_to_bf16()
+__attribute__((target("avx2")))
+inline void fp32_to_bf16(const real_t* x, uint16_t* y, const int n) {
+
+  const __m256i bias = _mm256_set1_epi32(0x7fff);
+  const __m256i one  = _mm256_set1_epi32(1);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i u = _mm256_castps_si256(_mm256_loadu_ps(x + i));
+    u = _mm256_add_epi32(u, _mm256_add_epi32(bias, _mm256_and_si256(_mm256_srli_epi32(u, 16), one)));
+    u = _mm256_srli_epi32(u, 16);
+    u = _mm256_permute4x64_epi64(_mm256_packus_epi32(u, u), 0x08);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(y + i), _mm256_castsi256_si128(u));
+  }
+  scalar::fp32_to_bf16(x + i, y + i, n - i);
+}
+
+
+}
+
+
+namespace avx512 {
+
+
+__attribute__((target("avx512f")))
+inline __m512 invsqrt(const __m512 x) {
+
+  const __m512i i = _mm512_sub_epi32(_mm512_set1_epi32(0x5f3759df), _mm512_srli_epi32(_mm512_castps_si512(x), 1));
+  return _mm512_castsi512_ps(i);
+}
+
+
+// the tail is handled with masked loads/stores instead of a scalar loop
+__attribute__((target("avx512f")))
+inline __mmask16 tail_mask(const int n) {
+
+  return static_cast<__mmask16>((1U << n) - 1);
+}
+
+
+__attribute__((target("avx512f")))
+inline real_t dot(const real_t* x, const real_t* y, const int n) {
+
+  __m512 sum0 = _mm512_setzero_ps();
+  __m512 sum1 = _mm512_setzero_ps();
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i), sum0);
+    sum1 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i + 16), _mm512_loadu_ps(y + i + 16), sum1);
+  }
+  for (; i + 16 <= n; i += 16) {
+    sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i), sum0);
+  }
+  if (i < n) {
+    const __mmask16 m = tail_mask(n - i);
+    sum1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, x + i), _mm512_maskz_loadu_ps(m, y + i), sum1);
+  }
+  return _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1));
+}
+
+
+__attribute__((target("avx512f")))
+inline void axpy(const real_t a, const real_t* x, real_t* y, const int n) {
+
+  const __m512 va = _mm512_set1_ps(a);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(y + i, _mm512_fmadd_ps(va, _mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i)));
+  }
+  if (i < n) {
+    const __mmask16 m = tail_mask(n - i);
+    _mm512_mask_storeu_ps(y + i, m, _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(m, x + i), _mm512_maskz_loadu_ps(m, y + i)));
+  }
+}
+
+
+__attribute__((target("avx512f")))
+inline void mul_add(const real_t* x, const real_t* y, real_t* z, const int n) {
+
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(z + i, _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i), _mm512_loadu_ps(z + i)));
+  }
+  if (i < n) {
+    const __mmask16 m = tail_mask(n - i);
+    _mm512_mask_storeu_ps(z + i, m, _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, x + i), _mm512_maskz_loadu_ps(m, y + i), _mm512_maskz_loadu_ps(m, z + i)));
+  }
+}
+
+
+__attribute__((target("avx512f")))
+inline void mul_add2(const real_t a, const real_t* x, const real_t* y, real_t* z, const int n) {
+
+  const __m512 va = _mm512_set1_ps(a);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(z + i, _mm512_fmadd_ps(_mm512_mul_ps(va, _mm512_loadu_ps(x + i)), _mm512_loadu_ps(y + i), _mm512_loadu_ps(z + i)));
+  }
+  if (i < n) {
+    const __mmask16 m = tail_mask(n - i);
+    _mm512_mask_storeu_ps(z + i, m, _mm512_fmadd_ps(_mm512_mul_ps(va, _mm512_maskz_loadu_ps(m, x + i)), _mm512_maskz_loadu_ps(m, y + i), _mm512_maskz_loadu_ps(m, z + i)));
+  }
+}
+
+
+__attribute__((target("avx512f")))
+inline void adagrad(const real_t eta, const real_t* g, const real_t* s, real_t* p, const int n) {
+
+  const __m512 veta = _mm512_set1_ps(eta);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m512 rate = _mm512_mul_ps(veta, invsqrt(_mm512_loadu_ps(s + i)));
+    _mm512_storeu_ps(p + i, _mm512_fnmadd_ps(rate, _mm512_loadu_ps(g + i), _mm512_loadu_ps(p + i)));
+  }
+  if (i < n) {
+    const __mmask16 m = tail_mask(n - i);
+    const __m512 rate = _mm512_mul_ps(veta, invsqrt(_mm512_mask_loadu_ps(_mm512_set1_ps(1.0), m, s + i)));
+    _mm512_mask_storeu_ps(p + i, m, _mm512_fnmadd_ps(rate, _mm512_maskz_loadu_ps(m, g + i), _mm512_maskz_loadu_ps(m, p + i)));
+  }
+}
+
+
+__attribute__((target("avx512f")))
+inline void update_output(const real_t g, const real_t gg, const real_t eta_g, const real_t* x, real_t* o, real_t* s, real_t* grad, const int n) {
+
+  const __m512 vg     = _mm512_set1_ps(g);
+  const __m512 vgg    = _mm512_set1_ps(gg);
+  const __m512 veta_g = _mm512_set1_ps(eta_g);
+  for (int i = 0; i < n; i += 16) {
+    const __mmask16 m = n - i < 16 ? tail_mask(n - i) : static_cast<__mmask16>(0xffff);
+    const __m512 vx = _mm512_maskz_loadu_ps(m, x + i);
+    const __m512 vo = _mm512_maskz_loadu_ps(m, o + i);
+    const __m512 vs = _mm512_fmadd_ps(_mm512_mul_ps(vgg, vx), vx, _mm512_mask_loadu_ps(_mm512_set1_ps(1.0), m, s + i));
+    _mm512_mask_storeu_ps(grad + i, m, _mm512_fmadd_ps(vg, vo, _mm512_maskz_loadu_ps(m, grad + i)));
+    _mm512_mask_storeu_ps(s + i, m, vs);
+    _mm512_mask_storeu_ps(o + i, m, _mm512_fnmadd_ps(_mm512_mul_ps(veta_g, invsqrt(vs)), vx, vo));
+  }
+}
+
+
+__attribute__((target("avx512f")))
+inline void update_input(const real_t eta, const real_t* grad, real_t* s, real_t* x, const int n) {
+
+  const __m512 veta = _mm512_set1_ps(eta);
+  for (int i = 0; i < n; i += 16) {
+    const __mmask16 m = n - i < 16 ? tail_mask(n - i) : static_cast<__mmask16>(0xffff);
+    const __m512 vg = _mm512_maskz_loadu_ps(m, grad + i);
+    const __m512 vs = _mm512_fmadd_ps(vg, vg, _mm512_mask_loadu_ps(_mm512_set1_ps(1.0), m, s + i));
+    _mm512_mask_storeu_ps(s + i, m, vs);
+    _mm512_mask_storeu_ps(x + i, m, _mm512_fnmadd_ps(_mm512_mul_ps(veta, invsqrt(vs)), vg, _mm512_maskz_loadu_ps(m, x + i)));
+  }
+}
+
+
+// four rows at a time, so that each load of x feeds four FMAs
+__attribute__((target("avx512f")))
+inline void dots(const real_t* x, const real_t* const* ys, const int m, real_t* z, const int n) {
+
+  int j = 0;
+  for (; j + 4 <= m; j += 4) {
+    const real_t* y0 = ys[j];
+    const real_t* y1 = ys[j + 1];
+    const real_t* y2 = ys[j + 2];
+    const real_t* y3 = ys[j + 3];
+    __m512 sum0 = _mm512_setzero_ps();
+    __m512 sum1 = _mm512_setzero_ps();
+    __m512 sum2 = _mm512_setzero_ps();
+    __m512 sum3 = _mm512_setzero_ps();
+    for (int i = 0; i < n; i += 16) {
+      const __mmask16 mask = n - i < 16 ? tail_mask(n - i) : static_cast<__mmask16>(0xffff);
+      const __m512 vx = _mm512_maskz_loadu_ps(mask, x + i);
+      sum0 = _mm512_fmadd_ps(vx, _mm512_maskz_loadu_ps(mask, y0 + i), sum0);
+      sum1 = _mm512_fmadd_ps(vx, _mm512_maskz_loadu_ps(mask, y1 + i), sum1);
+      sum2 = _mm512_fmadd_ps(vx, _mm512_maskz_loadu_ps(mask, y2 + i), sum2);
+      sum3 = _mm512_fmadd_ps(vx, _mm512_maskz_loadu_ps(mask, y3 + i), sum3);
+    }
+    z[j]     = _mm512_reduce_add_ps(sum0);
+    z[j + 1] = _mm512_reduce_add_ps(sum1);
+    z[j + 2] = _mm512_reduce_add_ps(sum2);
+    z[j + 3] = _mm512_reduce_add_ps(sum3);
+  }
+  for (; j < m; ++j) {
+    z[j] = dot(x, ys[j], n);
+  }
+}
+
+
+__attribute__((target("avx512f")))
+inline void update_output_sgd(const real_t g, const real_t a, const real_t* x, real_t* o, real_t* grad, const int n) {
+
+  const __m512 vg = _mm512_set1_ps(g);
+  const __m512 va = _mm512_set1_ps(a);
+  for (int i = 0; i < n; i += 16) {
+    const __mmask16 m = n - i < 16 ? tail_mask(n - i) : static_cast<__mmask16>(0xffff);
+    const __m512 vo = _mm512_maskz_loadu_ps(m, o + i);
+    _mm512_mask_storeu_ps(grad + i, m, _mm512_fmadd_ps(vg, vo, _mm512_maskz_loadu_ps(m, grad + i)));
+    _mm512_mask_storeu_ps(o + i, m, _mm512_fnmadd_ps(va, _mm512_maskz_loadu_ps(m, x + i), vo));
+  }
+}
+
+
+__attribute__((target("avx512f")))
+inline void fp16_to_fp32(const uint16_t* x, real_t* y, const int n) {
+
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(y + i, _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i))));
+  }
+  scalar::fp16_to_fp32(x + i, y + i, n - i);
+}
+
+
+__attribute__((target("avx512f")))
+inline void fp32_to_fp16(const real_t* x, uint16_t* y, const int n) {
+
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(y + i), _mm512_cvtps_ph(_mm512_loadu_ps(x + i), _MM_FROUND_TO_NEAREST_INT));
+  }
+  scalar::fp32_to_fp16(x + i, y + i, n - i);
+}
+
+
+__attribute__((target("avx512f")))
+inline void bf16_to_fp32(const uint16_t* x, real_t* y, const int n) {
+
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m512i u = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i)));
+    _mm512_storeu_ps(y + i, _mm512_castsi512_ps(_mm512_slli_epi32(u, 16)));
+  }
+  scalar::bf16_to_fp32(x + i, y + i, n - i);
+}
+
+
+// same rounding as scalar::float_to_bf16()
+__attribute__((target("avx512f")))
+inline void fp32_to_bf16(const real_t* x, uint16_t* y, const int n) {
+
+  const __m512i bias = _mm512_set1_epi32(0x7fff);
+  const __m512i one  = _mm512_set1_epi32(1);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512i u = _mm512_castps_si512(_mm512_loadu_ps(x + i));
+    u = _mm512_add_epi32(u, _mm512_add_epi32(bias, _mm512_and_si512(_mm512_srli_epi32(u, 16), one)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(y + i), _mm512_cvtepi32_epi16(_mm512_srli_epi32(u, 16)));
+  }
+  scalar::fp32_to_bf16(x + i, y + i, n - i);
+}
+
+
+}
+#endif
+
+
+//
+// returns the kernels for `isa` ("scalar", "sse", "avx2" or "avx512"),
+// or NULL if the instruction set is not available on this CPU
+//
+inline const VecKernels* find_vec_kernels(const char* isa) {
+
+  static const VecKernels scalar_kernels = {"scalar", &scalar::dot, &scalar::axpy, &scalar::mul_add, &scalar::mul_add2, &scalar::adagrad, &scalar::update_output, &scalar::update_input, &scalar::dots, &scalar::update_output_sgd, &scalar::fp16_to_fp32, &scalar::fp32_to_fp16, &scalar::bf16_to_fp32, &scalar::fp32_to_bf16};
+  if (strcmp(isa, "scalar") == 0) {
+    return &scalar_kernels;
+  }
+#ifdef YSKIP_X86
+  static const VecKernels sse_kernels    = {"sse", &sse::dot, &sse::axpy, &sse::mul_add, &sse::mul_add2, &sse::adagrad, &sse::update_output, &sse::update_input, &sse::dots, &sse::update_output_sgd, &scalar::fp16_to_fp32, &scalar::fp32_to_fp16, &scalar::bf16_to_fp32, &scalar::fp32_to_bf16};
+  static const VecKernels avx2_kernels   = {"avx2", &avx2::dot, &avx2::axpy, &avx2::mul_add, &avx2::mul_add2, &avx2::adagrad, &avx2::update_output, &avx2::update_input, &avx2::dots, &avx2::update_output_sgd, &avx2::fp16_to_fp32, &avx2::fp32_to_fp16, &avx2::bf16_to_fp32, &avx2::fp32_to_bf16};
+  static const VecKernels avx512_kernels = {"avx512", &avx512::dot, &avx512::axpy, &avx512::mul_add, &avx512::mul_add2, &avx512::adagrad, &avx512::update_output, &avx512::update_input, &avx512::dots, &avx512::update_output_sgd, &avx512::fp16_to_fp32, &avx512::fp32_to_fp16, &avx512::bf16_to_fp32, &avx512::fp32_to_bf16};
+  __builtin_cpu_init();
+  if (strcmp(isa, "sse") == 0 && __builtin_cpu_supports("sse2")) {
+    return &sse_kernels;
+  }
+  if (strcmp(isa, "avx2") == 0 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c")) {
+    return &avx2_kernels;
+  }
+  if (strcmp(isa, "avx512") == 0 && __builtin_cpu_supports("avx512f")) {
+    return &avx512_kernels;
+  }
+#endif
+  return NULL;
+}
+
+
+//
+// kernels for the best instruction set of this CPU, chosen on the first call;
+// the environment variable YSKIP_SIMD can force a specific one
+//
+inline const VecKernels& vec_kernels() {
+
+  struct Selector {
+    static const VecKernels* select() {
+      const char* isa = getenv("YSKIP_SIMD");
+      if (isa != NULL && find_vec_kernels(isa) != NULL) {
+	return find_vec_kernels(isa);
+      }
+      const char* candidates[] = {"avx512", "avx2", "sse"};
+      for (int i = 0; i < 3; ++i) {
+	if (find_vec_kernels(candidates[i]) != NULL) {
+	  return find_vec_kernels(candidates[i]);
+	}
+      }
+      return find_vec_kernels("scalar");
+    }
+  };
+  static const VecKernels* kernels = Selector::select();
+  return *kernels;
+}
+
+
+}
@@ -5,8 +5,8 @@
 #include <stdio.h>
 #include <iostream>
 #include <thread>
+#include <atomic>
 #include <sys/time.h>
-#include <numeric> // inner_product
 #include <algorithm>
 #include <vector>
 #include <unordered_set>
@@ -15,33 +15,78 @@
 #include "vec_util.h"
 #include "random.h"
 #include "vocab.h"
+#include "line_reader.h"
 #include "dense_matrix.h"
+#include "sparse_matrix.h"
 #include "fast_sigmoid.h"
 #include "unigram_table.h"
+#include "sgd_kernel.h"
+#include "output_replica.h"
+#include "output_partition.h"
 
 
 namespace yskip {
 
+
+// binary models start with -MODEL_VERSION; older ones start with the (positive) maximum vocabulary size
+//  1: optimizer
+//  2: storage types of the vectors and of the optimizer state
+//  3: 64-bit sizes of the unigram table and of the vocabulary hash table
+const int MODEL_VERSION = 3;
+
   
-struct Parameter {
-  DenseMatrix input;
-  DenseMatrix output;
-  Parameter() {};
-  Parameter(const int max_vocab_size, const int vec_size, const real_t val=0.0) : input(max_vocab_size, vec_size, val), output(max_vocab_size, vec_size, val) {};
+template<class Matrix>
+struct BasicParameter {
+  Matrix input;
+  Matrix output;
+  BasicParameter() {};
+  BasicParameter(const int max_vocab_size, const int vec_size, const real_t val=0.0, const int type=FP32, const int row_alignment=0) : input(max_vocab_size, vec_size, val, type, row_alignment), output(max_vocab_size, vec_size, val, type, row_alignment) {};
+};
+typedef BasicParameter<DenseMatrix>  Parameter;
+typedef BasicParameter<SparseMatrix> SparseParameter; // rows materialized on demand
+
+
+// scratch of Skipgram::train() kept by the caller across sentences, like `grad`, so that a sentence allocates nothing
+struct TrainBuffer {
+  std::vector<int> encoded_text;
+  std::vector<int> neg_samples;
+  std::vector<int> contexts;
 };
 
 
 class Skipgram {
  public:
+  // how the (target, context) pairs of a window are turned into updates
+  enum SgdMode {
+    PAIR_SGD   = 0, // one update per pair, each with its own negative samples
+    WINDOW_SGD = 1, // one update per window, whose contexts share the negative samples
+  };
+  // how the vectors and the optimizer state are laid out in memory (files are not affected)
+  enum Layout {
+    SEPARATE    = 0, // in two matrices
+    INTERLEAVED = 1, // the vector and the state of a word in one row, so an update touches one block
+  };
   struct Option {
-    int    vec_size;
-    int    window_size;
-    int    neg_sample_num;
-    real_t alpha;
-    real_t subsampling_threshold;
-    real_t eta;
-    int    unigram_table_size;
-    int    max_vocab_size;
+    int     vec_size;
+    int     window_size;
+    int     neg_sample_num;
+    real_t  alpha;
+    real_t  subsampling_threshold;
+    real_t  eta;
+    int64_t unigram_table_size;
+    int     max_vocab_size;
+    int     sgd_mode;
+    int     optimizer;
+    int     vector_storage;        // StorageType of the embeddings
+    int     state_storage;         // StorageType of the optimizer state
+    int     layout;
+    int     row_alignment;         // rows are padded to a multiple of this many bytes (0: packed)
+    bool    lazy_init;             // initialize the rows of a word when it enters the vocabulary (turned off with INTERLEAVED)
+    bool    frequency_order;       // renumber words by frequency whenever the vocabulary is reduced (see sort_vocab())
+    int     huge_page_rows;        // rows backed by transparent huge pages, i.e. the frequent words if frequency_order
+    int     replica_rows;          // output rows each worker keeps a private copy of (see OutputReplica; FP32 only)
+    int     replica_sync_interval; // updates between merges of the replicas
+    int     numa_mode;             // NumaMode of the parameters
     Option();
   };
   Skipgram();
@@ -57,12 +102,31 @@ class Skipgram {
   real_t alpha() const;
   real_t subsampling_threshold() const;
   real_t eta() const;
+  int sgd_mode() const;
+  int optimizer() const;
+  int vector_storage() const;
+  int state_storage() const;
+  int layout() const;
+  int row_alignment() const;
+  bool lazy_init() const;
+  bool frequency_order() const;
+  int huge_page_rows() const;
+  int replica_rows() const;
+  int replica_sync_interval() const;
+  int numa_mode() const;
+
+  // learning rate of plain SGD decays linearly to (almost) zero after `count` words; 0 keeps it constant
+  void set_decay_count(const count_t count);
+  real_t learning_rate() const;
+
+  // size of the buffer passed as `grad` to train()
+  size_t grad_size() const;
 
   // vocabulary
   const Vocab& vocab() const;
 
-  // embedding
-  const Parameter& vec() const;
+  // embedding; rows of FP16/BF16 vectors must be read with DenseMatrix::get()
+  const SparseParameter& vec() const;
 
   // word statistics
   count_t total_count() const;
@@ -71,10 +135,22 @@ class Skipgram {
   // 
   void initialize(const Option& option, Random& random);
   void update_unigram_table(const std::vector<std::string>& text, Random& random);
+  void update_unigram_table(const Span* begin, const Span* end, Random& random);
   void update_unigram_table(const std::string& word, Random& random);
+  void update_unigram_table(const char* begin, const char* end, Random& random);
   void train(const std::vector<std::string>& text, bool incremental, real_t* grad, Random& random);
-  void sgd(const int target, const int context, const std::vector<int>& neg_samples, real_t* grad);
+  void train(const Span* begin, const Span* end, bool incremental, real_t* grad, Random& random, TrainBuffer& buffer);
+  void train(const int* text, const size_t n, real_t* grad, Random& random, OutputReplica* replica=NULL, OutputRouter* router=NULL);
+  void train(const int* text, const size_t n, real_t* grad, Random& random, TrainBuffer& buffer, OutputReplica* replica=NULL, OutputRouter* router=NULL);
+  void encode(const std::vector<std::string>& text, std::vector<int>& encoded_text) const;
+  void encode(const Span* begin, const Span* end, std::vector<int>& encoded_text) const;
+  void sgd(const int target, const int context, const std::vector<int>& neg_samples, real_t* grad, OutputReplica* replica=NULL, OutputRouter* router=NULL);
+  void sgd_window(const int target, const std::vector<int>& contexts, const std::vector<int>& neg_samples, real_t* grad, OutputReplica* replica=NULL, OutputRouter* router=NULL);
+  void init_replica(OutputReplica& replica);
+  bool receive_updates(OutputRouter& router);
+  void finish_updates(OutputRouter& router);
   void rebuild_unigram_table(Random& random);
+  void sort_vocab();
 
   // outdated
   //void update_vocab(const char* raw_text, Random& random);
@@ -102,22 +178,64 @@ class Skipgram {
   real_t       alpha_;
   real_t       subsampling_threshold_;
   real_t       eta_;
-  int          unigram_table_size_;
+  int64_t      unigram_table_size_;
   int          max_vocab_size_;
+  int          sgd_mode_;
+  int          optimizer_;
+  int          vector_storage_;
+  int          state_storage_;
+  int          layout_;
+  int          row_alignment_;
+  bool         lazy_init_;
+  int          init_seed_; // seed of the initializers (lazy_init_), drawn from the random of the constructor
+  bool         frequency_order_;
+  int          huge_page_rows_;
+  int          replica_rows_;
+  int          replica_sync_interval_;
+  int          numa_mode_;
+  count_t      decay_count_;
+
+  // NUMA nodes of the machine
+  NumaTopology numa_;
 
   // embeddings
   Vocab     vocab_;
-  Parameter vec_;
-  Parameter squared_grad_;
+  SparseParameter vec_;
+  SparseParameter squared_grad_;
+  Parameter       blocks_; // rows of vec_ and squared_grad_ if interleaved
   
   // word count
   count_t              total_count_;
   std::vector<count_t> counts_;
+  std::atomic<count_t> trained_count_;
 
   // unigram table
   UnigramTable unigram_table_;
 
+  // SGD kernel specialized on vec_size_
+  SgdFunction sgd_kernel_;
+  SgdFunctionOf<ReplicatedRows>::type replica_kernel_;
+
   void reduce_vocab(Random& random);
+  void sgd_converted(const int target, const int context, const std::vector<int>& neg_samples, real_t* grad);
+  void update(const real_t eta, const real_t* grad, real_t* x, real_t* squared_grad);
+  void update(const real_t eta, const real_t* grad, const int w, DenseMatrix& vec, DenseMatrix& squared_grad, real_t* buffer);
+  const real_t* row(const DenseMatrix& m, const int w, real_t* buffer) const;
+  bool converted() const;
+  int state_size() const;
+  void reset_squared_grad(const int max_vocab_size);
+  void set_layout();
+  void init_vec(const int first, const int last, Random& random);
+  void set_initializers(const int seed);
+  void materialize(const int w);
+  void materialize(const int t, const int* contexts, const int context_num, const std::vector<int>& neg_samples);
+  void advise_memory(const DenseMatrix& m) const;
+  void sync_replica(OutputReplica& replica);
+  bool routed(const OutputRouter* router) const;
+  void sgd_routed(const int target, const int context, const std::vector<int>& neg_samples, real_t* grad, OutputRouter& router);
+  void send_update(OutputRouter& router, const OutputUpdate& update);
+  void wait_for(OutputRouter& router, const int to);
+  void apply_update(const OutputUpdate& update, real_t* buffer);
   DISALLOW_COPY_AND_ASSIGN(Skipgram);
 };
 
@@ -132,6 +250,18 @@ inline Skipgram::Option::Option() {
   eta                   = 0.1;
   unigram_table_size    = 1e8;
   max_vocab_size        = 1e6;
+  sgd_mode              = PAIR_SGD;
+  optimizer             = ADAGRAD;
+  vector_storage        = FP32;
+  state_storage         = FP32;
+  layout                = SEPARATE;
+  row_alignment         = 0;
+  lazy_init             = false;
+  frequency_order       = false;
+  huge_page_rows        = 0;
+  replica_rows          = 0;
+  replica_sync_interval = 10000;
+  numa_mode             = NUMA_OFF;
 }
 
 
@@ -167,23 +297,42 @@ inline void Skipgram::initialize(const Option& option, Random& random) {
   alpha_                 = option.alpha;
   max_vocab_size_        = option.max_vocab_size;
   unigram_table_size_    = option.unigram_table_size;  
+  sgd_mode_              = option.sgd_mode;
+  optimizer_             = option.optimizer;
+  vector_storage_        = option.vector_storage;
+  state_storage_         = option.state_storage;
+  layout_                = option.layout;
+  row_alignment_         = option.row_alignment;
+  lazy_init_             = option.lazy_init && option.layout != INTERLEAVED; // interleaved blocks are initialized as a whole
+  frequency_order_       = option.frequency_order;
+  huge_page_rows_        = option.huge_page_rows;
+  replica_rows_          = option.replica_rows;
+  replica_sync_interval_ = option.replica_sync_interval;
+  numa_mode_             = option.numa_mode;
+  decay_count_           = 0;
+  trained_count_         = 0;
+  sgd_kernel_            = sgd_kernel(vec_size_, optimizer_);
+  replica_kernel_        = sgd_kernel<ReplicatedRows>(vec_size_, optimizer_);
   
   // vocabulary
-  vocab_ = Vocab(max_vocab_size_*2);
+  vocab_ = Vocab(static_cast<uint64_t>(max_vocab_size_)*2);
 
   // word embedding
-  vec_ = Parameter(max_vocab_size_, vec_size_);
-  const real_t min = static_cast<real_t>(-0.5)/static_cast<real_t>(vec_size_);
-  const real_t max = static_cast<real_t>(0.5)/static_cast<real_t>(vec_size_);
-  for (int w = 0; w < max_vocab_size_; ++w) {
-    for (int i = 0; i < vec_size_; ++i) {
-      vec_.input[w][i]  = random.uniform(min, max);
-      vec_.output[w][i] = random.uniform(min, max);
-    }
+  vec_ = SparseParameter(max_vocab_size_, vec_size_, 0.0, vector_storage_, row_alignment_);
+  advise_memory(vec_.input);
+  advise_memory(vec_.output);
+  if (!lazy_init_) {
+    init_vec(0, max_vocab_size_, random);
   }
 
   // accumulated gradient
-  squared_grad_ = Parameter(max_vocab_size_, vec_size_, 1.0e-8);
+  reset_squared_grad(max_vocab_size_);
+  init_seed_ = 0;
+  if (lazy_init_) {
+    init_seed_ = random.uniform(0, std::numeric_limits<int>::max());
+    set_initializers(init_seed_);
+  }
+  set_layout();
   
   // word counts
   total_count_ = 0;
@@ -197,43 +346,112 @@ inline void Skipgram::initialize(const Option& option, Random& random) {
 
 inline void Skipgram::train(const std::vector<std::string>& text, bool incremental, real_t* grad, Random& random) {
 
-  int n = text.size();
-  std::vector<int> neg_samples(neg_sample_num_);
-  for (int target = 0; target < n; ++target) {
-    //  incrementally update unigram table
-    if (incremental) {
-      update_unigram_table(text[target], random);
-    }
+  //  incrementally update unigram table
+  if (incremental) {
+    update_unigram_table(text, random);
+  }
+
+  //
+  TrainBuffer buffer;
+  encode(text, buffer.encoded_text);
+  train(buffer.encoded_text.data(), buffer.encoded_text.size(), grad, random, buffer);
+}
+
+
+// the same as above for the tokens [begin, end) of a line (see tokenize()), encoded into buffer.encoded_text
+inline void Skipgram::train(const Span* begin, const Span* end, bool incremental, real_t* grad, Random& random, TrainBuffer& buffer) {
+
+  if (incremental) {
+    update_unigram_table(begin, end, random);
+  }
+  encode(begin, end, buffer.encoded_text);
+  train(buffer.encoded_text.data(), buffer.encoded_text.size(), grad, random, buffer);
+}
+
+
+inline void Skipgram::train(const int* text, const size_t n, real_t* grad, Random& random, OutputReplica* replica, OutputRouter* router) {
+
+  TrainBuffer buffer;
+  train(text, n, grad, random, buffer, replica, router);
+}
+
+
+//
+// text: word indices of a sentence; unknown words must have been removed (see encode())
+// n: sentence length
+// buffer: scratch for the negative samples and the contexts; its encoded_text may be `text`
+// replica: replicas of the hottest output rows owned by the calling thread, if any
+//
+inline void Skipgram::train(const int* text, const size_t n, real_t* grad, Random& random, TrainBuffer& buffer, OutputReplica* replica, OutputRouter* router) {
+
+  const int len = n;
+  if (routed(router)) {
+    replica = NULL; // every row has a single writer anyway
+  }
+  if (replica != NULL && replica->enabled() && !replica->pulled()) {
+    replica->pull(vocab_.size());
+  }
+  std::vector<int>& neg_samples = buffer.neg_samples;
+  std::vector<int>& contexts    = buffer.contexts;
+  neg_samples.resize(neg_sample_num_);
+  for (int target = 0; target < len; ++target) {
+    const int target_index = text[target];
 
     //
-    int target_index = vocab_.encode(text[target]);
-    if (target_index == -1) continue; // ignore unknown word
-    
-    //
+    contexts.clear();
     int random_window_size = random.uniform(1, window_size_ + 1);
     for (int offset = -random_window_size; offset < random_window_size; ++offset) {
       if (offset == 0 || target + offset < 0) continue;
-      if (target + offset == n) break;
+      if (target + offset == len) break;
 
       //
-      int context_index = vocab_.encode(text[target + offset]);
-      if (context_index == -1) continue;  // ignore unknown word
+      const int context_index = text[target + offset];
 
-      // perform subsampling
-      if (0 < counts_[context_index] && sqrt(subsampling_threshold_*static_cast<real_t>(total_count_)/static_cast<real_t>(counts_[context_index])) < random.uniform(0.0, 1.0)) continue;
+      // perform subsampling; the counts may be stale (see update_unigram_table())
+      const count_t count = __atomic_load_n(&counts_[context_index], __ATOMIC_RELAXED);
+      const count_t total_count = __atomic_load_n(&total_count_, __ATOMIC_RELAXED);
+      if (0 < count && sqrt(subsampling_threshold_*static_cast<real_t>(total_count)/static_cast<real_t>(count)) < random.uniform(0.0, 1.0)) continue;
 
-      // collecting negative samples
-      for (int k = 0; k < neg_sample_num_; ++k) {
-	neg_samples[k] = unigram_table_.sample(random);
-	if (neg_samples[k] < 0 || max_vocab_size_ <= neg_samples[k]) {
-	  fprintf(stderr, "%d\n", neg_samples[k]);
-	}
+      //
+      if (sgd_mode_ == WINDOW_SGD) {
+	contexts.push_back(context_index);
+	continue;
       }
 
+      // collecting negative samples
+      unigram_table_.sample(random, &neg_samples[0], &neg_samples[0] + neg_sample_num_);
+
       // perform SGD
-      sgd(target_index, context_index, neg_samples, grad);
+      sgd(target_index, context_index, neg_samples, grad, replica, router);
     }
+
+    // one set of negative samples for the whole window
+    if (!contexts.empty()) {
+      unigram_table_.sample(random, &neg_samples[0], &neg_samples[0] + neg_sample_num_);
+      sgd_window(target_index, contexts, neg_samples, grad, replica, router);
+    }
+  }
+  if (routed(router)) {
+    receive_updates(*router);
   }
+  if (0 < decay_count_) {
+    trained_count_.fetch_add(n, std::memory_order_relaxed);
+  }
+}
+
+
+// map words to their indices once per sentence, dropping unknown words
+inline void Skipgram::encode(const std::vector<std::string>& text, std::vector<int>& encoded_text) const {
+
+  vocab_.encode_batch(text, encoded_text);
+  encoded_text.erase(std::remove(encoded_text.begin(), encoded_text.end(), -1), encoded_text.end());
+}
+
+
+inline void Skipgram::encode(const Span* begin, const Span* end, std::vector<int>& encoded_text) const {
+
+  vocab_.encode_batch(begin, end, encoded_text);
+  encoded_text.erase(std::remove(encoded_text.begin(), encoded_text.end(), -1), encoded_text.end());
 }
 
 
@@ -267,31 +485,360 @@ inline void Skipgram::train(const std::vector<std::string>& text, bool increment
 // c: context word index
 // neg_samples: negative context word indices
 // grad: buffer to accumulate gradient
+// replica: if enabled, the output rows it holds are updated instead of the shared ones
+// router: if enabled, only the output rows owned by the worker are updated, and
+//         the updates of the others are sent to their owners (see OutputPartition)
 //
-inline void Skipgram::sgd(const int t, const int c, const std::vector<int>& neg_samples, real_t* grad) {
+inline void Skipgram::sgd(const int t, const int c, const std::vector<int>& neg_samples, real_t* grad, OutputReplica* replica, OutputRouter* router) {
 
-  // positive example
-  real_t sigma = sigmoid(std::inner_product(vec_.input[t], vec_.input[t] + vec_size_, vec_.output[c], 0.0));
-  std::fill(grad, grad + vec_size_, 0.0);
-  mul_add(sigma - 1.0, vec_.output[c], vec_.output[c] + vec_size_, grad);
-  
-  // SGD for vec_.output[c]
-  mul_add((sigma - 1.0)*(sigma - 1.0), vec_.input[t], vec_.input[t] + vec_size_, vec_.input[t], squared_grad_.output[c]);
-  adagrad(eta_*(sigma - 1.0), vec_.input[t], vec_.input[t] + vec_size_, squared_grad_.output[c], vec_.output[c]);
-  
-  // negative examples
-  for (int k = 0; k < neg_sample_num_; ++k) {
-    int v = neg_samples[k];
-    real_t sigma = sigmoid(std::inner_product(vec_.input[t], vec_.input[t] + vec_size_, vec_.output[v], 0.0));
-    mul_add(sigma, vec_.output[v], vec_.output[v] + vec_size_, grad);
+  if (lazy_init_) {
+    materialize(t, &c, 1, neg_samples);
+  }
 
-    // SGD for vec_.output[v]
-    mul_add(sigma*sigma, vec_.input[t], vec_.input[t] + vec_size_, vec_.input[t], squared_grad_.output[v]);  
-    adagrad(eta_*sigma, vec_.input[t], vec_.input[t] + vec_size_, squared_grad_.output[v], vec_.output[v]);
+  // each output vector is read once for the dot product and once for the fused
+  // update, while vec_.input[t] and grad stay in L1 across all 1+k outputs
+  // (see sgd_kernel.h)
+  if (converted()) {
+    sgd_converted(t, c, neg_samples, grad);
+    return;
+  }
+  if (routed(router)) {
+    sgd_routed(t, c, neg_samples, grad, *router);
+    return;
+  }
+  if (replica != NULL && replica->enabled()) {
+    replica_kernel_(learning_rate(), t, c, neg_samples.data(), neg_sample_num_, vec_.input, replica->output, squared_grad_.input, replica->squared_output, grad);
+    sync_replica(*replica);
+    return;
+  }
+  sgd_kernel_(learning_rate(), t, c, neg_samples.data(), neg_sample_num_, vec_.input, vec_.output, squared_grad_.input, squared_grad_.output, grad);
+}
+
+
+//
+// Makes replica hold private copies of the first replica_rows output rows,
+// which are merged into the shared rows every replica_sync_interval updates
+// (see OutputReplica). The replica stays disabled for FP16/BF16 parameters.
+//
+inline void Skipgram::init_replica(OutputReplica& replica) {
+
+  replica.initialize(vec_.output, squared_grad_.output, converted() ? 0 : replica_rows_, replica_sync_interval_);
+}
+
+
+// merges the replica into the shared rows and takes a fresh copy once it is due
+inline void Skipgram::sync_replica(OutputReplica& replica) {
+
+  if (replica.count_update()) {
+    replica.push();
+    replica.pull(vocab_.size());
+  }
+}
+
+
+// whether router is to be used; FP16/BF16 parameters are updated as in Hogwild
+inline bool Skipgram::routed(const OutputRouter* router) const {
+
+  return router != NULL && router->enabled() && !converted();
+}
+
+
+//
+// sgd() with the output rows partitioned among workers: the rows owned by
+// this worker are updated right away, and for the others only the gradient
+// coefficient g is sent to their owners, who apply it with the input vector
+// as it is by then.
+//
+inline void Skipgram::sgd_routed(const int t, const int c, const std::vector<int>& neg_samples, real_t* grad, OutputRouter& router) {
+
+  const int n = vec_size_;
+  const real_t eta = learning_rate();
+  const real_t* x = vec_.input[t];
+  real_t* buffer = router.buffer();
+  std::fill(grad, grad + n, 0.0);
+
+  // positive example, then negative examples
+  for (int k = -1; k < neg_sample_num_; ++k) {
+    const int v = k == -1 ? c : neg_samples[k];
+    real_t* y = vec_.output[v];
+    const real_t g = sigmoid(dot(x, x + n, y)) - (k == -1 ? 1.0 : 0.0);
+    mul_add(g, y, y + n, grad);
+    if (router.owns(v)) {
+      std::fill(buffer, buffer + n, 0.0);
+      mul_add(g, x, x + n, buffer);
+      update(eta, buffer, y, squared_grad_.output[v]);
+    }else {
+      OutputUpdate u = {v, t, g};
+      send_update(router, u);
+    }
+  }
+  update(eta, grad, vec_.input[t], squared_grad_.input[t]);
+}
+
+
+// queues update for the owner of its row
+inline void Skipgram::send_update(OutputRouter& router, const OutputUpdate& update) {
+
+  if (router.add(update)) {
+    wait_for(router, router.owner(update.row));
+  }
+}
+
+
+// applies the updates other workers have sent to this one so far; returns false if there were none
+inline bool Skipgram::receive_updates(OutputRouter& router) {
+
+  bool received = false;
+  const OutputUpdateBatch* batch;
+  while ((batch = router.receive()) != NULL) {
+    for (size_t i = 0; i < batch->size(); ++i) {
+      apply_update((*batch)[i], router.buffer());
+    }
+    received = true;
+  }
+  return received;
+}
+
+
+// flushes the batch to worker `to`, applying the updates sent to this worker while its queue is full
+inline void Skipgram::wait_for(OutputRouter& router, const int to) {
+
+  while (!router.flush(to)) {
+    if (!receive_updates(router)) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+
+//
+// Sends the remaining updates and applies those sent to this worker until
+// every worker sharing the partition has sent all of its own. Each of them
+// must call this at the end of a task, after which the output rows are up
+// to date.
+//
+inline void Skipgram::finish_updates(OutputRouter& router) {
+
+  if (!routed(&router)) {
+    return;
+  }
+  for (int to = 0; to < router.part_num(); ++to) {
+    wait_for(router, to);
+  }
+  router.arrive();
+  while (!router.all_arrived()) {
+    if (!receive_updates(router)) {
+      std::this_thread::yield();
+    }
+  }
+  receive_updates(router);
+}
+
+
+// buffer: vec_size_ elements
+inline void Skipgram::apply_update(const OutputUpdate& update, real_t* buffer) {
+
+  const int n = vec_size_;
+  const real_t* x = vec_.input[update.word];
+  std::fill(buffer, buffer + n, 0.0);
+  mul_add(update.g, x, x + n, buffer);
+  this->update(learning_rate(), buffer, vec_.output[update.row], squared_grad_.output[update.row]);
+}
+
+
+//
+// sgd() for parameters stored in FP16/BF16: every row is converted to real_t
+// before use and stored back right after its update, so that duplicate
+// negative samples see each other's updates as in the FP32 kernels.
+//
+// grad: buffer of grad_size() elements, the input gradient followed by the
+//       converted input row, output row and their optimizer state
+//
+inline void Skipgram::sgd_converted(const int t, const int c, const std::vector<int>& neg_samples, real_t* grad) {
+
+  const int n = vec_size_;
+  const int state_size = this->state_size();
+  real_t* x  = grad + n;
+  real_t* y  = x + n;
+  real_t* sx = y + n;
+  real_t* sy = sx + state_size;
+  const real_t eta = learning_rate();
+  vec_.input.get(t, x);
+  const real_t xx = optimizer_ == ROW_ADAGRAD ? dot(x, x + n, x)/n : 0.0;
+  std::fill(grad, grad + n, 0.0);
+
+  // positive example, then negative examples
+  for (int k = -1; k < neg_sample_num_; ++k) {
+    const int v = k == -1 ? c : neg_samples[k];
+    vec_.output.get(v, y);
+    if (0 < state_size) {
+      squared_grad_.output.get(v, sy);
+    }
+    const double g = sigmoid(dot(x, x + n, y)) - (k == -1 ? 1.0 : 0.0);
+    if (optimizer_ == ADAGRAD) {
+      adagrad_output(eta, g, x, x + n, y, sy, grad);
+    }else if (optimizer_ == ROW_ADAGRAD) {
+      sy[0] += g*g*xx;
+      sgd_output(g, eta*invsqrt(sy[0])*g, x, x + n, y, grad);
+    }else {
+      sgd_output(g, eta*g, x, x + n, y, grad);
+    }
+    vec_.output.set(v, y);
+    if (0 < state_size) {
+      squared_grad_.output.set(v, sy);
+    }
+  }
+  update(eta, grad, t, vec_.input, squared_grad_.input, x);
+}
+
+
+//
+// Shared negative samples: all pairs of a window are updated at once.
+// As in word2vec, the contexts play the input side and the target the output
+// side, so that the m context vectors meet the same 1+k output vectors (the
+// target and the shared negatives). The scores are then an m x (1+k) matrix
+// product and the gradients two more small products, all on rows that stay
+// in L1. Every score uses the parameters as they were before the update.
+//
+// t: target word index
+// contexts: context word indices (at most 2*window_size)
+// neg_samples: negative word indices shared by the contexts
+// grad: buffer of grad_size() elements
+// replica, router: see sgd()
+//
+inline void Skipgram::sgd_window(const int t, const std::vector<int>& contexts, const std::vector<int>& neg_samples, real_t* grad, OutputReplica* replica, OutputRouter* router) {
+
+  const int m = contexts.size();
+  const int k = neg_sample_num_ + 1;
+#ifdef __YSKIP_DEBUG__
+  assert(m <= 2*window_size_);
+#endif
+  if (lazy_init_) {
+    materialize(t, contexts.data(), m, neg_samples);
+  }
+  real_t* input_grad  = grad;
+  real_t* output_grad = input_grad + static_cast<size_t>(2*window_size_)*vec_size_;
+  real_t* score       = output_grad + static_cast<size_t>(k)*vec_size_;
+  real_t* buffer      = score + 2*window_size_*k; // converted rows, see grad_size()
+  std::vector<const real_t*> inputs(m);
+  std::vector<const real_t*> outputs(k);
+  for (int i = 0; i < m; ++i) {
+    inputs[i] = row(vec_.input, contexts[i], buffer + static_cast<size_t>(i)*vec_size_);
+  }
+  buffer += static_cast<size_t>(2*window_size_)*vec_size_;
+  if (routed(router)) {
+    replica = NULL;
+  }
+  const bool replicated = replica != NULL && replica->enabled();
+  for (int j = 0; j < k; ++j) {
+    const int v = j == 0 ? t : neg_samples[j - 1];
+    outputs[j] = replicated ? replica->output[v] : row(vec_.output, v, buffer + static_cast<size_t>(j)*vec_size_);
+  }
+  buffer += static_cast<size_t>(k)*vec_size_;
+
+  // score[i][j] = sigmoid(input[c_i] . outputs[j]) - label
+  for (int i = 0; i < m; ++i) {
+    real_t* s = score + i*k;
+    dots(inputs[i], inputs[i] + vec_size_, &outputs[0], k, s);
+    s[0] = sigmoid(s[0]) - 1.0;
+    for (int j = 1; j < k; ++j) {
+      s[j] = sigmoid(s[j]);
+    }
+  }
+
+  // input_grad = score * outputs, output_grad = score^T * inputs
+  std::fill(output_grad, output_grad + static_cast<size_t>(k)*vec_size_, 0.0);
+  for (int i = 0; i < m; ++i) {
+    const real_t* input = inputs[i];
+    real_t* g = input_grad + static_cast<size_t>(i)*vec_size_;
+    std::fill(g, g + vec_size_, 0.0);
+    for (int j = 0; j < k; ++j) {
+      mul_add(score[i*k + j], outputs[j], outputs[j] + vec_size_, g);
+      mul_add(score[i*k + j], input, input + vec_size_, output_grad + static_cast<size_t>(j)*vec_size_);
+    }
+  }
+
+  //
+  const real_t eta = learning_rate();
+  for (int j = 0; j < k; ++j) {
+    const int v = j == 0 ? t : neg_samples[j - 1];
+    if (replicated) {
+      update(eta, output_grad + static_cast<size_t>(j)*vec_size_, replica->output[v], replica->squared_output[v]);
+    }else if (routed(router) && !router->owns(v)) {
+      // one update per context, since the owner only has the coefficients
+      for (int i = 0; i < m; ++i) {
+	OutputUpdate u = {v, contexts[i], score[i*k + j]};
+	send_update(*router, u);
+      }
+    }else {
+      update(eta, output_grad + static_cast<size_t>(j)*vec_size_, v, vec_.output, squared_grad_.output, buffer);
+    }
+  }
+  for (int i = 0; i < m; ++i) {
+    update(eta, input_grad + static_cast<size_t>(i)*vec_size_, contexts[i], vec_.input, squared_grad_.input, buffer);
+  }
+  if (replicated) {
+    sync_replica(*replica);
   }
-  
-  mul_add(grad, grad + vec_size_, grad, squared_grad_.input[t]);
-  adagrad(eta_, grad, grad + vec_size_, squared_grad_.input[t], vec_.input[t]);
+}
+
+
+// applies grad to the parameter vector x, whose optimizer state is squared_grad
+inline void Skipgram::update(const real_t eta, const real_t* grad, real_t* x, real_t* squared_grad) {
+
+  if (optimizer_ == ADAGRAD) {
+    adagrad_input(eta, grad, grad + vec_size_, squared_grad, x);
+  }else if (optimizer_ == ROW_ADAGRAD) {
+    *squared_grad += dot(grad, grad + vec_size_, grad)/vec_size_;
+    mul_add(-eta*invsqrt(*squared_grad), grad, grad + vec_size_, x);
+  }else {
+    mul_add(-eta, grad, grad + vec_size_, x);
+  }
+}
+
+
+// applies grad to row w of vec; buffer holds vec_size_ + state_size() elements for the conversion
+inline void Skipgram::update(const real_t eta, const real_t* grad, const int w, DenseMatrix& vec, DenseMatrix& squared_grad, real_t* buffer) {
+
+  if (!converted()) {
+    update(eta, grad, vec[w], squared_grad[w]);
+    return;
+  }
+  real_t* x = buffer;
+  real_t* s = buffer + vec_size_;
+  vec.get(w, x);
+  if (0 < state_size()) {
+    squared_grad.get(w, s);
+  }
+  update(eta, grad, x, s);
+  vec.set(w, x);
+  if (0 < state_size()) {
+    squared_grad.set(w, s);
+  }
+}
+
+
+// row w of m as real_t, converted into buffer unless m is stored in FP32
+inline const real_t* Skipgram::row(const DenseMatrix& m, const int w, real_t* buffer) const {
+
+  if (m.type() == FP32) {
+    return m[w];
+  }
+  m.get(w, buffer);
+  return buffer;
+}
+
+
+// whether the parameters must be converted from and to FP16/BF16
+inline bool Skipgram::converted() const {
+
+  return vector_storage_ != FP32 || (0 < state_size() && state_storage_ != FP32);
+}
+
+
+inline int Skipgram::state_size() const {
+
+  return optimizer_state_size(optimizer_, vec_size_);
 }
 
 
@@ -331,11 +878,38 @@ inline void Skipgram::update_unigram_table(const std::vector<std::string>& text,
 }
 
 
+inline void Skipgram::update_unigram_table(const Span* begin, const Span* end, Random& random) {
+
+  for (const Span* it = begin; it != end; ++it) {
+    update_unigram_table(it->begin, it->end, random);
+  }
+}
+
+
 inline void Skipgram::update_unigram_table(const std::string& word, Random& random) {
+
+  update_unigram_table(word.data(), word.data() + word.size(), random);
+}
+
+
+//
+// In multi-thread incremental training this runs on the main thread while the
+// workers train on earlier sentences, reading the counts, the vocabulary size
+// and the unigram table that it updates. Like the vectors in Hogwild, they are
+// shared without locks: a single writer stores them with relaxed atomics and
+// the workers load them the same way, so a worker may see a count or a table
+// entry a few sentences old, which only shifts the subsampling and the
+// negative samples slightly. Reducing the vocabulary renumbers the words, so
+// the caller must let the workers finish first (see train_incremental()).
+//
+inline void Skipgram::update_unigram_table(const char* begin, const char* end, Random& random) {
   // update vocabulary
-  int word_index = vocab_.add(word);
-  total_count_ += 1;
-  counts_[word_index] += 1;
+  int word_index = vocab_.add(begin, end);
+  if (lazy_init_) {
+    materialize(word_index);
+  }
+  __atomic_store_n(&total_count_, total_count_ + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&counts_[word_index], counts_[word_index] + 1, __ATOMIC_RELAXED);
 
   // update unigram table
   unigram_table_.update(word_index, std::pow(static_cast<real_t>(counts_[word_index]), alpha_) - std::pow(static_cast<real_t>(counts_[word_index]-1), alpha_), random);
@@ -377,17 +951,197 @@ inline void Skipgram::reduce_vocab(Random& random) {
 
   //
   vocab_.reduce(reserved_word_indices);
-  vec_.input.reduce(reserved_word_indices);
-  vec_.output.reduce(reserved_word_indices);
-  squared_grad_.input.reduce(reserved_word_indices);
-  squared_grad_.output.reduce(reserved_word_indices);
-  for (int w = reduced_vocab_size; w < max_vocab_size_; ++w) {
-    for (int i = 0; i < vec_size_; ++i) {
-      vec_.input[w][i]  = random.uniform(static_cast<real_t>(-0.5)/static_cast<real_t>(vec_size_), static_cast<real_t>(0.5)/static_cast<real_t>(vec_size_));
-      vec_.output[w][i] = random.uniform(static_cast<real_t>(-0.5)/static_cast<real_t>(vec_size_), static_cast<real_t>(0.5)/static_cast<real_t>(vec_size_));
-      squared_grad_.input[w][i]  = 1.0e-8;
-      squared_grad_.output[w][i] = 1.0e-8;
+  if (lazy_init_) {
+    // the rows of removed words go back to their initializers and release their memory
+    vec_.input.reduce(reserved_word_indices);
+    vec_.output.reduce(reserved_word_indices);
+    if (0 < state_size()) {
+      squared_grad_.input.reduce(reserved_word_indices);
+      squared_grad_.output.reduce(reserved_word_indices);
+    }
+  }else {
+    vec_.input.DenseMatrix::reduce(reserved_word_indices);
+    vec_.output.DenseMatrix::reduce(reserved_word_indices);
+    init_vec(reduced_vocab_size, max_vocab_size_, random);
+    if (0 < state_size()) {
+      const std::vector<real_t> initial_state(state_size(), 1.0e-8);
+      squared_grad_.input.DenseMatrix::reduce(reserved_word_indices);
+      squared_grad_.output.DenseMatrix::reduce(reserved_word_indices);
+      for (int w = reduced_vocab_size; w < max_vocab_size_; ++w) {
+	squared_grad_.input.set(w, &initial_state[0]);
+	squared_grad_.output.set(w, &initial_state[0]);
+      }
+    }
+  }
+
+  // the rows are rewritten anyway, so this is the time to bring the frequent words together
+  if (frequency_order_) {
+    sort_vocab();
+  }
+}
+
+
+//
+// Renumbers the words in the descending order of their counts, so that the
+// rows of the few words receiving most of the updates are contiguous at the
+// top of the matrices instead of spread in the order the words were first
+// seen. Ties keep their order. Callers must make sure that no sentence
+// encoded with the old numbering is still to be trained.
+//
+inline void Skipgram::sort_vocab() {
+
+  //
+  const int vocab_size = vocab_.size();
+  std::vector<int> order(vocab_size);
+  for (int w = 0; w < vocab_size; ++w) {
+    order[w] = w;
+  }
+  std::stable_sort(order.begin(), order.end(), [this](const int w1, const int w2) {
+      return counts_[w1] > counts_[w2];
+    });
+  std::vector<int> new_index(vocab_size);
+  for (int w = 0; w < vocab_size; ++w) {
+    new_index[order[w]] = w;
+  }
+
+  //
+  vocab_.renumber(new_index);
+  unigram_table_.renumber(new_index);
+  const std::vector<count_t> counts(counts_.begin(), counts_.begin() + vocab_size);
+  for (int w = 0; w < vocab_size; ++w) {
+    counts_[w] = counts[order[w]];
+  }
+  vec_.input.permute(order);
+  vec_.output.permute(order);
+  if (0 < state_size()) {
+    squared_grad_.input.permute(order);
+    squared_grad_.output.permute(order);
+  }
+}
+
+
+// draws the vectors of words [first, last) uniformly from [-0.5/vec_size, 0.5/vec_size]
+inline void Skipgram::init_vec(const int first, const int last, Random& random) {
+
+  const real_t min = static_cast<real_t>(-0.5)/static_cast<real_t>(vec_size_);
+  const real_t max = static_cast<real_t>(0.5)/static_cast<real_t>(vec_size_);
+  std::vector<real_t> v(vec_size_);
+  for (int w = first; w < last; ++w) {
+    random.fill(&v[0], &v[0] + vec_size_, min, max);
+    vec_.input.set(w, &v[0]);
+    random.fill(&v[0], &v[0] + vec_size_, min, max);
+    vec_.output.set(w, &v[0]);
+  }
+}
+
+
+// initial values of the rows materialized later on (lazy_init_): vectors drawn
+// as in init_vec() from streams of the given seed, and the initial squared gradient
+inline void Skipgram::set_initializers(const int seed) {
+
+  const real_t min = static_cast<real_t>(-0.5)/static_cast<real_t>(vec_size_);
+  const real_t max = static_cast<real_t>(0.5)/static_cast<real_t>(vec_size_);
+  vec_.input.set_random(min, max, seed);
+  vec_.output.set_random(min, max, seed ^ 0x5bd1e995);
+  squared_grad_.input.set_initial_value(1.0e-8);
+  squared_grad_.output.set_initial_value(1.0e-8);
+}
+
+
+// backs the rows of m with huge pages and places them on the NUMA nodes as the options say
+inline void Skipgram::advise_memory(const DenseMatrix& m) const {
+
+  if (0 < huge_page_rows_) {
+    m.advise_huge_pages(huge_page_rows_);
+  }
+  if (numa_mode_ == NUMA_INTERLEAVE) {
+    m.interleave(numa_);
+  }else if (numa_mode_ == NUMA_PARTITION) {
+    const int n = numa_.node_num();
+    for (int node = 0; node < n; ++node) {
+      m.bind(numa_, static_cast<int64_t>(m.row_num())*node/n, static_cast<int64_t>(m.row_num())*(node + 1)/n, node);
+    }
+  }
+}
+
+
+// makes the rows of word w usable by the SGD kernels
+inline void Skipgram::materialize(const int w) {
+
+  vec_.input.materialize(w);
+  vec_.output.materialize(w);
+  if (0 < state_size()) {
+    squared_grad_.input.materialize(w);
+    squared_grad_.output.materialize(w);
+  }
+}
+
+
+// materializes every row of an update before the kernels take pointers to them,
+// so that no row is trained before its initial values are set; thread-safe
+inline void Skipgram::materialize(const int t, const int* contexts, const int context_num, const std::vector<int>& neg_samples) {
+
+  materialize(t);
+  for (int i = 0; i < context_num; ++i) {
+    materialize(contexts[i]);
+  }
+  for (size_t i = 0; i < neg_samples.size(); ++i) {
+    materialize(neg_samples[i]);
+  }
+}
+
+
+// allocates the optimizer state; SGD keeps none
+inline void Skipgram::reset_squared_grad(const int max_vocab_size) {
+
+  if (0 < state_size()) {
+    squared_grad_ = SparseParameter(max_vocab_size, state_size(), 1.0e-8, state_storage_, row_alignment_);
+    advise_memory(squared_grad_.input);
+    advise_memory(squared_grad_.output);
+    if (!lazy_init_) {
+      squared_grad_.input.materialize_all();
+      squared_grad_.output.materialize_all();
+    }
+  }else {
+    squared_grad_ = SparseParameter();
+  }
+}
+
+
+//
+// Moves vec_ and squared_grad_ into blocks_ if the layout is INTERLEAVED.
+// Each row of a block holds the vector of a word followed by its optimizer
+// state, both padded to 64 bytes, so that an update brings in adjacent cache
+// lines and one TLB entry per word instead of two. vec_ and squared_grad_
+// become views on the blocks and nothing else has to know about the layout.
+// Vectors and state of different storage types are left separate.
+//
+inline void Skipgram::set_layout() {
+
+  if (layout_ != INTERLEAVED || state_size() == 0 || vector_storage_ != state_storage_) {
+    blocks_ = Parameter();
+    return;
+  }
+  const int align      = 64/storage_size(vector_storage_);
+  const int vec_cols   = (vec_size_ + align - 1)/align*align;
+  const int state_cols = (state_size() + align - 1)/align*align;
+  blocks_ = Parameter(max_vocab_size_, vec_cols + state_cols, 0.0, vector_storage_);
+  advise_memory(blocks_.input);
+  advise_memory(blocks_.output);
+  SparseMatrix* matrices[] = {&vec_.input, &squared_grad_.input, &vec_.output, &squared_grad_.output};
+  DenseMatrix* blocks[]    = {&blocks_.input, &blocks_.input, &blocks_.output, &blocks_.output};
+  const int col_offsets[]  = {0, vec_cols, 0, vec_cols};
+  std::vector<real_t> v(std::max(vec_size_, state_size()));
+  for (int i = 0; i < 4; ++i) {
+    // the rows go straight into their columns of the blocks, so that no matrix is copied as a whole
+    const int col_num = matrices[i]->col_num();
+    DenseMatrix columns;
+    columns.view(*blocks[i], col_offsets[i], col_num);
+    for (int w = 0; w < matrices[i]->row_num(); ++w) {
+      matrices[i]->get(w, &v[0]);
+      columns.set(w, &v[0]);
     }
+    matrices[i]->view(*blocks[i], col_offsets[i], col_num);
   }
 }
 
@@ -434,51 +1188,84 @@ inline int Skipgram::load_text(const char* filename) {
   }
   
   // read header
-  char line[BUFF_SIZE];
-  if (fgets(line, BUFF_SIZE, is) == NULL) {
+  LineReader reader(is);
+  Span line;
+  if (!reader.next(line)) {
     std::fprintf(stderr, "%s is empty\n", filename);
     return FAILURE;
   }
-  line[strlen(line)-1] = '\0';
   int vocab_size;
-  if (sscanf(line, "%d\t%d\t%d\t%d\t%d\t%f\t%f\t%f\t%d\n", &vocab_size, &max_vocab_size_, &vec_size_, &window_size_, &neg_sample_num_, &alpha_, &subsampling_threshold_, &eta_, &unigram_table_size_) != 9) {
-    std::fprintf(stderr, HERE "invalid format (%s): %s\n", filename, line);
+  long long unigram_table_size;
+  optimizer_      = ADAGRAD; // older models have neither the optimizer nor the storage fields
+  vector_storage_ = FP32;
+  state_storage_  = FP32;
+  const int field_num = sscanf(line.begin, "%d\t%d\t%d\t%d\t%d\t%f\t%f\t%f\t%lld\t%d\t%d\t%d\n", &vocab_size, &max_vocab_size_, &vec_size_, &window_size_, &neg_sample_num_, &alpha_, &subsampling_threshold_, &eta_, &unigram_table_size, &optimizer_, &vector_storage_, &state_storage_);
+  if ((field_num != 9 && field_num != 10 && field_num != 12) || optimizer_ < ADAGRAD || SGD < optimizer_ || vector_storage_ < FP32 || BF16 < vector_storage_ || state_storage_ < FP32 || BF16 < state_storage_) {
+    std::fprintf(stderr, HERE "invalid format (%s): %s\n", filename, line.begin);
     return FAILURE;
   }
+  unigram_table_size_ = unigram_table_size;
+  const int state_size = this->state_size();
     
   //
-  vocab_.initialize(max_vocab_size_*2);
-  vec_ = Parameter(max_vocab_size_, vec_size_, 0.0);
-  squared_grad_ = Parameter(max_vocab_size_, vec_size_, 1.0e-8);
+  vocab_.initialize(static_cast<uint64_t>(max_vocab_size_)*2);
+  vec_ = SparseParameter(max_vocab_size_, vec_size_, 0.0, vector_storage_, row_alignment_);
+  advise_memory(vec_.input);
+  advise_memory(vec_.output);
+  if (!lazy_init_) {
+    vec_.input.materialize_all();
+    vec_.output.materialize_all();
+  }
+  reset_squared_grad(max_vocab_size_);
+  if (lazy_init_) {
+    set_initializers(init_seed_); // the seed of the run, not of the saved model
+  }
   total_count_ = 0;
   counts_ = std::vector<count_t>(max_vocab_size_, 0);
 
   //
-  char word[BUFF_SIZE], s1[BUFF_SIZE], s2[BUFF_SIZE], s3[BUFF_SIZE], s4[BUFF_SIZE];
+  std::vector<char> fields; // a field is no longer than its line
   uint64_t count;
-  while (fgets(line, BUFF_SIZE, is) != NULL) {
-    line[strlen(line)-1] = '\0';
-    if (sscanf(line, "%s %lld %[^\t] %[^\t] %[^\t] %[^\t]", word, &count, s1, s2, s3, s4) != 6) {
-      std::fprintf(stderr, HERE "invalid format (%s): %s\n", filename, line);
+  std::vector<real_t> v(std::max(vec_size_, state_size));
+  while (reader.next(line)) {
+    if (fields.size() < 5*(line.size() + 1)) {
+      fields.resize(5*(line.size() + 1));
+    }
+    char* word = &fields[0];
+    char* s1   = word + line.size() + 1;
+    char* s2   = s1 + line.size() + 1;
+    char* s3   = s2 + line.size() + 1;
+    char* s4   = s3 + line.size() + 1;
+    if (sscanf(line.begin, "%s %lld %[^\t] %[^\t] %[^\t] %[^\t]", word, &count, s1, s2, s3, s4) != (0 < state_size ? 6 : 4)) {
+      std::fprintf(stderr, HERE "invalid format (%s): %s\n", filename, line.begin);
       return FAILURE;
     }
     vocab_.add(word);
     total_count_ += count;
     int index = vocab_.size() - 1;
     counts_[index] = count;
-    yskip::load(s1, vec_.input[index]);
-    yskip::load(s2, vec_.output[index]);
-    yskip::load(s3, squared_grad_.input[index]);
-    yskip::load(s4, squared_grad_.output[index]);
+    yskip::load(s1, &v[0]);
+    vec_.input.set(index, &v[0]);
+    yskip::load(s2, &v[0]);
+    vec_.output.set(index, &v[0]);
+    if (0 < state_size) {
+      yskip::load(s3, &v[0]);
+      squared_grad_.input.set(index, &v[0]);
+      yskip::load(s4, &v[0]);
+      squared_grad_.output.set(index, &v[0]);
+    }
   }
   if (strcmp(filename, "-") != 0) {
     fclose(is);
   }
   
   //
+  set_layout();
   unigram_table_.initialize(unigram_table_size_);
   Random random(0);
   this->rebuild_unigram_table(random);
+  sgd_kernel_ = sgd_kernel(vec_size_, optimizer_);
+  replica_kernel_ = sgd_kernel<ReplicatedRows>(vec_size_, optimizer_);
 
   return SUCCESS;
 }
@@ -502,7 +1289,7 @@ inline int Skipgram::save_text(const char* filename) const {
   
   // header
   std::fprintf(os,
-	       "%d\t%d\t%d\t%d\t%d\t%f\t%f\t%f\t%d\n",
+	       "%d\t%d\t%d\t%d\t%d\t%f\t%f\t%f\t%lld\t%d\t%d\t%d\n",
 	       vocab_.size(),
 	       max_vocab_size_,
 	       vec_size_,
@@ -511,39 +1298,52 @@ inline int Skipgram::save_text(const char* filename) const {
 	       alpha_,
 	       subsampling_threshold_,
 	       eta_,
-	       unigram_table_.max_size());
+	       static_cast<long long>(unigram_table_.max_size()),
+	       optimizer_,
+	       vector_storage_,
+	       state_storage_);
   
   // word vectors
+  const int state_size = this->state_size();
+  std::vector<real_t> v(std::max(vec_size_, state_size));
   std::vector<std::string> words = vocab_.all();
   for (int index = 0; index < words.size(); ++index) {
     std::fprintf(os, "%s", words[index].c_str());
     std::fprintf(os, "\t%lld", counts_[index]);
+    vec_.input.get(index, &v[0]);
     for (int i = 0; i < vec_size_; ++i) {
       if (i == 0) {
-    	std::fprintf(os, "\t%lf", vec_.input[index][i]);
+    	std::fprintf(os, "\t%lf", v[i]);
       }else {
-    	std::fprintf(os, " %lf", vec_.input[index][i]);
+    	std::fprintf(os, " %lf", v[i]);
       }
     }
+    vec_.output.get(index, &v[0]);
     for (int i = 0; i < vec_size_; ++i) {
       if (i == 0) {
-    	std::fprintf(os, "\t%lf", vec_.output[index][i]);
+    	std::fprintf(os, "\t%lf", v[i]);
       }else {
-    	std::fprintf(os, " %lf", vec_.output[index][i]);
+    	std::fprintf(os, " %lf", v[i]);
       }
     }
-    for (int i = 0; i < vec_size_; ++i) {
+    if (0 < state_size) {
+      squared_grad_.input.get(index, &v[0]);
+    }
+    for (int i = 0; i < state_size; ++i) {
       if (i == 0) {
-    	std::fprintf(os, "\t%lf", squared_grad_.input[index][i]);
+    	std::fprintf(os, "\t%lf", v[i]);
       }else {
-    	std::fprintf(os, " %lf", squared_grad_.input[index][i]);
+    	std::fprintf(os, " %lf", v[i]);
       }
     }
-    for (int i = 0; i < vec_size_; ++i) {
+    if (0 < state_size) {
+      squared_grad_.output.get(index, &v[0]);
+    }
+    for (int i = 0; i < state_size; ++i) {
       if (i == 0) {
-    	std::fprintf(os, "\t%lf", squared_grad_.output[index][i]);
+    	std::fprintf(os, "\t%lf", v[i]);
       }else {
-    	std::fprintf(os, " %lf", squared_grad_.output[index][i]);
+    	std::fprintf(os, " %lf", v[i]);
       }
     }
     std::fprintf(os, "\n");
@@ -576,9 +1376,20 @@ inline int Skipgram::load_bin(const char* filename) {
 inline int Skipgram::load_bin(FILE* is) {
   
   //
+  int version = 0;
   if (fread(&max_vocab_size_, sizeof(int), 1, is) != 1) {
     return FAILURE;
   }
+  if (max_vocab_size_ < 0) {
+    version = -max_vocab_size_;
+    if (MODEL_VERSION < version) {
+      std::fprintf(stderr, HERE "unsupported model version: %d\n", version);
+      return FAILURE;
+    }
+    if (fread(&max_vocab_size_, sizeof(int), 1, is) != 1) {
+      return FAILURE;
+    }
+  }
   if (fread(&vec_size_, sizeof(int), 1, is) != 1) {
     return FAILURE;
   }
@@ -597,26 +1408,67 @@ inline int Skipgram::load_bin(FILE* is) {
   if (fread(&eta_, sizeof(real_t), 1, is) != 1) {
     return FAILURE;
   }
-  if (fread(&unigram_table_size_, sizeof(int), 1, is) != 1) {
+  if (3 <= version) {
+    if (fread(&unigram_table_size_, sizeof(int64_t), 1, is) != 1) {
+      return FAILURE;
+    }
+  }else {
+    int unigram_table_size;
+    if (fread(&unigram_table_size, sizeof(int), 1, is) != 1) {
+      return FAILURE;
+    }
+    unigram_table_size_ = unigram_table_size;
+  }
+  optimizer_ = ADAGRAD;
+  if (1 <= version && fread(&optimizer_, sizeof(int), 1, is) != 1) {
     return FAILURE;
   }
-
-  //
-  if (vocab_.load(is) == FAILURE) {
+  if (optimizer_ < ADAGRAD || SGD < optimizer_) {
+    std::fprintf(stderr, HERE "unknown optimizer: %d\n", optimizer_);
     return FAILURE;
   }
-  if (vec_.input.load(is) == FAILURE) {
+  vector_storage_ = FP32;
+  state_storage_  = FP32;
+  if (2 <= version) {
+    if (fread(&vector_storage_, sizeof(int), 1, is) != 1) {
+      return FAILURE;
+    }
+    if (fread(&state_storage_, sizeof(int), 1, is) != 1) {
+      return FAILURE;
+    }
+  }
+  if (vector_storage_ < FP32 || BF16 < vector_storage_ || state_storage_ < FP32 || BF16 < state_storage_) {
+    std::fprintf(stderr, HERE "unknown storage type: %d %d\n", vector_storage_, state_storage_);
     return FAILURE;
   }
-  if (vec_.output.load(is) == FAILURE) {
+
+  //
+  if (vocab_.load(is, 3 <= version) == FAILURE) {
     return FAILURE;
   }
-  if (squared_grad_.input.load(is) == FAILURE) {
+  if (vec_.input.load(is, vector_storage_, row_alignment_) == FAILURE) {
     return FAILURE;
   }
-  if (squared_grad_.output.load(is) == FAILURE) {
+  if (vec_.output.load(is, vector_storage_, row_alignment_) == FAILURE) {
     return FAILURE;
   }
+  if (0 < state_size()) {
+    if (squared_grad_.input.load(is, state_storage_, row_alignment_) == FAILURE) {
+      return FAILURE;
+    }
+    if (squared_grad_.output.load(is, state_storage_, row_alignment_) == FAILURE) {
+      return FAILURE;
+    }
+    advise_memory(squared_grad_.input);
+    advise_memory(squared_grad_.output);
+  }else {
+    squared_grad_ = SparseParameter();
+  }
+  advise_memory(vec_.input);
+  advise_memory(vec_.output);
+  if (lazy_init_) {
+    set_initializers(init_seed_); // the seed of the run, not of the saved model
+  }
   
   //
   if (fread(&total_count_, sizeof(count_t), 1, is) != 1) {
@@ -628,9 +1480,12 @@ inline int Skipgram::load_bin(FILE* is) {
   }
 
   //
+  set_layout();
   unigram_table_.initialize(unigram_table_size_);
   Random random(0);
   this->rebuild_unigram_table(random);
+  sgd_kernel_ = sgd_kernel(vec_size_, optimizer_);
+  replica_kernel_ = sgd_kernel<ReplicatedRows>(vec_size_, optimizer_);
     
   return SUCCESS;
 }
@@ -656,6 +1511,10 @@ inline int Skipgram::save_bin(const char* filename) const {
 inline int Skipgram::save_bin(FILE* os) const {
 
   //
+  const int version = -MODEL_VERSION;
+  if (fwrite(&version, sizeof(int), 1, os) != 1) {
+    return FAILURE;
+  }
   if (fwrite(&max_vocab_size_, sizeof(int), 1, os) != 1) {
     return FAILURE;
   }
@@ -677,7 +1536,16 @@ inline int Skipgram::save_bin(FILE* os) const {
   if (fwrite(&eta_, sizeof(real_t), 1, os) != 1) {
     return FAILURE;
   }
-  if (fwrite(&unigram_table_size_, sizeof(int), 1, os) != 1) {
+  if (fwrite(&unigram_table_size_, sizeof(int64_t), 1, os) != 1) {
+    return FAILURE;
+  }
+  if (fwrite(&optimizer_, sizeof(int), 1, os) != 1) {
+    return FAILURE;
+  }
+  if (fwrite(&vector_storage_, sizeof(int), 1, os) != 1) {
+    return FAILURE;
+  }
+  if (fwrite(&state_storage_, sizeof(int), 1, os) != 1) {
     return FAILURE;
   }
 
@@ -691,11 +1559,13 @@ inline int Skipgram::save_bin(FILE* os) const {
   if (vec_.output.save(os) == FAILURE) {
     return FAILURE;
   }
-  if (squared_grad_.input.save(os) == FAILURE) {
-    return FAILURE;
-  }
-  if (squared_grad_.output.save(os) == FAILURE) {
-    return FAILURE;
+  if (0 < state_size()) {
+    if (squared_grad_.input.save(os) == FAILURE) {
+      return FAILURE;
+    }
+    if (squared_grad_.output.save(os) == FAILURE) {
+      return FAILURE;
+    }
   }
 
   //
@@ -746,6 +1616,108 @@ inline real_t Skipgram::eta() const {
 }
 
 
+inline int Skipgram::sgd_mode() const {
+
+  return sgd_mode_;
+}
+
+
+inline int Skipgram::optimizer() const {
+
+  return optimizer_;
+}
+
+
+inline int Skipgram::vector_storage() const {
+
+  return vector_storage_;
+}
+
+
+inline int Skipgram::state_storage() const {
+
+  return state_storage_;
+}
+
+
+inline int Skipgram::layout() const {
+
+  return layout_;
+}
+
+
+inline int Skipgram::row_alignment() const {
+
+  return row_alignment_;
+}
+
+
+inline bool Skipgram::lazy_init() const {
+
+  return lazy_init_;
+}
+
+
+inline bool Skipgram::frequency_order() const {
+
+  return frequency_order_;
+}
+
+
+inline int Skipgram::huge_page_rows() const {
+
+  return huge_page_rows_;
+}
+
+
+inline int Skipgram::replica_rows() const {
+
+  return replica_rows_;
+}
+
+
+inline int Skipgram::replica_sync_interval() const {
+
+  return replica_sync_interval_;
+}
+
+
+inline int Skipgram::numa_mode() const {
+
+  return numa_mode_;
+}
+
+
+inline void Skipgram::set_decay_count(const count_t count) {
+
+  decay_count_   = count;
+  trained_count_ = 0;
+}
+
+
+inline real_t Skipgram::learning_rate() const {
+
+  if (optimizer_ != SGD || decay_count_ == 0) {
+    return eta_;
+  }
+  const double ratio = 1.0 - static_cast<double>(trained_count_.load(std::memory_order_relaxed))/static_cast<double>(decay_count_);
+  return eta_*std::max(ratio, 1.0e-4);
+}
+
+
+inline size_t Skipgram::grad_size() const {
+
+  // FP16/BF16 parameters also need room for their rows converted to real_t
+  const size_t state_size = this->state_size();
+  if (sgd_mode_ == WINDOW_SGD) {
+    const size_t k = neg_sample_num_ + 1;
+    const size_t size = (2*window_size_ + k)*vec_size_ + 2*window_size_*k;
+    return converted() ? size + (2*window_size_ + k + 1)*vec_size_ + state_size : size;
+  }
+  return converted() ? 3*vec_size_ + 2*state_size : vec_size_;
+}
+
+
 inline int Skipgram::max_vocab_size() const {
   
   return max_vocab_size_;
@@ -770,7 +1742,7 @@ inline const Vocab& Skipgram::vocab() const {
 }
 
 
-inline const Parameter& Skipgram::vec() const {
+inline const SparseParameter& Skipgram::vec() const {
 
   return vec_;
 }
@@ -0,0 +1,433 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#pragma once
+#include <sys/mman.h>
+#include <unistd.h> // sysconf
+#include <vector>
+#include <unordered_set>
+#include <mutex>
+#include "util.h"
+#include "random.h"
+#include "dense_matrix.h"
+
+
+namespace yskip {
+
+
+//
+// Matrix whose rows are initialized on demand.
+// The rows are reserved as untouched virtual memory and materialized a chunk
+// of CHUNK_ROWS rows at a time by materialize(), so that the memory in use
+// and the time spent initializing grow with the rows actually used rather
+// than with row_num. A row is initialized to a constant or to uniform random
+// numbers drawn from a stream of its own, which makes its value independent
+// of the order in which the chunks are materialized.
+//
+// Rows must be materialized before they are accessed through operator[];
+// get(), set() and save() take care of it themselves. materialize() may be
+// called by any thread, e.g. by the SGD workers before they take a row: a
+// chunk is initialized under a lock, and is then flagged as ready with a
+// release store that the lock-free check of the other threads acquires.
+// reduce(), clear() and load() must not run concurrently with training.
+//
+class SparseMatrix : public DenseMatrix {
+ public:
+  static const int CHUNK_ROWS = 1024;
+
+  SparseMatrix();
+  SparseMatrix(const SparseMatrix& other);
+  SparseMatrix(const int row_num, const int col_num, const real_t val=0.0, const int type=FP32, const int row_alignment=0);
+  ~SparseMatrix();
+  SparseMatrix& operator=(const SparseMatrix& other);
+  const real_t* operator[](const int row) const;
+  real_t* operator[](const int row);
+  void set_initial_value(const real_t val);
+  void set_random(const real_t min, const real_t max, const int seed);
+  void materialize(const int row);
+  void materialize_all();
+  bool materialized(const int row) const;
+  int materialized_row_num() const;
+  void get(const int row, real_t* v) const;
+  void set(const int row, const real_t* v);
+  void reduce(const std::unordered_set<int>& reserved_rows);
+  void view(DenseMatrix& base, const int col_offset, const int col_num);
+  void clear();
+  int load(FILE* is, const int type=FP32, const int row_alignment=0);
+  int save(FILE* os) const;
+
+
+ private:
+  void map();
+  void unmap();
+  void initial_row(const int row, real_t* v) const;
+  void reinitialize(const int first_row);
+
+  real_t            val_;        // initial value unless random
+  real_t            min_;        // range of the random initial values
+  real_t            max_;
+  bool              random_;
+  int               seed_;
+  int               generation_; // incremented whenever rows are re-initialized, for fresh random numbers
+  std::vector<char> ready_;      // whether each chunk is materialized; read and written atomically
+  std::mutex        mutex_;      // serializes the initialization of chunks, not copied
+  char*             mapped_;
+  size_t            mapped_size_;
+};
+
+
+inline SparseMatrix::SparseMatrix() : DenseMatrix() {
+
+  val_        = 0.0;
+  min_        = 0.0;
+  max_        = 0.0;
+  random_     = false;
+  seed_       = 0;
+  generation_ = 0;
+  mapped_     = NULL;
+  ready_.assign(1, 1); // the 1x1 matrix of DenseMatrix()
+}
+
+
+inline SparseMatrix::SparseMatrix(const int row_num, const int col_num, const real_t val, const int type, const int row_alignment) : DenseMatrix() {
+
+#ifdef __YSKIP_DEBUG__
+  assert(0 < row_num);
+  assert(0 < col_num);
+#endif
+
+  release();
+  row_num_       = row_num;
+  col_num_       = col_num;
+  type_          = type;
+  row_alignment_ = row_alignment;
+  val_           = val;
+  min_           = 0.0;
+  max_           = 0.0;
+  random_        = false;
+  seed_          = 0;
+  generation_    = 0;
+  map();
+}
+
+
+inline SparseMatrix::SparseMatrix(const SparseMatrix& other) : DenseMatrix() {
+
+  mapped_ = NULL;
+  *this = other;
+}
+
+
+inline SparseMatrix::~SparseMatrix() {
+
+  unmap();
+}
+
+
+inline SparseMatrix& SparseMatrix::operator=(const SparseMatrix& other) {
+
+  if (this == &other) {
+    return *this;
+  }
+  release();
+  unmap();
+  row_num_       = other.row_num();
+  col_num_       = other.col_num();
+  type_          = other.type();
+  row_alignment_ = other.row_alignment();
+  val_           = other.val_;
+  min_           = other.min_;
+  max_           = other.max_;
+  random_        = other.random_;
+  seed_          = other.seed_;
+  generation_    = other.generation_;
+  map();
+  for (size_t c = 0; c < ready_.size(); ++c) {
+    if (other.ready_[c]) {
+      const int last = std::min<int>((c + 1)*CHUNK_ROWS, row_num_);
+      for (int i = c*CHUNK_ROWS; i < last; ++i) {
+	memcpy(row_data(i), other.row_data(i), storage_size(type_)*col_num_);
+      }
+      ready_[c] = 1;
+    }
+  }
+  return *this;
+}
+
+
+// reserves the rows; pages are only backed by memory once they are written.
+// Large matrices start at a huge page boundary as in DenseMatrix::allocate().
+inline void SparseMatrix::map() {
+
+  set_stride();
+  owner_ = false;
+  const size_t size = storage_size(type_)*row_num_*static_cast<size_t>(stride_);
+  const size_t alignment = HUGE_PAGE_SIZE <= size ? HUGE_PAGE_SIZE : 0;
+  mapped_size_ = size + alignment;
+  void* p = mmap(NULL, mapped_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (p == MAP_FAILED) {
+    std::fprintf(stderr, HERE "failed to reserve %zu bytes\n", mapped_size_);
+    exit(FAILURE);
+  }
+  mapped_ = static_cast<char*>(p);
+  data_   = alignment == 0 ? mapped_ : reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(p) + alignment - 1)/alignment*alignment);
+  ready_.assign((row_num_ + CHUNK_ROWS - 1)/CHUNK_ROWS, 0);
+}
+
+
+inline void SparseMatrix::unmap() {
+
+  if (mapped_ != NULL) {
+    munmap(mapped_, mapped_size_);
+    mapped_ = NULL;
+  }
+}
+
+
+inline const real_t* SparseMatrix::operator[](const int row) const {
+
+#ifdef __YSKIP_DEBUG__
+  assert(materialized(row));
+#endif
+  return DenseMatrix::operator[](row);
+}
+
+
+inline real_t* SparseMatrix::operator[](const int row) {
+
+#ifdef __YSKIP_DEBUG__
+  assert(materialized(row));
+#endif
+  return DenseMatrix::operator[](row);
+}
+
+
+// rows not materialized yet will be set to val
+inline void SparseMatrix::set_initial_value(const real_t val) {
+
+  val_    = val;
+  random_ = false;
+}
+
+
+// rows not materialized yet will be drawn uniformly from [min, max)
+inline void SparseMatrix::set_random(const real_t min, const real_t max, const int seed) {
+
+  min_    = min;
+  max_    = max;
+  seed_   = seed;
+  random_ = true;
+}
+
+
+inline void SparseMatrix::initial_row(const int row, real_t* v) const {
+
+  if (random_) {
+    Random random(seed_, (static_cast<uint64_t>(generation_) << 32) | static_cast<uint32_t>(row));
+    random.fill(v, v + col_num_, min_, max_);
+  }else {
+    std::fill(v, v + col_num_, val_);
+  }
+}
+
+
+inline void SparseMatrix::materialize(const int row) {
+
+  const int c = row/CHUNK_ROWS;
+  if (__atomic_load_n(&ready_[c], __ATOMIC_ACQUIRE)) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (__atomic_load_n(&ready_[c], __ATOMIC_RELAXED)) {
+    return; // by another thread meanwhile
+  }
+  std::vector<real_t> v(col_num_);
+  const int last = std::min(row_num_, (c + 1)*CHUNK_ROWS);
+  for (int i = c*CHUNK_ROWS; i < last; ++i) {
+    initial_row(i, &v[0]);
+    DenseMatrix::set(i, &v[0]);
+  }
+  __atomic_store_n(&ready_[c], 1, __ATOMIC_RELEASE);
+}
+
+
+inline void SparseMatrix::materialize_all() {
+
+  for (int i = 0; i < row_num_; i += CHUNK_ROWS) {
+    materialize(i);
+  }
+}
+
+
+inline bool SparseMatrix::materialized(const int row) const {
+
+  return __atomic_load_n(&ready_[row/CHUNK_ROWS], __ATOMIC_ACQUIRE) != 0;
+}
+
+
+inline int SparseMatrix::materialized_row_num() const {
+
+  int n = 0;
+  for (size_t c = 0; c < ready_.size(); ++c) {
+    if (ready_[c]) {
+      n += std::min<int>(CHUNK_ROWS, row_num_ - c*CHUNK_ROWS);
+    }
+  }
+  return n;
+}
+
+
+// rows not materialized yet read as their initial values
+inline void SparseMatrix::get(const int row, real_t* v) const {
+
+  if (materialized(row)) {
+    DenseMatrix::get(row, v);
+  }else {
+    initial_row(row, v);
+  }
+}
+
+
+inline void SparseMatrix::set(const int row, const real_t* v) {
+
+  materialize(row);
+  DenseMatrix::set(row, v);
+}
+
+
+//
+// Gives the rows from first_row on fresh initial values: the whole chunks
+// give their memory back and are materialized again on demand, while the
+// rest of a partial chunk is overwritten. A view owns no memory, so all of
+// its rows are overwritten.
+//
+inline void SparseMatrix::reinitialize(const int first_row) {
+
+  ++generation_;
+  const int first_chunk = mapped_ == NULL ? ready_.size() : (first_row + CHUNK_ROWS - 1)/CHUNK_ROWS;
+  const int last = std::min(row_num_, first_chunk*CHUNK_ROWS);
+  std::vector<real_t> v(col_num_);
+  for (int i = first_row; i < last; ++i) {
+    if (materialized(i)) {
+      initial_row(i, &v[0]);
+      DenseMatrix::set(i, &v[0]);
+    }
+  }
+  if (first_chunk < static_cast<int>(ready_.size())) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    const size_t offset = (storage_size(type_)*stride_*static_cast<size_t>(first_chunk)*CHUNK_ROWS + page_size - 1)/page_size*page_size;
+    const size_t size   = storage_size(type_)*row_num_*static_cast<size_t>(stride_);
+    if (offset < size) {
+      madvise(data_ + offset, size - offset, MADV_DONTNEED);
+    }
+  }
+  for (size_t c = first_chunk; c < ready_.size(); ++c) {
+    ready_[c] = 0;
+  }
+}
+
+
+// the rows after the reserved ones go back to fresh initial values
+inline void SparseMatrix::reduce(const std::unordered_set<int>& reserved_rows) {
+
+  DenseMatrix::reduce(reserved_rows);
+  reinitialize(reserved_rows.size());
+}
+
+
+// see DenseMatrix::view(); the rows of base are taken as materialized
+inline void SparseMatrix::view(DenseMatrix& base, const int col_offset, const int col_num) {
+
+  unmap();
+  DenseMatrix::view(base, col_offset, col_num);
+  ready_.assign((row_num_ + CHUNK_ROWS - 1)/CHUNK_ROWS, 1);
+}
+
+
+// all rows go back to fresh initial values
+inline void SparseMatrix::clear() {
+
+  reinitialize(0);
+}
+
+
+// the rows of the file are materialized
+inline int SparseMatrix::load(FILE* is, const int type, const int row_alignment) {
+
+  int row_num, col_num;
+  if (fread(&row_num, sizeof(int), 1, is) != 1 || fread(&col_num, sizeof(int), 1, is) != 1) {
+    return FAILURE;
+  }
+  release();
+  unmap();
+  row_num_       = row_num;
+  col_num_       = col_num;
+  type_          = type;
+  row_alignment_ = row_alignment;
+  map();
+  for (int i = 0; i < row_num_; ++i) {
+    if (fread(row_data(i), storage_size(type_), static_cast<size_t>(col_num_), is) != static_cast<size_t>(col_num_)) {
+      return FAILURE;
+    }
+  }
+  ready_.assign(ready_.size(), 1);
+  return SUCCESS;
+}
+
+
+// same format as DenseMatrix::save(); rows not materialized are written with their initial values
+inline int SparseMatrix::save(FILE* os) const {
+
+  if (fwrite(&row_num_, sizeof(int), 1, os) != 1) {
+    return FAILURE;
+  }
+  if (fwrite(&col_num_, sizeof(int), 1, os) != 1) {
+    return FAILURE;
+  }
+  std::vector<real_t> v(col_num_);
+  std::vector<char> buffer(storage_size(type_)*col_num_);
+  for (int i = 0; i < row_num_; ++i) {
+    const char* row = row_data(i);
+    if (!materialized(i)) {
+      initial_row(i, &v[0]);
+      switch (type_) {
+      case FP16:
+	vec_kernels().fp32_to_fp16(&v[0], (uint16_t*)&buffer[0], col_num_);
+	break;
+      case BF16:
+	vec_kernels().fp32_to_bf16(&v[0], (uint16_t*)&buffer[0], col_num_);
+	break;
+      default:
+	memcpy(&buffer[0], &v[0], sizeof(real_t)*col_num_);
+      }
+      row = &buffer[0];
+    }
+    if (fwrite(row, storage_size(type_), static_cast<size_t>(col_num_), os) != static_cast<size_t>(col_num_)) {
+      return FAILURE;
+    }
+  }
+  return SUCCESS;
+}
+
+
+// compares through SparseMatrix::get() so that rows not materialized read as their initial values
+inline bool operator==(const SparseMatrix& m1, const SparseMatrix& m2) {
+
+  if (m1.col_num() != m2.col_num() || m1.row_num() != m2.row_num()) {
+    return false;
+  }
+  std::vector<real_t> v1(m1.col_num()), v2(m2.col_num());
+  for (int i = 0; i < m1.row_num(); ++i) {
+    m1.get(i, &v1[0]);
+    m2.get(i, &v2[0]);
+    for (int j = 0; j < m1.col_num(); ++j) {
+      if (approx_equal(v1[j], v2[j]) == false) {
+	return false;
+      }
+    }
+  }
+  return true;
+}
+
+
+}
@@ -0,0 +1,95 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#pragma once
+#include <vector>
+#include <atomic>
+#include <utility>
+#include "util.h"
+
+
+namespace yskip {
+
+
+//
+// Lock-free FIFO queue of at most `capacity` items between one producer and
+// one consumer thread. push() and pop() never block; they return false if
+// the queue is full or empty. Items are swapped in and out rather than
+// copied, so that e.g. the buffers of vectors are recycled between the two
+// threads instead of being reallocated.
+//
+template<class T>
+class SpscQueue {
+ public:
+  explicit SpscQueue(const size_t capacity);
+  ~SpscQueue() {};
+  bool push(T& item);
+  bool pop(T& item);
+  bool empty() const;
+  size_t capacity() const;
+
+ private:
+  std::vector<T>      slots_;
+  size_t              capacity_;
+  std::atomic<size_t> head_;     // next slot to pop, written by the consumer only
+  char                padding_[64];
+  std::atomic<size_t> tail_;     // next slot to push, written by the producer only
+  DISALLOW_COPY_AND_ASSIGN(SpscQueue);
+};
+
+
+template<class T>
+inline SpscQueue<T>::SpscQueue(const size_t capacity) : slots_(capacity + 1), head_(0), tail_(0) {
+
+#ifdef __YSKIP_DEBUG__
+  assert(0 < capacity);
+#endif
+  capacity_ = capacity;
+}
+
+
+// swaps item with an empty slot at the tail
+template<class T>
+inline bool SpscQueue<T>::push(T& item) {
+
+  const size_t tail = tail_.load(std::memory_order_relaxed);
+  const size_t next = tail == capacity_ ? 0 : tail + 1;
+  if (next == head_.load(std::memory_order_acquire)) {
+    return false;
+  }
+  std::swap(slots_[tail], item);
+  tail_.store(next, std::memory_order_release);
+  return true;
+}
+
+
+// swaps item with the head; item is left in the queue for a later push() to swap out
+template<class T>
+inline bool SpscQueue<T>::pop(T& item) {
+
+  const size_t head = head_.load(std::memory_order_relaxed);
+  if (head == tail_.load(std::memory_order_acquire)) {
+    return false;
+  }
+  std::swap(slots_[head], item);
+  head_.store(head == capacity_ ? 0 : head + 1, std::memory_order_release);
+  return true;
+}
+
+
+// may be stale as soon as it returns unless called by the consumer and the producer is done
+template<class T>
+inline bool SpscQueue<T>::empty() const {
+
+  return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+}
+
+
+template<class T>
+inline size_t SpscQueue<T>::capacity() const {
+
+  return capacity_;
+}
+
+
+}
@@ -0,0 +1,210 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#pragma once
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstring> // memchr
+#include <algorithm>
+#include <vector>
+#include <string>
+#include "util.h"
+
+
+namespace yskip {
+
+
+// lines of the corpus from one line to another, as one range per file (see TextCorpus::partition())
+typedef std::vector<Span> TextShard;
+
+
+//
+// Text files mapped into memory for batch learning, which workers read in
+// place and in parallel. The corpus is a list of files and directories, a
+// directory standing for the regular files in it in the order of their
+// names, e.g. a day's worth of log shards.
+//
+// partition() splits the corpus into n shards of about the same number of
+// bytes, each beginning at a line, so that each worker tokenizes and trains
+// on its own shard instead of receiving sentences from one reader.
+//
+class TextCorpus {
+ public:
+  TextCorpus();
+  ~TextCorpus();
+  int open(const std::vector<const char*>& paths);
+  void close();
+  const std::vector<Span>& files() const;
+  uint64_t size() const;
+  void partition(const int n, std::vector<TextShard>& shards) const;
+
+ private:
+  int map(const std::string& path);
+
+  std::vector<Span>     files_;  // mapped files, without empty ones
+  std::vector<uint64_t> starts_; // offset of each file in the corpus
+  uint64_t              size_;
+  DISALLOW_COPY_AND_ASSIGN(TextCorpus);
+};
+
+
+// the line beginning at s in [s, end), without its newline; returns the beginning of the next line
+inline const char* next_line(const char* s, const char* end, Span& line) {
+
+  const char* newline = static_cast<const char*>(memchr(s, '\n', end - s));
+  line.begin = s;
+  line.end   = newline == NULL ? end : newline;
+  return newline == NULL ? end : newline + 1;
+}
+
+
+inline TextCorpus::TextCorpus() {
+
+  size_ = 0;
+}
+
+
+inline TextCorpus::~TextCorpus() {
+
+  close();
+}
+
+
+inline int TextCorpus::open(const std::vector<const char*>& paths) {
+
+  close();
+  for (size_t i = 0; i < paths.size(); ++i) {
+    struct stat st;
+    if (stat(paths[i], &st) != 0) {
+      std::fprintf(stderr, HERE "cannot open %s\n", paths[i]);
+      return FAILURE;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+      if (map(paths[i]) == FAILURE) {
+	return FAILURE;
+      }
+      continue;
+    }
+
+    // regular files in the directory, except hidden ones
+    DIR* dir = opendir(paths[i]);
+    if (dir == NULL) {
+      std::fprintf(stderr, HERE "cannot open %s\n", paths[i]);
+      return FAILURE;
+    }
+    std::vector<std::string> files;
+    for (dirent* entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+      const std::string path = std::string(paths[i]) + "/" + entry->d_name;
+      if (entry->d_name[0] != '.' && stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+	files.push_back(path);
+      }
+    }
+    closedir(dir);
+    std::sort(files.begin(), files.end());
+    for (size_t j = 0; j < files.size(); ++j) {
+      if (map(files[j]) == FAILURE) {
+	return FAILURE;
+      }
+    }
+  }
+  return SUCCESS;
+}
+
+
+inline int TextCorpus::map(const std::string& path) {
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    std::fprintf(stderr, HERE "cannot open %s\n", path.c_str());
+    return FAILURE;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    std::fprintf(stderr, HERE "cannot open %s\n", path.c_str());
+    ::close(fd);
+    return FAILURE;
+  }
+  if (st.st_size == 0) {
+    ::close(fd);
+    return SUCCESS;
+  }
+  void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    std::fprintf(stderr, HERE "cannot map %s\n", path.c_str());
+    return FAILURE;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  const Span file = {static_cast<const char*>(map), static_cast<const char*>(map) + st.st_size};
+  files_.push_back(file);
+  starts_.push_back(size_);
+  size_ += st.st_size;
+  return SUCCESS;
+}
+
+
+inline void TextCorpus::close() {
+
+  for (size_t i = 0; i < files_.size(); ++i) {
+    munmap(const_cast<char*>(files_[i].begin), files_[i].size());
+  }
+  files_.clear();
+  starts_.clear();
+  size_ = 0;
+}
+
+
+// whole files in the order of the paths
+inline const std::vector<Span>& TextCorpus::files() const {
+
+  return files_;
+}
+
+
+// total bytes
+inline uint64_t TextCorpus::size() const {
+
+  return size_;
+}
+
+
+// shards[i] are the lines from about size()*i/n bytes to about size()*(i+1)/n bytes; some may be empty
+inline void TextCorpus::partition(const int n, std::vector<TextShard>& shards) const {
+
+  // offsets of the bounds in the corpus, each moved forward to the beginning of a line
+  std::vector<uint64_t> bounds(n + 1, size_);
+  bounds[0] = 0;
+  for (int i = 1; i < n; ++i) {
+    uint64_t bound = std::max(bounds[i-1], size_*i/n);
+    if (bound < size_) {
+      const size_t f = std::upper_bound(starts_.begin(), starts_.end(), bound) - starts_.begin() - 1;
+      const char* s = files_[f].begin + (bound - starts_[f]);
+      if (s != files_[f].begin && *(s - 1) != '\n') {
+	const char* newline = static_cast<const char*>(memchr(s, '\n', files_[f].end - s));
+	s = newline == NULL ? files_[f].end : newline + 1;
+      }
+      bound = starts_[f] + (s - files_[f].begin);
+    }
+    bounds[i] = bound;
+  }
+
+  //
+  shards.assign(n, TextShard());
+  for (int i = 0; i < n; ++i) {
+    for (size_t f = 0; f < files_.size(); ++f) {
+      const uint64_t first = std::max(bounds[i], starts_[f]);
+      const uint64_t last  = std::min(bounds[i+1], starts_[f] + files_[f].size());
+      if (first < last) {
+	const Span range = {files_[f].begin + (first - starts_[f]), files_[f].begin + (last - starts_[f])};
+	shards[i].push_back(range);
+      }
+    }
+  }
+}
+
+
+}
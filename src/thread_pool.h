@@ -0,0 +1,131 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#pragma once
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "util.h"
+
+
+namespace yskip {
+
+
+//
+// Fixed set of long-lived worker threads.
+// run() hands one task to every worker (each receives its own thread id)
+// and wait() blocks until all of them have finished it.
+//
+class ThreadPool {
+ public:
+  typedef std::function<void(const int)> Task;
+  explicit ThreadPool(const int thread_num);
+  ~ThreadPool();
+  int thread_num() const;
+  void run(const Task& task);
+  void wait();
+
+ private:
+  void loop(const int thread_id);
+
+  int                      thread_num_;
+  std::vector<std::thread> threads_;
+  std::mutex               mutex_;
+  std::condition_variable  start_cond_;
+  std::condition_variable  done_cond_;
+  Task                     task_;
+  uint64_t                 generation_;
+  int                      running_num_;
+  bool                     stop_;
+  DISALLOW_COPY_AND_ASSIGN(ThreadPool);
+};
+
+
+inline ThreadPool::ThreadPool(const int thread_num) {
+
+#ifdef __YSKIP_DEBUG__
+  assert(0 < thread_num);
+#endif
+
+  thread_num_  = thread_num;
+  generation_  = 0;
+  running_num_ = 0;
+  stop_        = false;
+  for (int i = 0; i < thread_num_; ++i) {
+    threads_.push_back(std::thread(&ThreadPool::loop, this, i));
+  }
+}
+
+
+inline ThreadPool::~ThreadPool() {
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cond_.wait(lock, [this]{ return running_num_ == 0; });
+    stop_ = true;
+  }
+  start_cond_.notify_all();
+  for (int i = 0; i < thread_num_; ++i) {
+    threads_[i].join();
+  }
+}
+
+
+inline int ThreadPool::thread_num() const {
+
+  return thread_num_;
+}
+
+
+inline void ThreadPool::run(const Task& task) {
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cond_.wait(lock, [this]{ return running_num_ == 0; }); // the previous task must be finished
+    task_        = task;
+    running_num_ = thread_num_;
+    ++generation_;
+  }
+  start_cond_.notify_all();
+}
+
+
+inline void ThreadPool::wait() {
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cond_.wait(lock, [this]{ return running_num_ == 0; });
+}
+
+
+inline void ThreadPool::loop(const int thread_id) {
+
+  uint64_t generation = 0;
+  while (1) {
+    Task task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      start_cond_.wait(lock, [this, generation]{ return stop_ || generation_ != generation; });
+      if (stop_) {
+	return;
+      }
+      generation = generation_;
+      task = task_;
+    }
+
+    task(thread_id);
+
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      --running_num_;
+      if (running_num_ == 0) {
+	done_cond_.notify_all();
+      }
+    }
+  }
+}
+
+
+}
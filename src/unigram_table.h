@@ -6,26 +6,39 @@
 #include <iostream>
 #include <vector>
 #include <numeric> // accumulate
+#include <limits>
 #include "util.h"
 #include "random.h"
 
 namespace yskip {
 
 
+//
+// Table of word indices in proportion to their weights, from which negative
+// samples are drawn uniformly. Its size is 64-bit so that a table can hold
+// more than 2^31 entries, e.g. for vocabularies of tens of millions of words.
+//
+// sample() may run on other threads while one thread calls update(), as in
+// incremental training: the size and the entries are stored and loaded with
+// relaxed atomics, so a sample may miss the latest update. build() and
+// renumber() must not run concurrently with sample().
+//
 class UnigramTable {
  public:
   UnigramTable();
-  explicit UnigramTable(const int max_size);
+  explicit UnigramTable(const int64_t max_size);
   ~UnigramTable() {};
-  int max_size() const;
+  int64_t max_size() const;
   int sample(Random& random) const;
-  void initialize(const int max_size);
+  void sample(Random& random, int* first, int* last) const;
+  void initialize(const int64_t max_size);
   void build(const std::vector<count_t>& counts, const real_t alpha, Random& random);
   void update(const int word, const real_t weight, Random& random);
+  void renumber(const std::vector<int>& new_index);
   
  private:
-  int              max_size_;
-  int              size_;
+  int64_t          max_size_;
+  int64_t          size_;
   real_t           weight_sum_;
   std::vector<int> table_;
   DISALLOW_COPY_AND_ASSIGN(UnigramTable);
@@ -40,7 +53,7 @@ inline UnigramTable::UnigramTable() {
 }
 
 
-inline UnigramTable::UnigramTable(const int max_size) {
+inline UnigramTable::UnigramTable(const int64_t max_size) {
 
   max_size_   = max_size;
   size_       = 0;
@@ -51,18 +64,37 @@ inline UnigramTable::UnigramTable(const int max_size) {
 
 inline int UnigramTable::sample(Random& random) const {
 
-  assert(0 < size_);
-  return table_[random.uniform(0, size_)];
+  const int64_t size = __atomic_load_n(&size_, __ATOMIC_RELAXED);
+  assert(0 < size);
+  return __atomic_load_n(&table_[random.uniform(static_cast<int64_t>(0), size)], __ATOMIC_RELAXED);
 }
 
 
-inline int UnigramTable::max_size() const {
+// draws last - first samples at once
+inline void UnigramTable::sample(Random& random, int* first, int* last) const {
+
+  const int64_t size = __atomic_load_n(&size_, __ATOMIC_RELAXED);
+  assert(0 < size);
+  if (size <= std::numeric_limits<int>::max()) {
+    random.fill(first, last, 0, static_cast<int>(size));
+    for (int* it = first; it != last; ++it) {
+      *it = __atomic_load_n(&table_[*it], __ATOMIC_RELAXED);
+    }
+  }else {
+    for (int* it = first; it != last; ++it) {
+      *it = __atomic_load_n(&table_[random.uniform(static_cast<int64_t>(0), size)], __ATOMIC_RELAXED);
+    }
+  }
+}
+
+
+inline int64_t UnigramTable::max_size() const {
 
   return max_size_;
 }
 
 
-inline void UnigramTable::initialize(const int max_size) {
+inline void UnigramTable::initialize(const int64_t max_size) {
 
   max_size_   = max_size;
   size_       = 0;
@@ -81,11 +113,11 @@ inline void UnigramTable::build(const std::vector<count_t>& counts, const real_t
   }
 
   //
-  std::vector<int> nums(vocab_size, 0);
+  std::vector<int64_t> nums(vocab_size, 0);
   for (int w = 0; w < vocab_size; ++w) {
     nums[w] = random.round(static_cast<double>(max_size_)*std::pow(static_cast<real_t>(counts[w]), alpha)/z);
   }
-  int sum = std::accumulate(nums.begin(), nums.end(), 0);
+  int64_t sum = std::accumulate(nums.begin(), nums.end(), static_cast<int64_t>(0));
   while (max_size_ < sum) {
     int w = random.uniform(0, vocab_size);
     if (0 < nums[w]) {
@@ -98,7 +130,7 @@ inline void UnigramTable::build(const std::vector<count_t>& counts, const real_t
   weight_sum_ = z;
   size_ = 0;
   for (int w = 0; w < vocab_size; ++w) {
-    for (int i = 0; i < nums[w]; ++i) {
+    for (int64_t i = 0; i < nums[w]; ++i) {
       table_[size_] = w;
       ++size_;
     }
@@ -114,18 +146,27 @@ inline void UnigramTable::update(const int word, const real_t weight, Random& ra
 
   weight_sum_ += weight;
   if (size_ < max_size_) {
-    int new_size = std::min<int>(random.round(weight) + size_, max_size_);
-    for (int i = size_; i < new_size; ++i) {
-      table_[i] = word;
+    int64_t new_size = std::min<int64_t>(random.round(weight) + size_, max_size_);
+    for (int64_t i = size_; i < new_size; ++i) {
+      __atomic_store_n(&table_[i], word, __ATOMIC_RELAXED);
     }
-    size_ = new_size;
+    __atomic_store_n(&size_, new_size, __ATOMIC_RELAXED);
   }else {
-    int n = random.round((weight/weight_sum_)*static_cast<real_t>(max_size_));
-    for (int i = 0; i < n; ++i) {
-      table_[random.uniform(0, max_size_)] = word;
+    int64_t n = random.round((weight/weight_sum_)*static_cast<real_t>(max_size_));
+    for (int64_t i = 0; i < n; ++i) {
+      __atomic_store_n(&table_[random.uniform(static_cast<int64_t>(0), max_size_)], word, __ATOMIC_RELAXED);
     }
   }
 }
 
 
+// word w becomes new_index[w], keeping the table as it is
+inline void UnigramTable::renumber(const std::vector<int>& new_index) {
+
+  for (int64_t i = 0; i < size_; ++i) {
+    table_[i] = new_index[table_[i]];
+  }
+}
+
+
 }
@@ -44,6 +44,59 @@ inline std::vector<std::string> tokenize(const char* s) {
 }
 
 
+// a token as [begin, end) of a buffer owned elsewhere, e.g. a line
+struct Span {
+  const char* begin;
+  const char* end;
+  const char* data() const { return begin; }
+  size_t size() const { return end - begin; }
+  std::string str() const { return std::string(begin, end); }
+};
+
+
+// same as tokenize(s), but appends the tokens to `tokens` as spans into s instead of allocating a string per token;
+// returns the end of s
+inline const char* tokenize(const char* s, std::vector<Span>& tokens) {
+
+  const char* begin = s;
+  while (1) {
+    if (*s == ' ' or *s == '\0') {
+      if (begin < s) { // ignore empty string
+	const Span token = {begin, s};
+	tokens.push_back(token);
+      }
+      if (*s == '\0') {
+	return s;
+      }
+      ++s;
+      begin = s;
+    }else {
+      ++s;
+    }
+  }
+}
+
+
+// the same for a line that is not null-terminated, e.g. of a mapped file
+inline void tokenize(const Span& line, std::vector<Span>& tokens) {
+
+  const char* begin = line.begin;
+  for (const char* s = line.begin; s != line.end; ++s) {
+    if (*s == ' ') {
+      if (begin < s) { // ignore empty string
+	const Span token = {begin, s};
+	tokens.push_back(token);
+      }
+      begin = s + 1;
+    }
+  }
+  if (begin < line.end) {
+    const Span token = {begin, line.end};
+    tokens.push_back(token);
+  }
+}
+
+
 
 inline bool mystrcmp(const char* begin, const char* end, const std::string &str) {
 
@@ -75,7 +128,71 @@ inline uint32_t fnv1a(const char* begin, const char* end) {
   }
   return hash_val;
 }
- 
+
+
+// 64x64-bit multiplication folded to 64 bits
+inline uint64_t mum(const uint64_t a, const uint64_t b) {
+
+#ifdef __SIZEOF_INT128__
+  const __uint128_t r = static_cast<__uint128_t>(a)*b;
+  return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+#else
+  const uint64_t r = a*b;
+  return r ^ (r >> 32) ^ ((a >> 32)*(b >> 32));
+#endif
+}
+
+
+inline uint64_t read32(const unsigned char* p) {
+
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+
+inline uint64_t read64(const unsigned char* p) {
+
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+
+// word-at-a-time hash after wyhash; a word of up to 16 bytes is read in at most four loads, without a loop.
+// The values depend on the byte order and must not be saved.
+inline uint64_t word_hash(const char* begin, const char* end) {
+
+  const uint64_t k0 = 0xa0761d6478bd642full;
+  const uint64_t k1 = 0xe7037ed1a0b428dbull;
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(begin);
+  const size_t len = end - begin;
+  uint64_t seed = mum(k0, k1);
+  uint64_t a, b;
+  if (len <= 16) {
+    if (4 <= len) {
+      const size_t mid = (len >> 3) << 2; // 0 or 4
+      a = (read32(p) << 32) | read32(p + mid);
+      b = (read32(p + len - 4) << 32) | read32(p + len - 4 - mid);
+    }else if (0 < len) {
+      a = (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[len >> 1]) << 8) | p[len - 1];
+      b = 0;
+    }else {
+      a = b = 0;
+    }
+  }else {
+    size_t i = len;
+    while (16 < i) {
+      seed = mum(read64(p) ^ k1, read64(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    a = read64(p + i - 16);
+    b = read64(p + i - 8);
+  }
+  return mum(mum(a ^ k1, b ^ seed) ^ k0 ^ len, k1);
+}
+
 
 // fast inverse square root
 inline float invsqrt(float x) {
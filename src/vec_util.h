@@ -12,49 +12,37 @@
 #include <algorithm>
 #include <stdexcept>
 #include "util.h"
+#include "simd.h"
 
 
 namespace yskip {
 
 
+//
+// The following functions dispatch to the SIMD kernels selected for this CPU (see simd.h)
+//
+
+inline real_t dot(const real_t* first1, const real_t* last1, const real_t* first2) {
+
+  return vec_kernels().dot(first1, first2, last1 - first1);
+}
+
+
 inline void mul_add(const real_t a, const real_t* first1, const real_t* last1, real_t* first2) {
 
-  const real_t* it1 = first1;
-  real_t* it2       = first2;
-  
-  while (it1 != last1) {
-    *it2 += a * (*it1);
-    ++it1;
-    ++it2;
-  }
+  vec_kernels().axpy(a, first1, first2, last1 - first1);
 }
 
 
 inline void mul_add(const real_t* first1, const real_t* last1, const real_t* first2, real_t* first3) {
 
-  const real_t* it1 = first1;
-  const real_t* it2 = first2;
-  real_t*       it3 = first3;
-  while (it1 != last1) {
-    *it3 += (*it1) * (*it2);
-    ++it1;
-    ++it2;
-    ++it3;
-  }
+  vec_kernels().mul_add(first1, first2, first3, last1 - first1);
 }
 
 
 inline void mul_add(const real_t a, const real_t* first1, const real_t* last1, const real_t* first2, real_t* first3) {
 
-  const real_t* it1 = first1;
-  const real_t* it2 = first2;
-  real_t*       it3 = first3;
-  while (it1 != last1) {
-    *it3 += a * (*it1) * (*it2);
-    ++it1;
-    ++it2;
-    ++it3;
-  }
+  vec_kernels().mul_add2(a, first1, first2, first3, last1 - first1);
 }
 
  
@@ -67,15 +55,68 @@ inline void mul_add(const real_t a, const real_t* first1, const real_t* last1, c
  */
 inline void adagrad(const real_t eta, const real_t* first1, const real_t* last1, const real_t* first2, real_t* first3) {
 
-  const real_t* it1 = first1;
-  const real_t* it2 = first2;
-  real_t*       it3 = first3;
-  while (it1 != last1) {
-    *it3 -= eta * invsqrt(*it2) * (*it1);
-    ++it1;
-    ++it2;
-    ++it3;
-  }
+  vec_kernels().adagrad(eta, first1, first2, first3, last1 - first1);
+}
+
+
+/*
+ *  Fused update of one output vector in a single pass; equivalent to
+ *    mul_add(g, first2, first2 + n, first4);
+ *    mul_add(g*g, first1, last1, first1, first3);
+ *    adagrad(eta*g, first1, last1, first3, first2);
+ *  eta: learning rate
+ *  g: gradient coefficient (sigma - label)
+ *  [first1, last1): input vector
+ *  first2, : output vector
+ *  first3, : squared-grad-sum of the output vector
+ *  first4, : buffer accumulating the gradient of the input vector
+ */
+inline void adagrad_output(const real_t eta, const double g, const real_t* first1, const real_t* last1, real_t* first2, real_t* first3, real_t* first4) {
+
+  vec_kernels().update_output(g, g*g, eta*g, first1, first2, first3, first4, last1 - first1);
+}
+
+
+/*
+ *  Fused update of the input vector in a single pass; equivalent to
+ *    mul_add(first1, last1, first1, first2);
+ *    adagrad(eta, first1, last1, first2, first3);
+ *  eta: learning rate
+ *  [first1, last1): grad
+ *  first2, : squared-grad-sum
+ *  first3, : parameter
+ */
+inline void adagrad_input(const real_t eta, const real_t* first1, const real_t* last1, real_t* first2, real_t* first3) {
+
+  vec_kernels().update_input(eta, first1, first2, first3, last1 - first1);
+}
+
+
+/*
+ *  Update of one output vector whose learning rate is the same for all
+ *  coordinates (plain SGD, row-wise AdaGrad); equivalent to
+ *    mul_add(g, first2, first2 + n, first3);
+ *    mul_add(-a, first1, last1, first2);
+ *  g: gradient coefficient (sigma - label)
+ *  a: g times the learning rate
+ *  [first1, last1): input vector
+ *  first2, : output vector
+ *  first3, : buffer accumulating the gradient of the input vector
+ */
+inline void sgd_output(const real_t g, const real_t a, const real_t* first1, const real_t* last1, real_t* first2, real_t* first3) {
+
+  vec_kernels().update_output_sgd(g, a, first1, first2, first3, last1 - first1);
+}
+
+
+/*
+ *  [first1, last1): x
+ *  first2, : m vectors of the same size as x
+ *  first3, : z[j] = dot(x, first2[j]) for j < m
+ */
+inline void dots(const real_t* first1, const real_t* last1, const real_t* const* first2, const int m, real_t* first3) {
+
+  vec_kernels().dots(first1, first2, m, first3, last1 - first1);
 }
 
 
@@ -14,113 +14,99 @@
 
 namespace yskip {
 
-    
+
+//
+// Open-addressing hash table from words to indices. Words are indexed by int,
+// but the table itself may have 2^32 slots or more (twice the vocabulary).
+// Files written with wide=false have the 32-bit table size of older models.
+//
+// The words are kept null-terminated in one arena, in which offsets_[i] is
+// the position of word i and lengths_[i] its length. A slot holds only the
+// hash of its word and its index, so that a lookup mostly reads one slot and
+// touches the arena once the hashes and the lengths match, and the words are
+// listed in the order of their indices without sorting. The arena only grows
+// until clear() or reduce().
+//
+// A slot is found from the 64-bit word_hash() modulo the table size and
+// keeps the upper half of the hash. encode_batch() looks up the words of a
+// sentence in two passes, hashing them and prefetching their slots first,
+// so that the cache misses of independent lookups overlap.
+//
 class Vocab {
  public:
-  struct Item {
-    std::string word;
-    int         index;
-    Item();
-  };
-  struct SortItem {
-    bool operator()(const Item &x, const Item &y) const {
-      return x.index < y.index;
-    }
+  struct Slot {
+    uint32_t hash;
+    int      index; // -1 if empty
   };
   Vocab();
-  Vocab(const int table_size);
-  Vocab(const Vocab &other);
+  Vocab(const uint64_t table_size);
   ~Vocab() {};
-  Vocab& operator=(const Vocab &other);
-  void initialize(const int table_size);
+  void initialize(const uint64_t table_size);
   void clear();
   void reduce(const std::unordered_set<int> &reduced_vocab);
+  void renumber(const std::vector<int>& new_index);
   int add(const std::string& word);
   int add(const char* word);
   int add(const char* begin, const char* end);
   int encode(const std::string& word) const;
   int encode(const char* word) const;
   int encode(const char* begin, const char* end) const;
+  void encode_batch(const std::vector<std::string>& words, std::vector<int>& indices) const;
+  void encode_batch(const Span* begin, const Span* end, std::vector<int>& indices) const;
+  const char* word(const int index) const;
   std::vector<std::string> all() const;
   uint32_t size() const;
-  uint32_t table_size() const;
-  const std::vector<Item>& table() const;
-  int save(FILE* os) const;
-  int load(FILE* os);
-  
- private:  
-  uint32_t                    size_;
-  uint32_t                    table_size_;
-  std::vector<Item>           table_;
-  std::vector<Item>::iterator table_begin_;
-  std::vector<Item>::iterator table_end_;
+  uint64_t table_size() const;
+  int save(FILE* os, const bool wide=true) const;
+  int load(FILE* is, const bool wide=true);
+
+ private:
+  uint32_t              size_;
+  uint64_t              table_size_;
+  std::vector<Slot>     table_;
+  std::vector<char>     arena_;
+  std::vector<uint64_t> offsets_;
+  std::vector<uint32_t> lengths_;
+  static const int ENCODE_BATCH_SIZE = 32; // lookups in flight in encode_batch()
+  template<class Word> void encode_batch(const Word* words, const size_t n, int* indices) const;
+  uint64_t position(const uint64_t hash) const;
+  int find(uint64_t pos, const uint32_t hash, const char* begin, const char* end) const;
+  bool match(const Slot& slot, const uint32_t hash, const char* begin, const char* end) const;
 };
 
 
-inline Vocab::Item::Item() {
-
-  word  = "";
-  index = -1;
-}
-
-
 inline Vocab::Vocab() {
 
-  size_        = 0;
-  table_size_  = 1e6;
-  table_       = std::vector<Item>(table_size_, Item());
-  table_begin_ = table_.begin();
-  table_end_   = table_.end();
-}
-
-
-inline Vocab::Vocab(const int table_size) {
-  
-  size_        = 0;
-  table_size_  = table_size;
-  table_       = std::vector<Item>(table_size_, Item());
-  table_begin_ = table_.begin();
-  table_end_   = table_.end();
+  initialize(1e6);
 }
 
 
-inline Vocab::Vocab(const Vocab &other) {
-
-  size_        = other.size();
-  table_size_  = other.table_size();
-  table_       = other.table();
-  table_begin_ = table_.begin();
-  table_end_   = table_.end();
-}
- 
+inline Vocab::Vocab(const uint64_t table_size) {
 
-inline Vocab& Vocab::operator=(const Vocab &other) {
-
-  if (this != &other) {
-    size_        = other.size();
-    table_size_  = other.table_size();
-    table_       = other.table();
-    table_begin_ = table_.begin();
-    table_end_   = table_.end();
-  }
-  return *this;
+  initialize(table_size);
 }
 
 
-inline void Vocab::initialize(const int table_size) {
+inline void Vocab::initialize(const uint64_t table_size) {
 
   table_size_ = table_size;
-  table_.resize(table_size_);
-  table_begin_ = table_.begin();
-  table_end_   = table_.end();
-  clear();
+  const Slot empty = {0, -1};
+  table_.assign(table_size_, empty);
+  size_ = 0;
+  arena_.clear();
+  offsets_.clear();
+  lengths_.clear();
 }
 
 
 inline void Vocab::clear() {
 
+  const Slot empty = {0, -1};
+  std::fill(table_.begin(), table_.end(), empty);
   size_ = 0;
-  std::fill(table_.begin(), table_.end(), Item());
+  arena_.clear();
+  offsets_.clear();
+  lengths_.clear();
 }
 
 
@@ -128,7 +114,7 @@ inline void Vocab::reduce(const std::unordered_set<int> &reduced_vocab) {
 
   //
   std::vector<std::string> words = all();
-  
+
   //
   clear();
   for (int i = 0; i < words.size(); ++i) {
@@ -139,9 +125,28 @@ inline void Vocab::reduce(const std::unordered_set<int> &reduced_vocab) {
 }
 
 
+// word i gets the index new_index[i]; the words stay where they are in the hash table and in the arena
+inline void Vocab::renumber(const std::vector<int>& new_index) {
+
+  for (size_t i = 0; i < table_.size(); ++i) {
+    if (table_[i].index != -1) {
+      table_[i].index = new_index[table_[i].index];
+    }
+  }
+  std::vector<uint64_t> offsets(offsets_.size());
+  std::vector<uint32_t> lengths(lengths_.size());
+  for (size_t i = 0; i < offsets_.size(); ++i) {
+    offsets[new_index[i]] = offsets_[i];
+    lengths[new_index[i]] = lengths_[i];
+  }
+  offsets_.swap(offsets);
+  lengths_.swap(lengths);
+}
+
+
 inline int Vocab::add(const std::string& word) {
 
-  return this->add(word.c_str());
+  return this->add(word.data(), word.data() + word.size());
 }
 
 
@@ -149,23 +154,29 @@ inline int Vocab::add(const char* word) {
 
   return add(word, word + strlen(word));
 }
- 
+
 
 inline int Vocab::add(const char* begin, const char* end) {
-  
-  std::vector<Item>::iterator it = table_begin_ + fnv1a(begin, end)%table_size_;
+
+  const uint64_t hash64 = word_hash(begin, end);
+  const uint32_t hash   = hash64 >> 32;
+  std::vector<Slot>::iterator it = table_.begin() + position(hash64);
   do {
-    if (mystrcmp(begin, end, it->word)) {
-      return it->index;
-    }else if (it->index == -1) {
-      it->word.assign(begin, end);
+    if (it->index == -1) {
+      it->hash  = hash;
       it->index = size_;
-      ++size_;
+      offsets_.push_back(arena_.size());
+      lengths_.push_back(end - begin);
+      arena_.insert(arena_.end(), begin, end);
+      arena_.push_back('\0');
+      __atomic_store_n(&size_, size_ + 1, __ATOMIC_RELAXED); // size() may be read by other threads meanwhile
+      return it->index;
+    }else if (match(*it, hash, begin, end)) {
       return it->index;
     }else {
       ++it;
-      if (table_end_ == it) {
-	it = table_begin_;
+      if (table_.end() == it) {
+	it = table_.begin();
       }
     }
   }while(1);
@@ -174,85 +185,145 @@ inline int Vocab::add(const char* begin, const char* end) {
 
 inline int Vocab::encode(const std::string& word) const {
 
-  return this->encode(word.c_str());
+  return this->encode(word.data(), word.data() + word.size());
 }
- 
+
 
 inline int Vocab::encode(const char* s) const {
 
   return this->encode(s, s + strlen(s));
 }
- 
+
 
 inline int Vocab::encode(const char* begin, const char* end) const {
 
-  std::vector<Item>::const_iterator it = table_begin_ + fnv1a(begin, end)%table_size_;
+  const uint64_t hash = word_hash(begin, end);
+  return find(position(hash), hash >> 32, begin, end);
+}
+
+
+// indices[i] is the index of words[i], or -1 if it is unknown
+inline void Vocab::encode_batch(const std::vector<std::string>& words, std::vector<int>& indices) const {
+
+  indices.resize(words.size());
+  encode_batch(words.data(), words.size(), indices.data());
+}
+
+
+inline void Vocab::encode_batch(const Span* begin, const Span* end, std::vector<int>& indices) const {
+
+  indices.resize(end - begin);
+  encode_batch(begin, end - begin, indices.data());
+}
+
+
+// Word is std::string or Span
+template<class Word>
+inline void Vocab::encode_batch(const Word* words, const size_t n, int* indices) const {
+
+  uint64_t positions[ENCODE_BATCH_SIZE];
+  uint32_t hashes[ENCODE_BATCH_SIZE];
+  for (size_t first = 0; first < n; first += ENCODE_BATCH_SIZE) {
+    const Word* batch = words + first;
+    const size_t m = std::min(n - first, static_cast<size_t>(ENCODE_BATCH_SIZE));
+    for (size_t i = 0; i < m; ++i) {
+      const uint64_t hash = word_hash(batch[i].data(), batch[i].data() + batch[i].size());
+      positions[i] = position(hash);
+      hashes[i]    = hash >> 32;
+      __builtin_prefetch(&table_[positions[i]]);
+    }
+    for (size_t i = 0; i < m; ++i) {
+      indices[first + i] = find(positions[i], hashes[i], batch[i].data(), batch[i].data() + batch[i].size());
+    }
+  }
+}
+
+
+inline uint64_t Vocab::position(const uint64_t hash) const {
+
+  return hash%table_size_;
+}
+
+
+// probes from the slot at pos for [begin, end) of the given hash; returns -1 if it is not found
+inline int Vocab::find(uint64_t pos, const uint32_t hash, const char* begin, const char* end) const {
+
   do {
-    if (mystrcmp(begin, end, it->word)) {
-      return it->index;
-    }else if (it->index == -1) {
+    const Slot& slot = table_[pos];
+    if (slot.index == -1) {
       return -1;
+    }else if (match(slot, hash, begin, end)) {
+      return slot.index;
     }else {
-      ++it;
-      if (table_end_ == it) {
-	it = table_begin_;
+      ++pos;
+      if (pos == table_size_) {
+	pos = 0;
       }
     }
   }while (1);
 }
 
 
-inline uint32_t Vocab::size() const {
+// whether the word in a non-empty slot is [begin, end), which may hold any bytes; the arena is only read if the hashes and the lengths are the same
+inline bool Vocab::match(const Slot& slot, const uint32_t hash, const char* begin, const char* end) const {
 
-  return size_;
+  if (slot.hash != hash) {
+    return false;
+  }
+  const size_t len = end - begin;
+  return lengths_[slot.index] == len && memcmp(&arena_[offsets_[slot.index]], begin, len) == 0;
 }
 
 
-inline uint32_t Vocab::table_size() const {
+// the null-terminated word of an index; valid until the next add(), clear() or reduce()
+inline const char* Vocab::word(const int index) const {
 
-  return table_size_;
+  return &arena_[offsets_[index]];
 }
- 
 
-inline const std::vector<Vocab::Item>& Vocab::table() const {
 
-  return table_;
+inline uint32_t Vocab::size() const {
+
+  return __atomic_load_n(&size_, __ATOMIC_RELAXED);
+}
+
+
+inline uint64_t Vocab::table_size() const {
+
+  return table_size_;
 }
 
 
 // return all words in the ascending order of the indices
 inline std::vector<std::string> Vocab::all() const {
 
-  //
-  std::vector<Item> tmp;
-  for (int i = 0; i < table_.size(); ++i) {
-    if (table_[i].index != -1) {
-      tmp.push_back(table_[i]);
-    }
-  }
-  std::sort(tmp.begin(), tmp.end(), SortItem());
-
-  //
-  std::vector<std::string> words;
-  for (int i = 0; i < tmp.size(); ++i) {
-    words.push_back(tmp[i].word);
+  std::vector<std::string> words(size_);
+  for (uint32_t i = 0; i < size_; ++i) {
+    words[i] = word(i);
   }
   return words;
 }
- 
 
-inline int Vocab::save(FILE* os) const {
+
+inline int Vocab::save(FILE* os, const bool wide) const {
 
   //
-  if (fwrite(&table_size_, sizeof(table_size_), 1, os) != 1) {
-    return FAILURE;
+  if (wide) {
+    if (fwrite(&table_size_, sizeof(table_size_), 1, os) != 1) {
+      return FAILURE;
+    }
+  }else {
+    const uint32_t table_size = table_size_;
+    if (fwrite(&table_size, sizeof(table_size), 1, os) != 1) {
+      return FAILURE;
+    }
   }
 
-  std::vector<std::string> words = all();
   std::string buff;
-  for (int i = 0; i < words.size(); ++i) {
-    buff.append(words[i]);
-    if (i != words.size() - 1) {
+  buff.reserve(arena_.size());
+  for (uint32_t i = 0; i < size_; ++i) {
+    buff.append(word(i));
+    if (i != size_ - 1) {
       buff.append(1, ' ');
     }
   }
@@ -260,20 +331,28 @@ inline int Vocab::save(FILE* os) const {
   if (fwrite(&buff_size, sizeof(buff_size), 1, os) != 1) {
     return FAILURE;
   }
-  if (fwrite(buff.data(), sizeof(char), buff_size, os) != buff_size) {
+  if (fwrite(buff.c_str(), sizeof(char), buff_size, os) != buff_size) {
     return FAILURE;
   }
-  
+
   return SUCCESS;
 }
 
 
-inline int Vocab::load(FILE* is) {
+inline int Vocab::load(FILE* is, const bool wide) {
 
   // create empty hash table
-  int table_size;
-  if (fread(&table_size, sizeof(table_size), 1, is) != 1) {
-    return FAILURE;
+  uint64_t table_size;
+  if (wide) {
+    if (fread(&table_size, sizeof(table_size), 1, is) != 1) {
+      return FAILURE;
+    }
+  }else {
+    uint32_t table_size32;
+    if (fread(&table_size32, sizeof(table_size32), 1, is) != 1) {
+      return FAILURE;
+    }
+    table_size = table_size32;
   }
   initialize(table_size);
 
@@ -282,30 +361,42 @@ inline int Vocab::load(FILE* is) {
   if (fread(&buff_size, sizeof(buff_size), 1, is) != 1) {
     return FAILURE;
   }
-  char* buff = new char[buff_size];
-  if (fread(buff, sizeof(char), buff_size, is) != buff_size) {
+  std::vector<char> buff(buff_size + 1, '\0');
+  if (fread(&buff[0], sizeof(char), buff_size, is) != buff_size) {
     return FAILURE;
   }
+  arena_.reserve(buff_size);
 
-  //
-  std::vector<std::string> tokens = tokenize(buff);
-  for (int i = 0; i < tokens.size(); ++i) {
-    add(tokens[i]);
+  // words are separated by spaces as in tokenize()
+  const char* s = &buff[0];
+  while (*s != '\0') {
+    while (*s == ' ') {
+      ++s;
+    }
+    const char* begin = s;
+    while (*s != ' ' && *s != '\0') {
+      ++s;
+    }
+    if (begin != s) {
+      add(begin, s);
+    }
   }
-  delete[] buff;
   return SUCCESS;
 }
 
 
-inline bool operator==(const Vocab::Item &item1, const Vocab::Item &item2) {
-
-  return (item1.word == item2.word && item1.index == item2.index);
-}
- 
-
+// the same words with the same indices in tables of the same size
 inline bool operator==(const Vocab &vocab1, const Vocab &vocab2) {
 
-  return (vocab1.size() == vocab2.size() && vocab1.table_size() == vocab2.table_size() && vocab1.table() == vocab2.table());
+  if (vocab1.size() != vocab2.size() || vocab1.table_size() != vocab2.table_size()) {
+    return false;
+  }
+  for (uint32_t i = 0; i < vocab1.size(); ++i) {
+    if (strcmp(vocab1.word(i), vocab2.word(i)) != 0) {
+      return false;
+    }
+  }
+  return true;
 }
 
 
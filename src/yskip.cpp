@@ -4,12 +4,20 @@
 #include <stdio.h>
 #include <getopt.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <cassert>
 #include <iostream>
 #include <vector>
 #include <string>
+#include <memory>
+#include <atomic>
 #include "util.h"
 #include "timer.h"
+#include "thread_pool.h"
+#include "bounded_queue.h"
+#include "corpus_cache.h"
+#include "line_reader.h"
+#include "text_corpus.h"
 #include "skipgram.h"
 
 
@@ -21,12 +29,17 @@ struct Configuration {
   int  iter_num;
   int  thread_num;
   int  mini_batch_size;
+  int  pipeline_depth;
+  int  max_lag;
   int  random_seed;
   bool binary_mode;
+  bool owner_computes;
   bool verbose;
   const char* train_file;
+  std::vector<const char*> train_files; // files and directories of batch learning, the first of which is train_file
   const char* model_file;
   const char* initial_model_file;
+  const char* corpus_cache_file;
   Configuration();
 };
 
@@ -36,25 +49,29 @@ Configuration::Configuration() {
   train_method       = 0;
   thread_num         = 10;
   mini_batch_size    = 10000;
+  pipeline_depth     = 0;
+  max_lag            = 1000;
   iter_num           = 5;
   random_seed        = time(NULL);
   binary_mode        = false;
+  owner_computes     = false;
   verbose            = true;
   train_file         = NULL;
   model_file         = NULL;
   initial_model_file = NULL;
+  corpus_cache_file  = NULL;
 }
 
 
 void print_help() {
 
-  std::cerr << "yskip [option] <train> <model>" << std::endl;
+  std::cerr << "yskip [option] <train>... <model>" << std::endl;
   std::cerr << std::endl;
   std::cerr << "Skip-gram model paramters:" << std::endl;
   std::cerr << " -t, --training-method=INT          Training method" << std::endl;
   std::cerr << "                                    0: incremental (default)" << std::endl;
   std::cerr << "                                    1: min-batch" << std::endl;
-  std::cerr << "                                    2: batch" << std::endl;
+  std::cerr << "                                    2: batch, in which <train> may be several files and directories, read in parallel by the threads" << std::endl;
   std::cerr << " -d, --dimensionality=INT           Dimensionality of word embeddings (default: 100)" << std::endl;
   std::cerr << " -w, --window-size=INT              Window size (default: 5)" << std::endl;
   std::cerr << " -n, --negative-sample=INT          Number of negative samples (default: 5)" << std::endl;
@@ -62,13 +79,43 @@ void print_help() {
   std::cerr << " -s, --subsampling-threshold=FLOAT  Subsampling threshold (default: 1.0e-5)" << std::endl;
   std::cerr << " -u, --unigram-table-size=INT       Unigram table size used for negative sampling (default: 1e8)" << std::endl;
   std::cerr << " -m, --max-vocabulary-size=INT      Maximum vocabulary size (default: 1e6)" << std::endl;
-  std::cerr << " -e, --eta=FLOAT                    Initial learning rate of AdaGrad (default: 0.1)" << std::endl;
+  std::cerr << " -e, --eta=FLOAT                    Initial learning rate (default: 0.1)" << std::endl;
+  std::cerr << " -O, --optimizer=INT                Optimizer" << std::endl;
+  std::cerr << "                                    0: AdaGrad (default)" << std::endl;
+  std::cerr << "                                    1: row-wise AdaGrad, one accumulator per word" << std::endl;
+  std::cerr << "                                    2: SGD, the learning rate decays linearly in batch learning" << std::endl;
+  std::cerr << " -v, --vector-storage=INT           Storage type of word embeddings" << std::endl;
+  std::cerr << "                                    0: 32-bit float (default)" << std::endl;
+  std::cerr << "                                    1: 16-bit float" << std::endl;
+  std::cerr << "                                    2: bfloat16" << std::endl;
+  std::cerr << " -V, --state-storage=INT            Storage type of the optimizer state (default: 0, see -v); 2 is recommended over 1" << std::endl;
+  std::cerr << " -M, --memory-layout=INT            How word vectors and their optimizer state are laid out in memory" << std::endl;
+  std::cerr << "                                    0: separately (default)" << std::endl;
+  std::cerr << "                                    1: interleaved, the vector and the state of a word in one block" << std::endl;
+  std::cerr << " -A, --row-alignment=INT            Pad each word vector to a multiple of INT bytes, e.g. 64 to keep threads off each other's cache lines (default: 0, packed)" << std::endl;
+  std::cerr << " -z, --lazy-init                    Initialize the vectors of a word when it enters the vocabulary, so that memory grows with the vocabulary rather than with -m (not with -M 1)" << std::endl;
+  std::cerr << " -F, --frequency-order              Renumber words in the descending order of frequency at vocabulary reductions and before saving, so that frequent words have adjacent rows" << std::endl;
+  std::cerr << " -K, --replica-rows=INT             Let each thread update private copies of the output vectors of the first INT words (the most frequent ones with -F), merged every -N updates and after each mini-batch (default: 0)" << std::endl;
+  std::cerr << " -N, --replica-sync-interval=INT    Updates between merges of the private copies of -K (default: 10000)" << std::endl;
+  std::cerr << " -o, --owner-computes               Partition the output vectors among the threads, each updating only its own and sending the updates of the others to their owners, instead of Hogwild (mini-batch and batch training)" << std::endl;
+  std::cerr << " -U, --numa=INT                     Pin the threads to the CPUs of the NUMA nodes in turn and place the parameters and the copies of -K on the nodes" << std::endl;
+  std::cerr << "                                    0: no (default)" << std::endl;
+  std::cerr << "                                    1: pages of every matrix spread over all nodes" << std::endl;
+  std::cerr << "                                    2: rows of every matrix split into one contiguous range per node" << std::endl;
+  std::cerr << "                                    Nothing changes on a machine with a single node" << std::endl;
+  std::cerr << " -H, --huge-page-rows=INT           Back the first INT rows (the most frequent words with -F) with transparent huge pages (default: 0)" << std::endl;
+  std::cerr << " -S, --sgd-mode=INT                 How the pairs of a window are updated" << std::endl;
+  std::cerr << "                                    0: one update per pair, each with its own negative samples (default)" << std::endl;
+  std::cerr << "                                    1: one update per window, whose contexts share the negative samples" << std::endl;
   std::cerr << " -b, --mini-batch-size=INT          Mini-batch size (default: 10000)" << std::endl;
   std::cerr << " -B, --binary-mode                  Read/write models in a binary format" << std::endl;
   std::cerr << " -i, --iteration-numbedr            Iteration number in batch learning (default: 5)" << std::endl;
+  std::cerr << " -C, --corpus-cache=FILE            Cache the encoded corpus in FILE and train on it instead of the text in batch learning" << std::endl;
   std::cerr << std::endl;
   std::cerr << "Misc.:" << std::endl;
   std::cerr << " -T, --thread-num=INT               Number of threads (default: 10)" << std::endl;
+  std::cerr << " -L, --max-lag=INT                  Maximum number of sentences the SGD workers may lag behind in incremental training, which they take in batches of up to 64 (default: 1000)" << std::endl;
+  std::cerr << " -P, --pipeline-depth=INT           Number of mini-batches read ahead while training (default: 0, no read-ahead)" << std::endl;
   std::cerr << " -I, --initial-model=FILE           Initial model (default: NULL)" << std::endl;
   std::cerr << " -r, --random-seed=INT              Random seed (default: current Unix time)" << std::endl;
   std::cerr << " -q, --quiet                        Do not show progress messages" << std::endl;
@@ -90,17 +137,33 @@ int parse_arg(int argc, char* argv[], Skipgram::Option &option, Configuration& c
     {"unigram-table-size",    required_argument, NULL, 'u'},
     {"max-vocabulary-size",   required_argument, NULL, 'm'},
     {"eta",                   required_argument, NULL, 'e'},
+    {"sgd-mode",              required_argument, NULL, 'S'},
+    {"optimizer",             required_argument, NULL, 'O'},
+    {"vector-storage",        required_argument, NULL, 'v'},
+    {"state-storage",         required_argument, NULL, 'V'},
+    {"memory-layout",         required_argument, NULL, 'M'},
+    {"row-alignment",         required_argument, NULL, 'A'},
+    {"lazy-init",             no_argument,       NULL, 'z'},
+    {"frequency-order",       no_argument,       NULL, 'F'},
+    {"huge-page-rows",        required_argument, NULL, 'H'},
+    {"replica-rows",          required_argument, NULL, 'K'},
+    {"replica-sync-interval", required_argument, NULL, 'N'},
+    {"owner-computes",        no_argument,       NULL, 'o'},
+    {"numa",                  required_argument, NULL, 'U'},
     {"mini-batch-size",       required_argument, NULL, 'b'},
     {"binary-mode",           required_argument, NULL, 'B'},    
     {"iteration-number",      required_argument, NULL, 'i'},
+    {"corpus-cache",          required_argument, NULL, 'C'},
     {"initial-model",         required_argument, NULL, 'I'},
     {"thread-num",            required_argument, NULL, 'T'},
+    {"pipeline-depth",        required_argument, NULL, 'P'},
+    {"max-lag",               required_argument, NULL, 'L'},
     {"random-seed",           required_argument, NULL, 'r'},
     {"quiet",                 no_argument,       NULL, 'q'},
     {"help",                  no_argument,       NULL, 'h'},
     {0,                       0,                 0,    0  },
   };
-  while((opt=getopt_long(argc, argv, "d:w:e:u:m:b:Bl:i:n:a:s:t:r:I:hq", longopts, NULL)) != -1){
+  while((opt=getopt_long(argc, argv, "d:w:e:S:O:v:V:M:A:zFH:K:N:oU:u:m:b:Bl:i:C:n:a:s:t:T:P:L:r:I:hq", longopts, NULL)) != -1){
     switch(opt){
     case 't':
       config.train_method = strtol(optarg, &endptr, 10);
@@ -114,6 +177,55 @@ int parse_arg(int argc, char* argv[], Skipgram::Option &option, Configuration& c
       option.eta = atof(optarg);
       assert(0.0 < option.eta);
       break;
+    case 'S':
+      option.sgd_mode = strtol(optarg, &endptr, 10);
+      assert(option.sgd_mode == Skipgram::PAIR_SGD || option.sgd_mode == Skipgram::WINDOW_SGD);
+      break;
+    case 'O':
+      option.optimizer = strtol(optarg, &endptr, 10);
+      assert(option.optimizer == ADAGRAD || option.optimizer == ROW_ADAGRAD || option.optimizer == SGD);
+      break;
+    case 'v':
+      option.vector_storage = strtol(optarg, &endptr, 10);
+      assert(option.vector_storage == FP32 || option.vector_storage == FP16 || option.vector_storage == BF16);
+      break;
+    case 'V':
+      option.state_storage = strtol(optarg, &endptr, 10);
+      assert(option.state_storage == FP32 || option.state_storage == FP16 || option.state_storage == BF16);
+      break;
+    case 'M':
+      option.layout = strtol(optarg, &endptr, 10);
+      assert(option.layout == Skipgram::SEPARATE || option.layout == Skipgram::INTERLEAVED);
+      break;
+    case 'z':
+      option.lazy_init = true;
+      break;
+    case 'F':
+      option.frequency_order = true;
+      break;
+    case 'H':
+      option.huge_page_rows = strtol(optarg, &endptr, 10);
+      assert(0 <= option.huge_page_rows);
+      break;
+    case 'K':
+      option.replica_rows = strtol(optarg, &endptr, 10);
+      assert(0 <= option.replica_rows);
+      break;
+    case 'N':
+      option.replica_sync_interval = strtol(optarg, &endptr, 10);
+      assert(0 < option.replica_sync_interval);
+      break;
+    case 'o':
+      config.owner_computes = true;
+      break;
+    case 'U':
+      option.numa_mode = strtol(optarg, &endptr, 10);
+      assert(option.numa_mode == NUMA_OFF || option.numa_mode == NUMA_INTERLEAVE || option.numa_mode == NUMA_PARTITION);
+      break;
+    case 'A':
+      option.row_alignment = strtol(optarg, &endptr, 10);
+      assert(option.row_alignment == 0 || option.row_alignment == 16 || option.row_alignment == 32 || option.row_alignment == 64 || option.row_alignment == 128);
+      break;
     case 'w':
       option.window_size = strtol(optarg, &endptr, 10);
       assert(0 < option.window_size);
@@ -123,7 +235,7 @@ int parse_arg(int argc, char* argv[], Skipgram::Option &option, Configuration& c
       assert(0 < option.neg_sample_num);
       break;
     case 'u':
-      option.unigram_table_size = strtol(optarg, &endptr, 10);
+      option.unigram_table_size = strtoll(optarg, &endptr, 10);
       assert(100 <= option.unigram_table_size);
       break;
     case 'm':
@@ -140,6 +252,9 @@ int parse_arg(int argc, char* argv[], Skipgram::Option &option, Configuration& c
     case 'i':
       config.iter_num = strtol(optarg, &endptr, 10);
       break;
+    case 'C':
+      config.corpus_cache_file = optarg;
+      break;
     case 'a':
       option.alpha = atof(optarg);
       assert(0.0 < option.alpha);
@@ -153,6 +268,14 @@ int parse_arg(int argc, char* argv[], Skipgram::Option &option, Configuration& c
       config.thread_num = strtol(optarg, &endptr, 10);
       assert(0 < config.thread_num);
       break;
+    case 'P':
+      config.pipeline_depth = strtol(optarg, &endptr, 10);
+      assert(0 <= config.pipeline_depth);
+      break;
+    case 'L':
+      config.max_lag = strtol(optarg, &endptr, 10);
+      assert(0 < config.max_lag);
+      break;
     case 'r':
       config.random_seed = strtol(optarg, &endptr, 10);
       break;
@@ -167,12 +290,18 @@ int parse_arg(int argc, char* argv[], Skipgram::Option &option, Configuration& c
       return FAILURE;
     }
   }
-  if (optind + 2 != argc) {
+  if (option.lazy_init && option.layout == Skipgram::INTERLEAVED) {
+    // the interleaved blocks are allocated and initialized as a whole
+    std::fprintf(stderr, "-z/--lazy-init cannot be used with -M 1 (interleaved layout)\n");
+    return FAILURE;
+  }
+  if (argc < optind + 2 || (config.train_method != 2 && optind + 2 != argc)) {
     print_help();
     return FAILURE;
   }
+  config.train_files.assign(argv + optind, argv + argc - 1);
   config.train_file = argv[optind];
-  config.model_file = argv[optind+1];
+  config.model_file = argv[argc-1];
   return SUCCESS;
 }
 
@@ -190,6 +319,29 @@ inline void print_progress(const count_t sent_num) {
 }
 
 
+// sentences trained by the workers of batch training, added in chunks of PROGRESS_CHUNK so that progress is shown while they run
+struct SharedProgress {
+  std::atomic<count_t> sent_num;
+  bool                 verbose;
+  explicit SharedProgress(const bool verbose) : sent_num(0), verbose(verbose) {};
+  void add(const count_t n);
+  DISALLOW_COPY_AND_ASSIGN(SharedProgress);
+};
+const count_t PROGRESS_CHUNK = 1000;
+
+
+// prints the marks of print_progress() passed by the n sentences
+inline void SharedProgress::add(const count_t n) {
+
+  const count_t last = sent_num.fetch_add(n, std::memory_order_relaxed);
+  if (verbose) {
+    for (count_t i = (last/10000 + 1)*10000; i <= last + n; i += 10000) {
+      print_progress(i);
+    }
+  }
+}
+
+
 inline void print_speed(const timeval start_time, const uint64_t progress, const char* unit) {
 
   timeval current_time;
@@ -199,39 +351,356 @@ inline void print_speed(const timeval start_time, const uint64_t progress, const
 }
 
 
-inline void asyc_sgd2(Skipgram& skipgram, const int start, const int end, const std::vector<std::vector<std::string>>& mini_batch, Random& random) {
+//
+// Sentences of a mini-batch, both as tokens and as word indices. The lines
+// are kept null-terminated in one arena and their tokens are spans into it,
+// so that reading a mini-batch allocates a few buffers instead of a string
+// per token. Moving a mini-batch keeps the spans valid but copying would not,
+// so it can only be moved.
+//
+struct MiniBatch {
+  std::vector<char>             arena;
+  std::vector<Span>             tokens;
+  std::vector<size_t>           ends;         // the tokens of sentence i are [ends[i-1], ends[i])
+  std::vector<std::vector<int>> encoded_text;
+  MiniBatch() {};
+  MiniBatch(MiniBatch&&) = default;
+  MiniBatch& operator=(MiniBatch&&) = default;
+  size_t size() const { return ends.size(); }
+  const Span* begin(const size_t i) const { return tokens.data() + (i == 0 ? 0 : ends[i - 1]); }
+  const Span* end(const size_t i) const { return tokens.data() + ends[i]; }
+};
+
+
+// per-thread working memory and random number stream that survive across mini-batches
+struct Worker {
+  real_t*       grad;
+  TrainBuffer   buffer;
+  Random        random;
+  OutputReplica replica;
+  OutputRouter  router;
+  Worker(const size_t grad_size, const int seed, const int id);
+  ~Worker();
+  DISALLOW_COPY_AND_ASSIGN(Worker);
+};
+
+
+// stream 0 is left to the main thread
+Worker::Worker(const size_t grad_size, const int seed, const int id) : random(seed, id + 1) {
+
+  posix_memalign((void**)&grad, 128, sizeof(real_t)*grad_size);
+}
+
+
+Worker::~Worker() {
+
+  free(grad);
+}
+
+
+// the workers share an OutputPartition if `partitioned`, which requires that they run the same tasks (see asyc_sgd())
+inline void create_workers(Skipgram& skipgram, const Configuration& config, const ThreadPool& pool, std::vector<std::unique_ptr<Worker>>& workers, const bool partitioned=false) {
+
+  workers.clear();
+  NumaTopology numa;
+  std::shared_ptr<OutputPartition> partition;
+  if (partitioned && config.owner_computes) {
+    partition = std::make_shared<OutputPartition>(pool.thread_num());
+  }
+  for (int i = 0; i < pool.thread_num(); ++i) {
+    workers.push_back(std::unique_ptr<Worker>(new Worker(skipgram.grad_size(), config.random_seed, i)));
+    if (partition) {
+      workers.back()->router.initialize(partition, i, skipgram.vec_size());
+    }else {
+      skipgram.init_replica(workers.back()->replica);
+      if (skipgram.numa_mode() != NUMA_OFF) {
+	workers.back()->replica.bind(numa, numa.worker_node(i, pool.thread_num()));
+      }
+    }
+  }
+}
+
+
+// pins each worker to a CPU of its NUMA node; does nothing on a single node
+inline void pin_workers(ThreadPool& pool) {
+
+  NumaTopology numa;
+  pool.run([&](const int id) {
+      if (numa.pin_worker(id, pool.thread_num()) == FAILURE) {
+	std::fprintf(stderr, "failed to pin worker %d\n", id);
+      }
+    });
+  pool.wait();
+}
+
+
+// merges the replicas of the workers into the shared parameters; the workers must be idle
+inline void push_replicas(std::vector<std::unique_ptr<Worker>>& workers) {
+
+  for (size_t i = 0; i < workers.size(); ++i) {
+    workers[i]->replica.push();
+  }
+}
+
+
+inline void asyc_sgd2(Skipgram& skipgram, const int start, const int end, const MiniBatch& mini_batch, Worker& worker) {
 
-  real_t* grad;
-  posix_memalign((void**)&grad, 128, sizeof(real_t)*skipgram.vec_size());
   for (int i = start; i < end; ++i) {
-    skipgram.train(mini_batch[i], false, grad, random);
+    const std::vector<int>& text = mini_batch.encoded_text[i];
+    skipgram.train(text.data(), text.size(), worker.grad, worker.random, worker.buffer, &worker.replica, &worker.router);
   }
-  free(grad);
+  skipgram.finish_updates(worker.router);
 }
 
 
-inline void asyc_sgd(Skipgram& skipgram, const Configuration& config, const std::vector<std::vector<std::string>> mini_batch, Random& random) {
+// the mini-batch is split into contiguous ranges, one per worker; returns after all workers are done
+inline void asyc_sgd(Skipgram& skipgram, ThreadPool& pool, std::vector<std::unique_ptr<Worker>>& workers, const MiniBatch& mini_batch) {
 
-  int n = mini_batch.size();
-  std::vector<std::thread> threads; 
-  for (int i = 0; i < config.thread_num; ++i) {
-    threads.push_back(std::thread(&asyc_sgd2, std::ref(skipgram), i*n/config.thread_num, std::min<int>((i+1)*n/config.thread_num, n), std::ref(mini_batch), std::ref(random)));
+  const int n = mini_batch.encoded_text.size();
+  const int thread_num = pool.thread_num();
+  pool.run([&](const int id) {
+      asyc_sgd2(skipgram, id*n/thread_num, std::min<int>((id+1)*n/thread_num, n), mini_batch, *workers[id]);
+    });
+  pool.wait();
+  push_replicas(workers);
+}
+
+
+inline void encode_mini_batch(const Skipgram& skipgram, MiniBatch& mini_batch) {
+
+  mini_batch.encoded_text.resize(mini_batch.size());
+  for (size_t i = 0; i < mini_batch.size(); ++i) {
+    skipgram.encode(mini_batch.begin(i), mini_batch.end(i), mini_batch.encoded_text[i]);
   }
-  for (int i = 0; i < config.thread_num; ++i) {
-    threads[i].join();
+}
+
+
+// reads and tokenizes at most `size` lines; returns the number of sentences read
+inline size_t read_mini_batch(LineReader& reader, const size_t size, MiniBatch& mini_batch) {
+
+  Span line;
+  size_t line_num = 0;
+  mini_batch.arena.clear();
+  while (line_num < size && reader.next(line)) {
+    mini_batch.arena.insert(mini_batch.arena.end(), line.begin, line.end + 1); // with the null character
+    ++line_num;
+  }
+
+  // tokenize once the arena no longer moves
+  mini_batch.tokens.clear();
+  mini_batch.ends.clear();
+  const char* s = mini_batch.arena.data();
+  for (size_t i = 0; i < line_num; ++i) {
+    s = tokenize(s, mini_batch.tokens) + 1;
+    mini_batch.ends.push_back(mini_batch.tokens.size());
+  }
+  return mini_batch.size();
+}
+
+
+//
+// Supplies mini-batches read from `is`.
+// If `depth` is positive, a reader thread fills up to `depth` mini-batches
+// ahead so that reading and tokenizing overlap with SGD.
+//
+class MiniBatchReader {
+ public:
+  MiniBatchReader(FILE* is, const size_t mini_batch_size, const int depth);
+  ~MiniBatchReader();
+  bool next(MiniBatch& mini_batch);
+  bool pipelined() const;
+  double reader_stall_time() const;
+  double trainer_stall_time() const;
+
+ private:
+  void read();
+
+  LineReader                                reader_;
+  size_t                                    mini_batch_size_;
+  std::unique_ptr<BoundedQueue<MiniBatch>> queue_;
+  std::thread                               thread_;
+  DISALLOW_COPY_AND_ASSIGN(MiniBatchReader);
+};
+
+
+MiniBatchReader::MiniBatchReader(FILE* is, const size_t mini_batch_size, const int depth) : reader_(is) {
+
+  mini_batch_size_ = mini_batch_size;
+  if (0 < depth) {
+    queue_.reset(new BoundedQueue<MiniBatch>(depth));
+    thread_ = std::thread(&MiniBatchReader::read, this);
   }
 }
 
 
-inline int train_batch(Skipgram& skipgram, const Configuration& config, Random& random) {
+MiniBatchReader::~MiniBatchReader() {
+
+  if (pipelined()) {
+    queue_->close();
+    thread_.join();
+  }
+}
+
+
+// returns false after the last mini-batch
+bool MiniBatchReader::next(MiniBatch& mini_batch) {
+
+  if (pipelined()) {
+    return queue_->pop(mini_batch);
+  }
+  return read_mini_batch(reader_, mini_batch_size_, mini_batch) != 0;
+}
+
+
+void MiniBatchReader::read() {
+
+  MiniBatch mini_batch;
+  while (read_mini_batch(reader_, mini_batch_size_, mini_batch) != 0) {
+    if (queue_->push(std::move(mini_batch)) == false) {
+      return;
+    }
+    mini_batch = MiniBatch();
+  }
+  queue_->close();
+}
+
+
+bool MiniBatchReader::pipelined() const {
+
+  return queue_.get() != NULL;
+}
+
+
+// time the reader spent waiting for the trainer to consume a mini-batch
+double MiniBatchReader::reader_stall_time() const {
+
+  return pipelined() ? queue_->push_wait_time() : 0.0;
+}
+
+
+// time the trainer spent waiting for the reader to fill a mini-batch
+double MiniBatchReader::trainer_stall_time() const {
+
+  return pipelined() ? queue_->pop_wait_time() : 0.0;
+}
+
+
+inline void print_stall_time(const double reader_stall_time, const double trainer_stall_time) {
+
+  std::fprintf(stderr, "Pipeline stall: reader %.2f sec, trainer %.2f sec\n", reader_stall_time, trainer_stall_time);
+}
+
+
+inline void cached_sgd2(Skipgram& skipgram, const int* first, const int* last, Worker& worker, SharedProgress& progress) {
+
+  const int* begin = first;
+  count_t sent_num = 0;
+  for (const int* it = first; it != last; ++it) {
+    if (*it == CORPUS_CACHE_EOS) {
+      skipgram.train(begin, it - begin, worker.grad, worker.random, worker.buffer, &worker.replica, &worker.router);
+      begin = it + 1;
+      if (++sent_num == PROGRESS_CHUNK) {
+	progress.add(sent_num);
+	sent_num = 0;
+      }
+    }
+  }
+  progress.add(sent_num);
+  skipgram.finish_updates(worker.router);
+}
+
+
+// one pass over the cached corpus; each worker trains on its own range of the file
+inline void cached_sgd(Skipgram& skipgram, ThreadPool& pool, std::vector<std::unique_ptr<Worker>>& workers, const CorpusCache& cache, SharedProgress& progress) {
+
+  std::vector<const int*> bounds;
+  cache.partition(pool.thread_num(), bounds);
+  pool.run([&](const int id) {
+      cached_sgd2(skipgram, bounds[id], bounds[id+1], *workers[id], progress);
+    });
+  pool.wait();
+  push_replicas(workers);
+}
+
+
+// trains on the lines of a shard of the text corpus, which the worker reads and tokenizes itself
+inline void text_sgd2(Skipgram& skipgram, const TextShard& shard, Worker& worker, SharedProgress& progress) {
+
+  Span line;
+  std::vector<Span> tokens;
+  count_t sent_num = 0;
+  for (size_t i = 0; i < shard.size(); ++i) {
+    const char* s = shard[i].begin;
+    while (s != shard[i].end) {
+      s = next_line(s, shard[i].end, line);
+      tokens.clear();
+      tokenize(line, tokens);
+      skipgram.encode(tokens.data(), tokens.data() + tokens.size(), worker.buffer.encoded_text);
+      skipgram.train(worker.buffer.encoded_text.data(), worker.buffer.encoded_text.size(), worker.grad, worker.random, worker.buffer, &worker.replica, &worker.router);
+      if (++sent_num == PROGRESS_CHUNK) {
+	progress.add(sent_num);
+	sent_num = 0;
+      }
+    }
+  }
+  progress.add(sent_num);
+  skipgram.finish_updates(worker.router);
+}
+
+
+// one pass over the text corpus; each worker trains on its own shard
+inline void text_sgd(Skipgram& skipgram, ThreadPool& pool, std::vector<std::unique_ptr<Worker>>& workers, const std::vector<TextShard>& shards, SharedProgress& progress) {
+
+  pool.run([&](const int id) {
+      text_sgd2(skipgram, shards[id], *workers[id], progress);
+    });
+  pool.wait();
+  push_replicas(workers);
+}
+
+
+// writes the encoded corpus to the corpus cache file
+inline int write_corpus_cache(const Skipgram& skipgram, const TextCorpus& corpus, const char* filename) {
+
+  CorpusCacheWriter cache_writer;
+  if (cache_writer.open(filename) == FAILURE) {
+    return FAILURE;
+  }
+  Span line;
+  std::vector<Span> tokens;
+  std::vector<int> encoded_text;
+  for (size_t i = 0; i < corpus.files().size(); ++i) {
+    const Span& file = corpus.files()[i];
+    for (const char* s = file.begin; s != file.end; ) {
+      s = next_line(s, file.end, line);
+      tokens.clear();
+      tokenize(line, tokens);
+      skipgram.encode(tokens.data(), tokens.data() + tokens.size(), encoded_text);
+      if (cache_writer.write(encoded_text) == FAILURE) {
+	return FAILURE;
+      }
+    }
+  }
+  return cache_writer.close();
+}
+
+
+// reports that the corpus cache could not be written and removes the partial file, so that it is not taken for a cache
+inline int discard_corpus_cache(const char* filename) {
+
+  std::fprintf(stderr, "failed to write %s\n", filename);
+  unlink(filename);
+  return FAILURE;
+}
+
+
+inline int train_batch(Skipgram& skipgram, const Configuration& config, ThreadPool& pool, Random& random) {
 
   //
-  FILE* is = fopen(config.train_file, "r");
-  if (is == NULL) {
-    std::fprintf(stderr, "failed to open %s\n", config.train_file);
+  TextCorpus corpus;
+  if (corpus.open(config.train_files) == FAILURE) {
     return FAILURE;
   }
-  setvbuf(is, NULL, _IOFBF, BUFF_SIZE);
 
   //
   if (config.verbose) {
@@ -241,12 +710,53 @@ inline int train_batch(Skipgram& skipgram, const Configuration& config, Random&
   /*****************************************************
    *  construct unigram table
    *****************************************************/
-  char line[BUFF_SIZE];
-  while (fgets(line, BUFF_SIZE, is) != NULL) {
-    line[strlen(line)-1] = '\0';
-    skipgram.update_unigram_table(tokenize(line), random);
+  const bool use_cache = config.corpus_cache_file != NULL;
+  CorpusCacheWriter cache_writer;
+  if (use_cache && cache_writer.open(config.corpus_cache_file) == FAILURE) {
+    return FAILURE;
+  }
+  Span line;
+  std::vector<Span> tokens;
+  std::vector<int> encoded_text;
+  count_t line_num = 0;
+  for (size_t i = 0; i < corpus.files().size(); ++i) {
+    const Span& file = corpus.files()[i];
+    for (const char* s = file.begin; s != file.end; ++line_num) {
+      s = next_line(s, file.end, line);
+      tokens.clear();
+      tokenize(line, tokens);
+      const Span* begin = tokens.data();
+      const Span* end   = tokens.data() + tokens.size();
+
+      // reducing the vocabulary renumbers words; the cache is then written after this pass instead
+      if (cache_writer.is_open() && skipgram.max_vocab_size() <= skipgram.vocab().size() + tokens.size() && cache_writer.close() == FAILURE) {
+	return discard_corpus_cache(config.corpus_cache_file);
+      }
+      skipgram.update_unigram_table(begin, end, random);
+      if (cache_writer.is_open()) {
+	skipgram.encode(begin, end, encoded_text);
+	if (cache_writer.write(encoded_text) == FAILURE) {
+	  return discard_corpus_cache(config.corpus_cache_file);
+	}
+      }
+    }
   }
   skipgram.rebuild_unigram_table(random); // make sure that the unigram table is calculated without approximation
+  skipgram.set_decay_count(skipgram.total_count()*config.iter_num);
+  if (skipgram.frequency_order()) {
+    // renumbering makes the cache stale; it is then written again below
+    skipgram.sort_vocab();
+    if (cache_writer.is_open() && cache_writer.close() == FAILURE) {
+      return discard_corpus_cache(config.corpus_cache_file);
+    }
+  }
+  const bool cache_ready = cache_writer.is_open();
+  if (cache_ready && cache_writer.close() == FAILURE) {
+    return discard_corpus_cache(config.corpus_cache_file);
+  }
+  if (use_cache && !cache_ready && write_corpus_cache(skipgram, corpus, config.corpus_cache_file) == FAILURE) {
+    return discard_corpus_cache(config.corpus_cache_file);
+  }
   
   //
   if (config.verbose) {
@@ -259,25 +769,29 @@ inline int train_batch(Skipgram& skipgram, const Configuration& config, Random&
    *****************************************************/
   time_t start_time = time(NULL);
   count_t sent_num = 0;
-  std::vector<std::vector<std::string>> mini_batch;
+  std::vector<std::unique_ptr<Worker>> workers;
+  create_workers(skipgram, config, pool, workers, true);
+
+  // iterations over the text corpus, or over the cached corpus which is smaller
+  std::vector<TextShard> shards;
+  CorpusCache cache;
+  if (use_cache) {
+    corpus.close();
+    if (cache.open(config.corpus_cache_file) == FAILURE) {
+      return FAILURE;
+    }
+  }else {
+    corpus.partition(pool.thread_num(), shards);
+  }
+  SharedProgress progress(config.verbose);
   for (int iter = 0; iter < config.iter_num; ++iter) {
-    rewind(is);
-    while (fgets(line, BUFF_SIZE, is) != NULL) {
-      line[strlen(line)-1] = '\0';
-      
-      mini_batch.push_back(tokenize(line));
-      if (mini_batch.size() == config.mini_batch_size || feof(is) != 0) {	
-	asyc_sgd(skipgram, config, mini_batch, random);
-	mini_batch.clear();
-      }
-      
-      ++sent_num;
-      if (config.verbose) {
-	print_progress(sent_num);
-      }
+    if (use_cache) {
+      cached_sgd(skipgram, pool, workers, cache, progress);
+    }else {
+      text_sgd(skipgram, pool, workers, shards, progress);
     }
+    sent_num += line_num;
   }
-  fclose(is);
   
   //
   time_t elapsed_time = time(NULL) - start_time;;
@@ -289,7 +803,33 @@ inline int train_batch(Skipgram& skipgram, const Configuration& config, Random&
 }
 
 
-inline int train_incremental(Skipgram& skipgram, const Configuration& config, Random& random) {
+// consecutive sentences encoded into word indices, queued as one item so that the queue is locked once per batch
+struct EncodedBatch {
+  count_t             first_id; // position of the first sentence in the input
+  std::vector<int>    text;     // the sentences one after another
+  std::vector<size_t> ends;     // end of each sentence in text
+};
+const size_t ENCODED_BATCH_SIZE = 64; // sentences, or max_lag if smaller
+
+
+// each sentence is trained with its own random stream, so the result does not depend on which worker picks it up;
+// stream 0 is the main thread's and 1 to thread_num are the workers' (see Worker), so sentence i takes thread_num + 1 + i
+inline void incremental_sgd(Skipgram& skipgram, const Configuration& config, BoundedQueue<EncodedBatch>& queue, Worker& worker) {
+
+  EncodedBatch batch;
+  while (queue.pop(batch)) {
+    size_t begin = 0;
+    for (size_t i = 0; i < batch.ends.size(); ++i) {
+      worker.random.seed(config.random_seed, config.thread_num + 1 + batch.first_id + i);
+      skipgram.train(batch.text.data() + begin, batch.ends[i] - begin, worker.grad, worker.random, worker.buffer, &worker.replica);
+      begin = batch.ends[i];
+    }
+    queue.task_done();
+  }
+}
+
+
+inline int train_incremental(Skipgram& skipgram, const Configuration& config, ThreadPool& pool, Random& random) {
 
   //
   FILE* is = stdin;
@@ -309,32 +849,104 @@ inline int train_incremental(Skipgram& skipgram, const Configuration& config, Ra
   
   //
   time_t start_time = time(NULL);
-  real_t* grad;
-  posix_memalign((void**)&grad, 128, sizeof(real_t)*skipgram.vec_size());
   count_t sent_num = 0;
-  char line[BUFF_SIZE];
-  while (fgets(line, BUFF_SIZE, is) != NULL) {
-    line[strlen(line)-1] = '\0';
-    skipgram.train(tokenize(line), true, grad, random);
-    ++sent_num;
-    if (config.verbose) {
-      print_progress(sent_num);
+  double sequencer_stall_time = 0.0;
+  double worker_stall_time    = 0.0;
+  LineReader reader(is);
+  Span line;
+  if (pool.thread_num() == 1) {
+    real_t* grad;
+    posix_memalign((void**)&grad, 128, sizeof(real_t)*skipgram.grad_size());
+    TrainBuffer buffer;
+    std::vector<Span> tokens;
+    while (reader.next(line)) {
+      tokens.clear();
+      tokenize(line.begin, tokens);
+      skipgram.train(tokens.data(), tokens.data() + tokens.size(), true, grad, random, buffer);
+      ++sent_num;
+      if (config.verbose) {
+	print_progress(sent_num);
+      }
     }
+    free(grad);
+  }else {
+    // the main thread updates the vocabulary and the unigram table in the input order,
+    // while the workers run SGD on batches of the encoded sentences at most `max_lag` sentences behind
+    // and read the counts and the unigram table as the main thread updates them (see Skipgram::update_unigram_table());
+    // a batch is begun only when fewer than max_batch_num batches are queued or being trained,
+    // so that these and the batch being built hold at most max_batch_num*batch_size <= max_lag sentences
+    std::vector<std::unique_ptr<Worker>> workers;
+    create_workers(skipgram, config, pool, workers);
+    const size_t batch_size    = std::min<size_t>(ENCODED_BATCH_SIZE, config.max_lag);
+    const size_t max_batch_num = config.max_lag/batch_size;
+    BoundedQueue<EncodedBatch> queue(max_batch_num);
+    pool.run([&](const int id) {
+	incremental_sgd(skipgram, config, queue, *workers[id]);
+      });
+    std::vector<Span> tokens;
+    std::vector<int> encoded_text;
+    EncodedBatch batch;
+    batch.first_id = sent_num;
+    while (reader.next(line)) {
+      tokens.clear();
+      tokenize(line.begin, tokens);
+      const Span* begin = tokens.data();
+      const Span* end   = tokens.data() + tokens.size();
+      if (batch.ends.empty()) {
+	queue.wait_unfinished(max_batch_num);
+      }
+
+      // reducing the vocabulary renumbers words, so encoded sentences must be trained and the replicas merged before that
+      if (skipgram.max_vocab_size() <= skipgram.vocab().size() + tokens.size()) {
+	if (!batch.ends.empty()) {
+	  queue.push(std::move(batch));
+	  batch = EncodedBatch();
+	  batch.first_id = sent_num;
+	}
+	queue.join();
+	push_replicas(workers);
+      }
+      skipgram.update_unigram_table(begin, end, random);
+
+      //
+      skipgram.encode(begin, end, encoded_text);
+      batch.text.insert(batch.text.end(), encoded_text.begin(), encoded_text.end());
+      batch.ends.push_back(batch.text.size());
+      ++sent_num;
+      if (batch.ends.size() == batch_size) {
+	queue.push(std::move(batch));
+	batch = EncodedBatch();
+	batch.first_id = sent_num;
+      }
+      if (config.verbose) {
+	print_progress(sent_num);
+      }
+    }
+    if (!batch.ends.empty()) {
+      queue.push(std::move(batch));
+    }
+    queue.close();
+    pool.wait();
+    push_replicas(workers);
+    sequencer_stall_time = queue.push_wait_time();
+    worker_stall_time    = queue.pop_wait_time();
   }
   fclose(is);
-  free(grad);
 
   //
   time_t elapsed_time = time(NULL) - start_time;;
   if (config.verbose) {
     std::fprintf(stderr, " done (%lf=%ld/%ld sent/sec)\n", static_cast<double>(sent_num)/static_cast<double>(elapsed_time), sent_num, elapsed_time);
+    if (1 < pool.thread_num()) {
+      std::fprintf(stderr, "Pipeline stall: sequencer %.2f sec, workers %.2f sec\n", sequencer_stall_time, worker_stall_time);
+    }
   }
   
   return SUCCESS;
 }
 
 
-inline int train_mini_batch(Skipgram& skipgram, const Configuration& config, Random& random) {
+inline int train_mini_batch(Skipgram& skipgram, const Configuration& config, ThreadPool& pool, Random& random) {
   
   //
   FILE* is = stdin;
@@ -352,32 +964,34 @@ inline int train_mini_batch(Skipgram& skipgram, const Configuration& config, Ran
   }
   
   //
-  char line[BUFF_SIZE];
   count_t sent_num = 0;
-  std::vector<std::vector<std::string>> mini_batch;  
-  while (fgets(line, BUFF_SIZE, is) != NULL) {
-    line[strlen(line)-1] = '\0';
-
-    //
-    mini_batch.push_back(tokenize(line));
-    skipgram.update_unigram_table(mini_batch.back(), random);
-    
-    //
-    if (mini_batch.size() == config.mini_batch_size || feof(is) != 0) {	
-      asyc_sgd(skipgram, config, mini_batch, random);
-      mini_batch.clear();
+  std::vector<std::unique_ptr<Worker>> workers;
+  create_workers(skipgram, config, pool, workers, true);
+  MiniBatchReader reader(is, config.mini_batch_size, config.pipeline_depth);
+  MiniBatch mini_batch;
+  while (reader.next(mini_batch)) {
+    for (size_t i = 0; i < mini_batch.size(); ++i) {
+      skipgram.update_unigram_table(mini_batch.begin(i), mini_batch.end(i), random);
     }
-
-    //
-    ++sent_num;
-    if (config.verbose) {
-      print_progress(sent_num);
+    encode_mini_batch(skipgram, mini_batch);
+    asyc_sgd(skipgram, pool, workers, mini_batch);
+    for (size_t i = 0; i < mini_batch.size(); ++i) {
+      ++sent_num;
+      if (config.verbose) {
+	print_progress(sent_num);
+      }
     }
   }
   
   if (strcmp(config.train_file, "-") != 0) {
     fclose(is);
   }
+  if (config.verbose) {
+    std::fprintf(stderr, " done\n");
+    if (reader.pipelined()) {
+      print_stall_time(reader.reader_stall_time(), reader.trainer_stall_time());
+    }
+  }
   
   return SUCCESS;
 }
@@ -407,6 +1021,9 @@ int main(int argc, char **argv) {
     if (skipgram.load(config.initial_model_file, config.binary_mode) == FAILURE) {
       return FAILURE;
     }
+    if (skipgram.frequency_order()) {
+      skipgram.sort_vocab();
+    }
   }
   if (config.verbose) {
     std::fprintf(stderr, " done\n");
@@ -415,16 +1032,20 @@ int main(int argc, char **argv) {
   /*
    * train model
    */
+  ThreadPool pool(config.thread_num);
+  if (skipgram.numa_mode() != NUMA_OFF) {
+    pin_workers(pool);
+  }
   if (config.train_method == 0) {
-    if (train_incremental(skipgram, config, random) == FAILURE) {
+    if (train_incremental(skipgram, config, pool, random) == FAILURE) {
       return FAILURE;
     }
   }else if (config.train_method == 1) {
-    if (train_mini_batch(skipgram, config, random) == FAILURE) {
+    if (train_mini_batch(skipgram, config, pool, random) == FAILURE) {
       return FAILURE;
     }
   }else {
-    if (train_batch(skipgram, config, random) == FAILURE) {
+    if (train_batch(skipgram, config, pool, random) == FAILURE) {
       return FAILURE;
     }
   }
@@ -432,6 +1053,9 @@ int main(int argc, char **argv) {
   /*
    * save model
    */
+  if (skipgram.frequency_order()) {
+    skipgram.sort_vocab();
+  }
   if (skipgram.save(config.model_file, config.binary_mode) == FAILURE) {
     return FAILURE;
   }
@@ -0,0 +1,85 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#include <stdlib.h>
+#include <vector>
+#include <thread>
+#include "../src/random.h"
+#include "../src/timer.h"
+#include "../src/skipgram.h"
+
+
+//
+// Multi-thread scaling of Hogwild updates with packed and padded rows.
+//
+// usage: bench_hogwild [vec_size] [max_thread_num] [update_num]
+//
+// Thread i only updates the words i, i + T, i + 2T, ... of a small hot set,
+// so no two threads ever write the same row and any slowdown over one thread
+// comes from rows sharing cache lines (false sharing). Padding the rows to
+// 64 bytes should remove it.
+//
+
+
+using namespace yskip;
+
+
+const int HOT_WORDS_PER_THREAD = 16;
+
+
+void work(Skipgram& skipgram, const int id, const int thread_num, const int update_num) {
+
+  Random random(id);
+  std::vector<real_t> grad(skipgram.grad_size());
+  std::vector<int> neg_samples(skipgram.neg_sample_num());
+  for (int n = 0; n < update_num; ++n) {
+    const int t = id + thread_num*random.uniform(0, HOT_WORDS_PER_THREAD);
+    const int c = id + thread_num*random.uniform(0, HOT_WORDS_PER_THREAD);
+    for (size_t k = 0; k < neg_samples.size(); ++k) {
+      neg_samples[k] = id + thread_num*random.uniform(0, HOT_WORDS_PER_THREAD);
+    }
+    skipgram.sgd(t, c, neg_samples, &grad[0]);
+  }
+}
+
+
+double run(const int row_alignment, const int vec_size, const int thread_num, const int update_num) {
+
+  Skipgram::Option option;
+  option.vec_size           = vec_size;
+  option.max_vocab_size     = HOT_WORDS_PER_THREAD*thread_num;
+  option.unigram_table_size = 100;
+  option.row_alignment      = row_alignment;
+  Random random(0);
+  Skipgram skipgram(option, random);
+  std::vector<std::thread> threads;
+  Timer timer;
+  for (int i = 0; i < thread_num; ++i) {
+    threads.push_back(std::thread(work, std::ref(skipgram), i, thread_num, update_num));
+  }
+  for (int i = 0; i < thread_num; ++i) {
+    threads[i].join();
+  }
+  timer.stop();
+  return timer.elapsed_time();
+}
+
+
+int main(int argc, char** argv) {
+
+  const int vec_size       = 1 < argc ? atoi(argv[1]) : 100;
+  const int max_thread_num = 2 < argc ? atoi(argv[2]) : std::max<int>(1, std::thread::hardware_concurrency());
+  const int update_num     = 3 < argc ? atoi(argv[3]) : 200000;
+
+  std::fprintf(stderr, "kernels: %s, hardware threads: %u\n", vec_kernels().name, std::thread::hardware_concurrency());
+  std::fprintf(stderr, "vec_size: %d, updates per thread: %d\n", vec_size, update_num);
+  std::fprintf(stderr, "%8s %20s %20s\n", "threads", "packed Mupdates/s", "padded Mupdates/s");
+  for (int thread_num = 1; thread_num <= max_thread_num; thread_num *= 2) {
+    const double packed = run(0, vec_size, thread_num, update_num);
+    const double padded = run(64, vec_size, thread_num, update_num);
+    const double updates = static_cast<double>(thread_num)*update_num*1.0e-6;
+    std::fprintf(stderr, "%8d %20.2f %20.2f\n", thread_num, updates/packed, updates/padded);
+  }
+
+  return 0;
+}
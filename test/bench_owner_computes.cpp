@@ -0,0 +1,134 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#include <stdlib.h>
+#include <cmath>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <string>
+#include <thread>
+#include "../src/random.h"
+#include "../src/timer.h"
+#include "../src/skipgram.h"
+
+
+//
+// Multi-thread scaling of Hogwild against owner-computes training, in which
+// only the owner of an output row writes it (see output_partition.h).
+//
+// usage: bench_owner_computes [vec_size] [sentence_num] [thread_num ...]
+//
+// The corpus is drawn from a Zipf distribution over VOCAB_SIZE words, whose
+// vocabulary is sorted by frequency as with -F. Each thread trains on its own
+// sentence_num sentences, so the work grows with the number of threads and
+// ideal scaling keeps the time constant. The default thread numbers are 8,
+// 16, 32 and 64; results beyond the number of hardware threads only show the
+// cost of oversubscription.
+//
+
+
+using namespace yskip;
+
+
+const int VOCAB_SIZE    = 100000;
+const int SENTENCE_SIZE = 20;
+
+
+// sentences of words drawn with probability proportional to 1/rank
+void create_corpus(const int sentence_num, Random& random, std::vector<std::vector<std::string>>& corpus) {
+
+  std::vector<double> cdf(VOCAB_SIZE);
+  double z = 0.0;
+  for (int i = 0; i < VOCAB_SIZE; ++i) {
+    z += 1.0/(i + 1);
+    cdf[i] = z;
+  }
+  corpus.resize(sentence_num);
+  for (int n = 0; n < sentence_num; ++n) {
+    corpus[n].clear();
+    for (int i = 0; i < SENTENCE_SIZE; ++i) {
+      const int w = std::lower_bound(cdf.begin(), cdf.end(), random.uniform(0.0, z)) - cdf.begin();
+      corpus[n].push_back("w" + std::to_string(std::min(w, VOCAB_SIZE - 1)));
+    }
+  }
+}
+
+
+double run(const bool owner_computes, const int vec_size, const int thread_num, const std::vector<std::vector<std::string>>& corpus) {
+
+  Skipgram::Option option;
+  option.vec_size           = vec_size;
+  option.max_vocab_size     = 2*VOCAB_SIZE;
+  option.unigram_table_size = 1e7;
+  Random random(0);
+  Skipgram skipgram(option, random);
+  for (size_t n = 0; n < corpus.size(); ++n) {
+    skipgram.update_unigram_table(corpus[n], random);
+  }
+  skipgram.rebuild_unigram_table(random);
+  skipgram.sort_vocab();
+  std::vector<std::vector<int>> encoded_corpus(corpus.size());
+  for (size_t n = 0; n < corpus.size(); ++n) {
+    skipgram.encode(corpus[n], encoded_corpus[n]);
+  }
+
+  //
+  std::shared_ptr<OutputPartition> partition = std::make_shared<OutputPartition>(thread_num);
+  std::vector<std::unique_ptr<OutputRouter>> routers;
+  for (int i = 0; i < thread_num; ++i) {
+    routers.push_back(std::unique_ptr<OutputRouter>(new OutputRouter()));
+    if (owner_computes) {
+      routers.back()->initialize(partition, i, vec_size);
+    }
+  }
+  std::vector<std::thread> threads;
+  Timer timer;
+  for (int i = 0; i < thread_num; ++i) {
+    threads.push_back(std::thread([&](const int id) {
+	  Random random(id);
+	  std::vector<real_t> grad(skipgram.grad_size());
+	  const size_t n = encoded_corpus.size();
+	  for (size_t j = id*n/thread_num; j < (id + 1)*n/thread_num; ++j) {
+	    skipgram.train(encoded_corpus[j].data(), encoded_corpus[j].size(), &grad[0], random, NULL, routers[id].get());
+	  }
+	  skipgram.finish_updates(*routers[id]);
+	}, i));
+  }
+  for (int i = 0; i < thread_num; ++i) {
+    threads[i].join();
+  }
+  timer.stop();
+  return timer.elapsed_time();
+}
+
+
+int main(int argc, char** argv) {
+
+  const int vec_size     = 1 < argc ? atoi(argv[1]) : 100;
+  const int sentence_num = 2 < argc ? atoi(argv[2]) : 2000;
+  std::vector<int> thread_nums;
+  for (int i = 3; i < argc; ++i) {
+    thread_nums.push_back(atoi(argv[i]));
+  }
+  if (thread_nums.empty()) {
+    const int defaults[] = {8, 16, 32, 64};
+    thread_nums.assign(defaults, defaults + 4);
+  }
+
+  std::fprintf(stderr, "kernels: %s, hardware threads: %u\n", vec_kernels().name, std::thread::hardware_concurrency());
+  std::fprintf(stderr, "vec_size: %d, sentences per thread: %d, words per sentence: %d\n", vec_size, sentence_num, SENTENCE_SIZE);
+  std::fprintf(stderr, "%8s %20s %20s\n", "threads", "Hogwild kwords/s", "owner kwords/s");
+  for (size_t i = 0; i < thread_nums.size(); ++i) {
+    const int thread_num = thread_nums[i];
+    Random random(thread_num);
+    std::vector<std::vector<std::string>> corpus;
+    create_corpus(thread_num*sentence_num, random, corpus);
+    const double hogwild = run(false, vec_size, thread_num, corpus);
+    const double owner   = run(true, vec_size, thread_num, corpus);
+    const double words   = static_cast<double>(corpus.size())*SENTENCE_SIZE*1.0e-3;
+    std::fprintf(stderr, "%8d %20.2f %20.2f\n", thread_num, words/hogwild, words/owner);
+  }
+
+  return 0;
+}
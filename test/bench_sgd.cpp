@@ -0,0 +1,138 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#include <stdlib.h>
+#include <vector>
+#include "../src/random.h"
+#include "../src/timer.h"
+#include "../src/fast_sigmoid.h"
+#include "../src/vec_util.h"
+
+
+//
+// Microbenchmark of one SGD update for a (target, context, negatives) tuple,
+// comparing the multi-pass update with the fused kernels.
+//
+// usage: bench_sgd [vec_size] [neg_sample_num] [vocab_size] [update_num]
+//
+// "L1 traffic" counts the floats loaded and stored by the kernels of one
+// update; "rows" counts the distinct bytes of the parameter rows touched,
+// which is the same for both versions.
+//
+
+
+using namespace yskip;
+
+
+struct Model {
+  int vec_size;
+  std::vector<real_t> input;
+  std::vector<real_t> output;
+  std::vector<real_t> squared_input;
+  std::vector<real_t> squared_output;
+  real_t* in(const int i) { return &input[static_cast<size_t>(i)*vec_size]; }
+  real_t* out(const int i) { return &output[static_cast<size_t>(i)*vec_size]; }
+  real_t* sq_in(const int i) { return &squared_input[static_cast<size_t>(i)*vec_size]; }
+  real_t* sq_out(const int i) { return &squared_output[static_cast<size_t>(i)*vec_size]; }
+};
+
+
+void initialize(const int vec_size, const int vocab_size, Model& model) {
+
+  Random random(0);
+  const size_t size = static_cast<size_t>(vocab_size)*vec_size;
+  model.vec_size = vec_size;
+  model.input.resize(size);
+  model.output.resize(size);
+  model.squared_input.assign(size, 1.0e-8);
+  model.squared_output.assign(size, 1.0e-8);
+  random.fill(&model.input[0], &model.input[0] + size, static_cast<real_t>(-0.5/vec_size), static_cast<real_t>(0.5/vec_size));
+  random.fill(&model.output[0], &model.output[0] + size, static_cast<real_t>(-0.5/vec_size), static_cast<real_t>(0.5/vec_size));
+}
+
+
+// the update as it was written before the fused kernels
+void multi_pass(const real_t eta, const int t, const int* c, const int neg_sample_num, real_t* grad, Model& m) {
+
+  const int d = m.vec_size;
+  real_t sigma = sigmoid(dot(m.in(t), m.in(t) + d, m.out(c[0])));
+  std::fill(grad, grad + d, 0.0);
+  mul_add(sigma - 1.0, m.out(c[0]), m.out(c[0]) + d, grad);
+  mul_add((sigma - 1.0)*(sigma - 1.0), m.in(t), m.in(t) + d, m.in(t), m.sq_out(c[0]));
+  adagrad(eta*(sigma - 1.0), m.in(t), m.in(t) + d, m.sq_out(c[0]), m.out(c[0]));
+  for (int k = 1; k <= neg_sample_num; ++k) {
+    real_t sigma = sigmoid(dot(m.in(t), m.in(t) + d, m.out(c[k])));
+    mul_add(sigma, m.out(c[k]), m.out(c[k]) + d, grad);
+    mul_add(sigma*sigma, m.in(t), m.in(t) + d, m.in(t), m.sq_out(c[k]));
+    adagrad(eta*sigma, m.in(t), m.in(t) + d, m.sq_out(c[k]), m.out(c[k]));
+  }
+  mul_add(grad, grad + d, grad, m.sq_in(t));
+  adagrad(eta, grad, grad + d, m.sq_in(t), m.in(t));
+}
+
+
+void fused(const real_t eta, const int t, const int* c, const int neg_sample_num, real_t* grad, Model& m) {
+
+  const int d = m.vec_size;
+  const real_t* input = m.in(t);
+  std::fill(grad, grad + d, 0.0);
+  real_t sigma = sigmoid(dot(input, input + d, m.out(c[0])));
+  adagrad_output(eta, sigma - 1.0, input, input + d, m.out(c[0]), m.sq_out(c[0]), grad);
+  for (int k = 1; k <= neg_sample_num; ++k) {
+    real_t sigma = sigmoid(dot(input, input + d, m.out(c[k])));
+    adagrad_output(eta, sigma, input, input + d, m.out(c[k]), m.sq_out(c[k]), grad);
+  }
+  adagrad_input(eta, grad, grad + d, m.sq_in(t), m.in(t));
+}
+
+
+template<class F>
+double run(F update, const std::vector<int>& tuples, const int neg_sample_num, Model& model) {
+
+  std::vector<real_t> grad(model.vec_size);
+  const int tuple_size = neg_sample_num + 2;
+  Timer timer;
+  for (size_t i = 0; i < tuples.size(); i += tuple_size) {
+    update(0.1, tuples[i], &tuples[i + 1], neg_sample_num, &grad[0], model);
+  }
+  timer.stop();
+  return timer.elapsed_time();
+}
+
+
+int main(int argc, char** argv) {
+
+  const int vec_size       = 1 < argc ? atoi(argv[1]) : 100;
+  const int neg_sample_num = 2 < argc ? atoi(argv[2]) : 5;
+  const int vocab_size     = 3 < argc ? atoi(argv[3]) : 100000;
+  const int update_num     = 4 < argc ? atoi(argv[4]) : 1000000;
+
+  // target, context and negatives of each update
+  Random random(1);
+  const int tuple_size = neg_sample_num + 2;
+  std::vector<int> tuples(static_cast<size_t>(update_num)*tuple_size);
+  random.fill(&tuples[0], &tuples[0] + tuples.size(), 0, vocab_size);
+
+  // floats loaded and stored per update
+  //   multi-pass: per output dot(2d) + axpy(3d) + mul_add2(4d) + adagrad(4d), fill(d), input mul_add(4d) + adagrad(4d)
+  //   fused:      per output dot(2d) + update_output(7d), fill(d), input update_input(5d)
+  const double d = vec_size;
+  const double k1 = neg_sample_num + 1;
+  const double multi_pass_bytes = sizeof(real_t)*(k1*13.0*d + 9.0*d);
+  const double fused_bytes      = sizeof(real_t)*(k1*9.0*d + 6.0*d);
+  const double row_bytes        = sizeof(real_t)*(2.0*(k1 + 1.0)*d + d);
+
+  std::fprintf(stderr, "kernels: %s\n", vec_kernels().name);
+  std::fprintf(stderr, "vec_size: %d, neg_sample_num: %d, vocab_size: %d, updates: %d\n", vec_size, neg_sample_num, vocab_size, update_num);
+  std::fprintf(stderr, "rows touched per update: %.0f bytes\n", row_bytes);
+  std::fprintf(stderr, "%-12s %12s %12s %16s\n", "", "ns/update", "L1 traffic", "L1 GB/s");
+  for (int i = 0; i < 2; ++i) {
+    Model model;
+    initialize(vec_size, vocab_size, model);
+    const double time  = i == 0 ? run(multi_pass, tuples, neg_sample_num, model) : run(fused, tuples, neg_sample_num, model);
+    const double bytes = i == 0 ? multi_pass_bytes : fused_bytes;
+    std::fprintf(stderr, "%-12s %12.1f %12.0f %16.2f\n", i == 0 ? "multi-pass" : "fused", time/update_num*1.0e9, bytes, bytes*update_num/time*1.0e-9);
+  }
+
+  return 0;
+}
@@ -0,0 +1,106 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#include <stdlib.h>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include "../src/random.h"
+#include "../src/timer.h"
+#include "../src/vocab.h"
+
+
+//
+// Microbenchmark of the vocabulary lookups of a Zipfian token stream,
+// comparing FNV-1a with word_hash() and encode() per token with
+// encode_batch() per sentence.
+//
+// usage: bench_vocab [vocab_size] [token_num]
+//
+// The table is twice the vocabulary as in yskip, so that with a large
+// vocabulary most lookups of rare words miss the cache.
+//
+
+
+using namespace yskip;
+
+
+const int SENTENCE_SIZE = 20;
+
+
+// sentences of words drawn with probability proportional to 1/rank
+void create_corpus(const int vocab_size, const int token_num, Random& random, std::vector<std::vector<std::string>>& corpus) {
+
+  std::vector<double> cdf(vocab_size);
+  double sum = 0.0;
+  for (int i = 0; i < vocab_size; ++i) {
+    sum += 1.0/(i + 1);
+    cdf[i] = sum;
+  }
+  corpus.assign((token_num + SENTENCE_SIZE - 1)/SENTENCE_SIZE, std::vector<std::string>());
+  for (int i = 0; i < token_num; ++i) {
+    const double u = random.uniform(0.0, sum);
+    const int rank = std::min(static_cast<int>(std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin()), vocab_size - 1);
+    corpus[i/SENTENCE_SIZE].push_back("word" + std::to_string(rank));
+  }
+}
+
+
+int main(int argc, char** argv) {
+
+  const int vocab_size = 1 < argc ? atoi(argv[1]) : 1000000;
+  const int token_num  = 2 < argc ? atoi(argv[2]) : 10000000;
+
+  Random random(0);
+  std::vector<std::vector<std::string>> corpus;
+  create_corpus(vocab_size, token_num, random, corpus);
+  Vocab vocab(2*static_cast<uint64_t>(vocab_size));
+  for (int i = 0; i < vocab_size; ++i) {
+    vocab.add("word" + std::to_string(i));
+  }
+
+  // hashing only
+  uint64_t check = 0;
+  Timer fnv1a_timer;
+  for (size_t i = 0; i < corpus.size(); ++i) {
+    for (size_t j = 0; j < corpus[i].size(); ++j) {
+      check += fnv1a(corpus[i][j].data(), corpus[i][j].data() + corpus[i][j].size());
+    }
+  }
+  fnv1a_timer.stop();
+  Timer word_hash_timer;
+  for (size_t i = 0; i < corpus.size(); ++i) {
+    for (size_t j = 0; j < corpus[i].size(); ++j) {
+      check += word_hash(corpus[i][j].data(), corpus[i][j].data() + corpus[i][j].size());
+    }
+  }
+  word_hash_timer.stop();
+
+  // lookups
+  Timer encode_timer;
+  for (size_t i = 0; i < corpus.size(); ++i) {
+    for (size_t j = 0; j < corpus[i].size(); ++j) {
+      check += vocab.encode(corpus[i][j]);
+    }
+  }
+  encode_timer.stop();
+  std::vector<int> indices;
+  Timer encode_batch_timer;
+  for (size_t i = 0; i < corpus.size(); ++i) {
+    vocab.encode_batch(corpus[i], indices);
+    for (size_t j = 0; j < indices.size(); ++j) {
+      check += indices[j];
+    }
+  }
+  encode_batch_timer.stop();
+
+  printf("vocab_size=%d token_num=%d (check %llu)\n", vocab_size, token_num, static_cast<unsigned long long>(check));
+  printf("%-14s %10s\n", "", "ns/token");
+  printf("%-14s %10.1f\n", "fnv1a",        1.0e9*fnv1a_timer.elapsed_time()/token_num);
+  printf("%-14s %10.1f\n", "word_hash",    1.0e9*word_hash_timer.elapsed_time()/token_num);
+  printf("%-14s %10.1f\n", "encode",       1.0e9*encode_timer.elapsed_time()/token_num);
+  printf("%-14s %10.1f\n", "encode_batch", 1.0e9*encode_batch_timer.elapsed_time()/token_num);
+
+  return SUCCESS;
+}
@@ -0,0 +1,117 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#include <cassert>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include "../src/bounded_queue.h"
+
+
+using namespace yskip;
+
+
+void test_fifo() {
+
+  BoundedQueue<int> queue(3);
+  assert(queue.capacity() == 3);
+  assert(queue.push(1));
+  assert(queue.push(2));
+  assert(queue.push(3));
+  queue.close();
+  assert(queue.push(4) == false);
+
+  //
+  int item;
+  assert(queue.pop(item) && item == 1);
+  assert(queue.pop(item) && item == 2);
+  assert(queue.pop(item) && item == 3);
+  assert(queue.pop(item) == false);
+}
+
+
+void test_producer_consumer() {
+
+  BoundedQueue<std::vector<int>> queue(2);
+  std::thread producer([&]() {
+      for (int i = 0; i < 1000; ++i) {
+	queue.push(std::vector<int>(3, i));
+      }
+      queue.close();
+    });
+
+  //
+  std::vector<int> item;
+  int n = 0;
+  while (queue.pop(item)) {
+    assert(item.size() == 3);
+    assert(item[0] == n);
+    ++n;
+  }
+  producer.join();
+  assert(n == 1000);
+  assert(0.0 <= queue.push_wait_time());
+  assert(0.0 <= queue.pop_wait_time());
+}
+
+
+void test_join() {
+
+  BoundedQueue<int> queue(4);
+  int sum = 0;
+  std::thread consumer([&]() {
+      int item;
+      while (queue.pop(item)) {
+	sum += item;
+	queue.task_done();
+      }
+    });
+
+  //
+  for (int i = 1; i <= 100; ++i) {
+    queue.push(int(i));
+    if (i%10 == 0) {
+      queue.join();
+      assert(sum == i*(i + 1)/2); // every pushed item has been processed
+    }
+  }
+  queue.close();
+  consumer.join();
+}
+
+
+// items popped but not done yet count as unfinished too
+void test_wait_unfinished() {
+
+  BoundedQueue<int> queue(4);
+  std::atomic<int> done_num(0);
+  std::thread consumer([&]() {
+      int item;
+      while (queue.pop(item)) {
+	std::this_thread::sleep_for(std::chrono::microseconds(100));
+	++done_num;
+	queue.task_done();
+      }
+    });
+
+  //
+  for (int i = 0; i < 100; ++i) {
+    queue.wait_unfinished(2);
+    assert(i - done_num < 2);
+    queue.push(int(i));
+  }
+  queue.close();
+  consumer.join();
+  assert(done_num == 100);
+}
+
+
+int main() {
+
+  test_fifo();
+  test_producer_consumer();
+  test_join();
+  test_wait_unfinished();
+
+  return SUCCESS;
+}
@@ -0,0 +1,67 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#include <cassert>
+#include "../src/corpus_cache.h"
+
+
+using namespace yskip;
+
+
+void test_write_read() {
+
+  CorpusCacheWriter writer;
+  assert(writer.open("tmp_cache") == SUCCESS);
+  std::vector<int> text;
+  for (int i = 0; i < 100; ++i) {
+    text.assign(i%7, i);
+    assert(writer.write(text) == SUCCESS);
+  }
+  assert(writer.sent_num() == 100);
+  assert(writer.close() == SUCCESS);
+
+  //
+  CorpusCache cache;
+  assert(cache.open("tmp_cache") == SUCCESS);
+  assert(cache.sent_num() == 100);
+  int sent_num = 0;
+  int len = 0;
+  for (const int* it = cache.begin(); it != cache.end(); ++it) {
+    if (*it == CORPUS_CACHE_EOS) {
+      assert(len == sent_num%7);
+      ++sent_num;
+      len = 0;
+    }else {
+      assert(*it == sent_num);
+      ++len;
+    }
+  }
+  assert(sent_num == 100);
+}
+
+
+void test_partition() {
+
+  CorpusCache cache;
+  assert(cache.open("tmp_cache") == SUCCESS);
+  for (int n = 1; n < 12; ++n) {
+    std::vector<const int*> bounds;
+    cache.partition(n, bounds);
+    assert(bounds.size() == n + 1);
+    assert(bounds[0] == cache.begin());
+    assert(bounds[n] == cache.end());
+    for (int i = 1; i < n; ++i) {
+      assert(bounds[i-1] <= bounds[i]);
+      assert(bounds[i] == cache.end() || *(bounds[i] - 1) == CORPUS_CACHE_EOS); // starts a sentence
+    }
+  }
+}
+
+
+int main() {
+
+  test_write_read();
+  test_partition();
+
+  return SUCCESS;
+}
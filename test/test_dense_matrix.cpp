@@ -2,6 +2,7 @@
  * Copyright (C) 2017 Yahoo! JAPAN Research
  *******************************************/
 #include <cassert>
+#include <cmath>
 #include "../src/dense_matrix.h"
 
 
@@ -33,6 +34,154 @@ void test_reduce() {
 }
 
 
+// rows beyond the permutation stay where they are
+void test_permute() {
+
+  DenseMatrix m(6, 3, 0.0, FP32, 64);
+  for (int i = 0; i < 6; ++i) {
+    m[i][0] = i;
+    m[i][2] = 10*i;
+  }
+  const int order[] = {3, 0, 4, 1, 2};
+  m.permute(std::vector<int>(order, order + 5));
+  for (int i = 0; i < 5; ++i) {
+    assert(m[i][0] == order[i]);
+    assert(m[i][2] == 10*order[i]);
+  }
+  assert(m[5][0] == 5.0);
+}
+
+
+// FP16/BF16 matrices are read and written row by row through real_t
+void test_storage(const int type) {
+
+  DenseMatrix m(5, 3, 0.5, type);
+  assert(m.type() == type);
+  real_t v[3] = {1.0, -2.0, 0.25};
+  real_t w[3];
+  m.get(4, w);
+  assert(w[0] == 0.5 && w[1] == 0.5 && w[2] == 0.5);
+  m.set(1, v);
+  m.set(3, v);
+  m.get(1, w);
+  assert(w[0] == 1.0 && w[1] == -2.0 && w[2] == 0.25);
+  v[1] = 1.0e-3;
+  m.set(2, v);
+  m.get(2, w);
+  assert(w[1] != 1.0e-3 || type == FP32);
+  assert(std::fabs(w[1] - 1.0e-3) < 1.0e-5);
+
+  //
+  std::unordered_set<int> reserved_rows;
+  reserved_rows.insert(2);
+  reserved_rows.insert(3);
+  DenseMatrix m2(m);
+  m2.reduce(reserved_rows);
+  real_t u[3];
+  m.get(2, u);
+  m2.get(0, w);
+  assert(w[0] == u[0] && w[1] == u[1] && w[2] == u[2]);
+  m2.get(1, w);
+  assert(w[0] == 1.0 && w[1] == -2.0 && w[2] == 0.25);
+
+  //
+  FILE* os = fopen("tmp", "wb");
+  assert(m.save(os) == SUCCESS);
+  fclose(os);
+  DenseMatrix m3;
+  FILE* is = fopen("tmp", "rb");
+  assert(m3.load(is, type) == SUCCESS);
+  fclose(is);
+  assert(m3.type() == type);
+  assert(m3 == m);
+}
+
+
+// views share the rows of their base matrix but copy and save densely
+void test_view() {
+
+  DenseMatrix base(4, 5);
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j < 5; ++j) {
+      base[i][j] = 10*i + j;
+    }
+  }
+  DenseMatrix m;
+  m.view(base, 2, 3);
+  assert(m.row_num() == 4);
+  assert(m.col_num() == 3);
+  assert(m.stride() == 5);
+  assert(m[1][0] == 12.0);
+  m[3][2] = -1.0;
+  assert(base[3][4] == -1.0);
+  real_t v[3] = {1.0, 2.0, 3.0};
+  m.set(0, v);
+  assert(base[0][1] == 1.0 && base[0][2] == 1.0 && base[0][4] == 3.0);
+
+  //
+  DenseMatrix m2(m);
+  assert(m2.stride() == 3);
+  assert(m2 == m);
+  std::unordered_set<int> reserved_rows;
+  reserved_rows.insert(2);
+  m.reduce(reserved_rows);
+  assert(m[0][0] == 22.0);
+  assert(base[0][1] == 1.0 && base[0][2] == 22.0);
+
+  //
+  FILE* os = fopen("tmp", "wb");
+  assert(m.save(os) == SUCCESS);
+  fclose(os);
+  FILE* is = fopen("tmp", "rb");
+  assert(m2.load(is) == SUCCESS);
+  fclose(is);
+  assert(m2.stride() == 3);
+  assert(m2 == m);
+}
+
+
+// padded rows start on their own cache lines and are saved packed
+void test_padding() {
+
+  DenseMatrix m(3, 5, 1.0, FP32, 64);
+  assert(m.row_alignment() == 64);
+  assert(m.stride() == 16);
+  assert(reinterpret_cast<size_t>(m[1]) % 64 == 0);
+  m[1][4] = 2.0;
+  m[2][0] = 3.0;
+  DenseMatrix m2(m);
+  assert(m2.stride() == 16);
+  assert(m2 == m);
+  DenseMatrix m3(3, 5, 0.0, BF16, 16);
+  assert(m3.stride() == 8);
+
+  //
+  std::unordered_set<int> reserved_rows;
+  reserved_rows.insert(1);
+  reserved_rows.insert(2);
+  m2.reduce(reserved_rows);
+  assert(m2[0][4] == 2.0);
+  assert(m2[1][0] == 3.0);
+
+  // the file is the same as that of a packed matrix
+  DenseMatrix packed(3, 5, 1.0);
+  packed[1][4] = 2.0;
+  packed[2][0] = 3.0;
+  FILE* os = fopen("tmp", "wb");
+  assert(m.save(os) == SUCCESS);
+  assert(packed.save(os) == SUCCESS);
+  fclose(os);
+  FILE* is = fopen("tmp", "rb");
+  assert(m2.load(is) == SUCCESS);
+  assert(m3.load(is, FP32, 64) == SUCCESS);
+  fclose(is);
+  assert(m2.stride() == 5);
+  assert(m3.stride() == 16);
+  assert(m2 == packed);
+  assert(m3 == packed);
+}
+
+
 int main() {
 
   DenseMatrix m(5, 2);
@@ -65,6 +214,12 @@ int main() {
   assert(m.row_num() == 5);  
 
   test_reduce();
+  test_permute();
+  test_storage(FP32);
+  test_storage(FP16);
+  test_storage(BF16);
+  test_view();
+  test_padding();
   
   return SUCCESS;
 }
@@ -0,0 +1,80 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#include <cassert>
+#include <vector>
+#include <string>
+#include "../src/line_reader.h"
+
+
+using namespace yskip;
+
+
+FILE* create_file(const std::string& text) {
+
+  FILE* os = fopen("tmp_lines", "wb");
+  assert(os != NULL);
+  assert(fwrite(text.data(), sizeof(char), text.size(), os) == text.size());
+  fclose(os);
+  FILE* is = fopen("tmp_lines", "rb");
+  assert(is != NULL);
+  return is;
+}
+
+
+std::vector<std::string> read_all(LineReader& reader) {
+
+  std::vector<std::string> lines;
+  Span line;
+  while (reader.next(line)) {
+    assert(*line.end == '\0');
+    lines.push_back(line.str());
+  }
+  return lines;
+}
+
+
+// lines shorter than, as long as and longer than a block, and empty lines
+void test_lines(const size_t block_size) {
+
+  const std::string long_line(3*block_size + 1, 'x');
+  const std::string text = "A B\n\nCDEFGH\n" + long_line + "\n" + std::string(block_size, 'y') + "\nlast";
+  FILE* is = create_file(text);
+  LineReader reader(is, block_size);
+  std::vector<std::string> lines = read_all(reader);
+  assert(lines.size() == 6);
+  assert(lines[0] == "A B");
+  assert(lines[1] == "");
+  assert(lines[2] == "CDEFGH");
+  assert(lines[3] == long_line);
+  assert(lines[4] == std::string(block_size, 'y'));
+  assert(lines[5] == "last"); // no newline at the end
+  fclose(is);
+}
+
+
+void test_newline_at_end() {
+
+  FILE* is = create_file("A\nB\n");
+  LineReader reader(is, 3);
+  std::vector<std::string> lines = read_all(reader);
+  assert(lines.size() == 2);
+  assert(lines[0] == "A");
+  assert(lines[1] == "B");
+  fclose(is);
+
+  is = create_file("");
+  LineReader reader2(is);
+  assert(read_all(reader2).empty());
+  fclose(is);
+}
+
+
+int main() {
+
+  test_lines(1);
+  test_lines(4);
+  test_lines(1024);
+  test_newline_at_end();
+  return SUCCESS;
+}
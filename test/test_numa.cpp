@@ -0,0 +1,109 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#include <cassert>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <string>
+#include "../src/numa.h"
+#include "../src/dense_matrix.h"
+#include "../src/skipgram.h"
+
+
+using namespace yskip;
+
+
+void write_file(const std::string& path, const char* s) {
+
+  FILE* os = fopen(path.c_str(), "w");
+  assert(os != NULL);
+  fputs(s, os);
+  fclose(os);
+}
+
+
+void test_parse_cpu_list() {
+
+  std::vector<int> cpus = parse_cpu_list("0-2,5,7-8\n");
+  assert(cpus.size() == 6);
+  assert(cpus[0] == 0 && cpus[2] == 2 && cpus[3] == 5 && cpus[4] == 7 && cpus[5] == 8);
+  assert(parse_cpu_list("3").size() == 1);
+  assert(parse_cpu_list("").empty());
+  assert(parse_cpu_list("2-1").empty());
+  assert(parse_cpu_list("0,x").empty());
+}
+
+
+// two nodes with four CPUs each and a node with memory only
+void test_topology() {
+
+  mkdir("tmp_node", 0755);
+  mkdir("tmp_node/node0", 0755);
+  mkdir("tmp_node/node1", 0755);
+  mkdir("tmp_node/node2", 0755);
+  write_file("tmp_node/online", "0-2\n");
+  write_file("tmp_node/node0/cpulist", "0-3\n");
+  write_file("tmp_node/node1/cpulist", "4-7\n");
+  write_file("tmp_node/node2/cpulist", "\n");
+  NumaTopology numa("tmp_node");
+  assert(numa.node_num() == 2);
+  assert(numa.cpus(1).size() == 4 && numa.cpus(1)[0] == 4);
+
+  // workers in contiguous blocks, wrapping around the CPUs of a node
+  assert(numa.worker_node(0, 4) == 0 && numa.worker_node(1, 4) == 0);
+  assert(numa.worker_node(2, 4) == 1 && numa.worker_node(3, 4) == 1);
+  assert(numa.worker_cpu(1, 4) == 1);
+  assert(numa.worker_cpu(2, 4) == 4);
+  assert(numa.worker_cpu(3, 4) == 5);
+  assert(numa.worker_cpu(9, 10) == 4 + (9 - 5)%4);
+  assert(numa.worker_node(0, 1) == 0);
+}
+
+
+// without NUMA everything is a no-op
+void test_single_node() {
+
+  NumaTopology numa("tmp_no_such_dir");
+  assert(numa.node_num() == 1);
+  assert(!numa.cpus(0).empty());
+  assert(numa.worker_node(5, 8) == 0);
+  assert(numa.pin_worker(0, 1) == SUCCESS);
+  DenseMatrix m(1000, 100, 1.0);
+  assert(m.interleave(numa) == SUCCESS);
+  assert(m.bind(numa, 0, 500, 0) == SUCCESS);
+  assert(m[999][99] == 1.0);
+}
+
+
+// placement does not change what is trained
+void test_skipgram(const int numa_mode) {
+
+  Random random(0);
+  Skipgram::Option option;
+  option.max_vocab_size     = 20;
+  option.unigram_table_size = 100;
+  option.vec_size           = 10;
+  Skipgram sg(option, random);
+  Random random2(0);
+  option.numa_mode = numa_mode;
+  Skipgram sg2(option, random2);
+  assert(sg2.numa_mode() == numa_mode);
+  std::vector<std::string> text = tokenize("A B C C D B DE D");
+  std::vector<real_t> grad(sg.grad_size());
+  sg.train(text, true, &grad[0], random);
+  sg2.train(text, true, &grad[0], random2);
+  assert(sg.vec().input == sg2.vec().input);
+  assert(sg.vec().output == sg2.vec().output);
+}
+
+
+int main() {
+
+  test_parse_cpu_list();
+  test_topology();
+  test_single_node();
+  test_skipgram(NUMA_INTERLEAVE);
+  test_skipgram(NUMA_PARTITION);
+
+  return SUCCESS;
+}
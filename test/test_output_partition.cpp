@@ -0,0 +1,167 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include "../src/output_partition.h"
+#include "../src/skipgram.h"
+
+
+using namespace yskip;
+
+
+bool equal_rows(const DenseMatrix& m1, const DenseMatrix& m2, const int row) {
+
+  return std::equal(m1[row], m1[row] + m1.col_num(), m2[row]);
+}
+
+
+void test_router() {
+
+  std::shared_ptr<OutputPartition> partition = std::make_shared<OutputPartition>(2, 2, 1);
+  OutputRouter router0, router1, router;
+  assert(router.enabled() == false);
+  router0.initialize(partition, 0, 10);
+  router1.initialize(partition, 1, 10);
+  assert(router0.enabled() && router1.enabled());
+  assert(router0.owns(4) && !router0.owns(5));
+  assert(router1.owns(5) && router1.owner(4) == 0);
+
+  // batches of two updates, at most one batch in each queue
+  OutputUpdate u = {5, 0, 0.5};
+  assert(router0.add(u) == false);
+  assert(router0.add(u));
+  assert(router0.flush(1));
+  assert(router0.flush(1)); // nothing to send
+  u.row = 7;
+  router0.add(u);
+  assert(router0.flush(1) == false);
+  const OutputUpdateBatch* batch = router1.receive();
+  assert(batch != NULL && batch->size() == 2 && (*batch)[0].row == 5);
+  assert(router0.flush(1));
+  batch = router1.receive();
+  assert(batch != NULL && batch->size() == 1 && (*batch)[0].row == 7);
+  assert(router1.receive() == NULL);
+  assert(router0.receive() == NULL);
+
+  //
+  router0.arrive();
+  assert(router0.all_arrived() == false);
+  router1.arrive();
+  assert(router0.all_arrived() && router1.all_arrived());
+  router1.arrive();
+  assert(router1.all_arrived() == false);
+}
+
+
+// the rows of the other worker only change once it receives the updates
+void test_sgd(const int sgd_mode) {
+
+  Random random(0);
+  Skipgram::Option option;
+  option.max_vocab_size     = 20;
+  option.unigram_table_size = 100;
+  option.vec_size           = 10;
+  option.optimizer          = SGD;
+  option.sgd_mode           = sgd_mode;
+  Skipgram sg(option, random);
+  sg.update_unigram_table(tokenize("A B C D E F"), random);
+  std::shared_ptr<OutputPartition> partition = std::make_shared<OutputPartition>(2, 1);
+  OutputRouter router0, router1;
+  router0.initialize(partition, 0, option.vec_size);
+  router1.initialize(partition, 1, option.vec_size);
+
+  //
+  const DenseMatrix output = sg.vec().output;
+  std::vector<real_t> grad(sg.grad_size());
+  std::vector<int> neg_samples;
+  neg_samples.push_back(2);
+  neg_samples.push_back(3);
+  neg_samples.push_back(4);
+  neg_samples.push_back(5);
+  neg_samples.push_back(5);
+  if (sgd_mode == Skipgram::PAIR_SGD) {
+    sg.sgd(0, 1, neg_samples, &grad[0], NULL, &router0);
+  }else {
+    sg.sgd_window(1, std::vector<int>(2, 0), neg_samples, &grad[0], NULL, &router0);
+  }
+  for (int w = 1; w < 6; ++w) {
+    assert(equal_rows(output, sg.vec().output, w) == (w%2 == 1));
+  }
+  sg.receive_updates(router0);
+  assert(equal_rows(output, sg.vec().output, 3));
+  sg.receive_updates(router1);
+  for (int w = 1; w < 6; ++w) {
+    assert(!equal_rows(output, sg.vec().output, w));
+  }
+}
+
+
+// every update is applied by the time all workers have finished
+void test_train(const int optimizer, const int sgd_mode) {
+
+  const int thread_num = 3;
+  Random random(0);
+  Skipgram::Option option;
+  option.max_vocab_size     = 20;
+  option.unigram_table_size = 100;
+  option.vec_size           = 10;
+  option.optimizer          = optimizer;
+  option.sgd_mode           = sgd_mode;
+  Skipgram sg(option, random);
+  std::vector<std::string> text = tokenize("A B C C D B DE D D A D E F G A B");
+  sg.update_unigram_table(text, random);
+  std::vector<int> encoded_text;
+  sg.encode(text, encoded_text);
+  const DenseMatrix output = sg.vec().output;
+  std::shared_ptr<OutputPartition> partition = std::make_shared<OutputPartition>(thread_num, 4, 2);
+  std::vector<std::unique_ptr<OutputRouter>> routers;
+  for (int i = 0; i < thread_num; ++i) {
+    routers.push_back(std::unique_ptr<OutputRouter>(new OutputRouter()));
+    routers.back()->initialize(partition, i, option.vec_size);
+  }
+
+  // two tasks in a row, as with mini-batches
+  for (int task = 0; task < 2; ++task) {
+    std::vector<std::thread> threads;
+    for (int i = 0; i < thread_num; ++i) {
+      threads.push_back(std::thread([&](const int id) {
+	    Random random(id);
+	    std::vector<real_t> grad(sg.grad_size());
+	    for (int n = 0; n < 50; ++n) {
+	      sg.train(encoded_text.data(), encoded_text.size(), &grad[0], random, NULL, routers[id].get());
+	    }
+	    sg.finish_updates(*routers[id]);
+	  }, i));
+    }
+    for (int i = 0; i < thread_num; ++i) {
+      threads[i].join();
+    }
+    for (int i = 0; i < thread_num; ++i) {
+      assert(routers[i]->receive() == NULL);
+    }
+  }
+  for (int w = 0; w < static_cast<int>(sg.vocab().size()); ++w) {
+    assert(!equal_rows(output, sg.vec().output, w));
+    for (int i = 0; i < option.vec_size; ++i) {
+      assert(std::isfinite(sg.vec().output[w][i]));
+    }
+  }
+}
+
+
+int main() {
+
+  test_router();
+  test_sgd(Skipgram::PAIR_SGD);
+  test_sgd(Skipgram::WINDOW_SGD);
+  for (int optimizer = ADAGRAD; optimizer <= SGD; ++optimizer) {
+    test_train(optimizer, Skipgram::PAIR_SGD);
+    test_train(optimizer, Skipgram::WINDOW_SGD);
+  }
+
+  return SUCCESS;
+}
@@ -0,0 +1,87 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#include <cassert>
+#include "../src/output_replica.h"
+#include "../src/skipgram.h"
+
+
+using namespace yskip;
+
+
+// updates made to the shared rows in the meantime survive a push()
+void test_push_pull() {
+
+  DenseMatrix shared(5, 2, 1.0);
+  ReplicatedRows rows;
+  rows.initialize(shared, 3);
+  assert(rows[0] == shared[0]); // nothing replicated before pull()
+  rows.pull(10);
+  assert(rows.row_num() == 3);
+  assert(rows[2] != shared[2]);
+  assert(rows[3] == shared[3]);
+  rows[0][0] += 2.0;
+  rows[2][1] -= 1.0;
+  shared[0][0] += 0.5; // another thread
+  assert(shared[0][0] == 1.5);
+  rows.push();
+  assert(rows.row_num() == 0);
+  assert(shared[0][0] == 3.5);
+  assert(shared[0][1] == 1.0);
+  assert(shared[2][1] == 0.0);
+  rows.pull(1);
+  assert(rows.row_num() == 1);
+  assert(rows[0][0] == 3.5);
+}
+
+
+// with a single thread, training through replicas changes nothing but rounding
+void test_train(const int optimizer, const int sgd_mode) {
+
+  Random random(0);
+  Skipgram::Option option;
+  option.max_vocab_size        = 20;
+  option.unigram_table_size    = 100;
+  option.vec_size              = 10;
+  option.optimizer             = optimizer;
+  option.sgd_mode              = sgd_mode;
+  option.replica_rows          = 3;
+  option.replica_sync_interval = 7;
+  Skipgram sg(option, random);
+  std::vector<std::string> text = tokenize("A B C C D B DE D D A D");
+  sg.update_unigram_table(text, random);
+  assert(sg.save("tmp", true) == SUCCESS);
+  Skipgram sg2(option);
+  assert(sg2.load("tmp", true) == SUCCESS);
+  assert(sg.load("tmp", true) == SUCCESS);
+
+  //
+  OutputReplica replica;
+  sg2.init_replica(replica);
+  assert(replica.enabled());
+  std::vector<int> encoded_text;
+  sg.encode(text, encoded_text);
+  std::vector<real_t> grad(sg.grad_size());
+  Random random1(1), random2(1);
+  for (int i = 0; i < 5; ++i) {
+    sg.train(encoded_text.data(), encoded_text.size(), &grad[0], random1);
+    sg2.train(encoded_text.data(), encoded_text.size(), &grad[0], random2, &replica);
+  }
+  assert(replica.pulled());
+  replica.push();
+  assert(!replica.pulled());
+  assert(sg.vec().output == sg2.vec().output);
+  assert(sg.vec().input == sg2.vec().input);
+}
+
+
+int main() {
+
+  test_push_pull();
+  for (int optimizer = ADAGRAD; optimizer <= SGD; ++optimizer) {
+    test_train(optimizer, Skipgram::PAIR_SGD);
+    test_train(optimizer, Skipgram::WINDOW_SGD);
+  }
+
+  return SUCCESS;
+}
@@ -2,13 +2,15 @@
  * Copyright (C) 2017 Yahoo! JAPAN Research
  *******************************************/
 #include <cassert>
+#include <vector>
+#include <algorithm>
 #include "../src/random.h"
 
 
 using namespace yskip;
 
 
-int main(int argc, char **argv) {
+void test_round() {
 
   Random random(0);
   int rounddown_num = 0;
@@ -23,6 +25,97 @@ int main(int argc, char **argv) {
     }
   }
   std::fprintf(stderr, "round(1.7): #rounddown=%d, #roundup=%d\n", rounddown_num, roundup_num);
+}
+
+
+void test_uniform() {
+
+  Random random(1);
+  std::vector<int> hist(10, 0);
+  for (int i = 0; i < 100000; ++i) {
+    int r = random.uniform(3, 13);
+    assert(3 <= r && r < 13);
+    ++hist[r - 3];
+    real_t x = random.uniform(static_cast<real_t>(-1.0), static_cast<real_t>(1.0));
+    assert(-1.0 <= x && x < 1.0);
+    double y = random.uniform(0.0, 1.0);
+    assert(0.0 <= y && y < 1.0);
+  }
+  for (int i = 0; i < 10; ++i) {
+    assert(9000 < hist[i] && hist[i] < 11000);
+  }
+}
+
+
+void test_fill() {
+
+  Random random1(2);
+  Random random2(2);
+  std::vector<int> v(100);
+  std::vector<real_t> w(100);
+  random1.fill(&v[0], &v[0] + v.size(), 0, 7);
+  random1.fill(&w[0], &w[0] + w.size(), static_cast<real_t>(0.0), static_cast<real_t>(0.5));
+  for (size_t i = 0; i < v.size(); ++i) {
+    assert(v[i] == random2.uniform(0, 7)); // fill draws the same sequence as uniform()
+  }
+  for (size_t i = 0; i < w.size(); ++i) {
+    assert(w[i] == random2.uniform(static_cast<real_t>(0.0), static_cast<real_t>(0.5)));
+  }
+}
+
+
+void test_stream() {
+
+  // same seed and stream reproduce the sequence; different streams differ
+  Random random1(3, 1);
+  Random random2(3, 1);
+  Random random3(3, 2);
+  int same_num = 0;
+  for (int i = 0; i < 1000; ++i) {
+    uint64_t x = random1.next();
+    assert(x == random2.next());
+    if (x == random3.next()) {
+      ++same_num;
+    }
+  }
+  assert(same_num == 0);
+
+  //
+  random3.seed(3, 1);
+  Random random4(3, 1);
+  for (int i = 0; i < 1000; ++i) {
+    assert(random3.next() == random4.next());
+  }
+}
+
+
+// ranges beyond 2^32, e.g. indices of huge unigram tables
+void test_uniform64() {
+
+  Random random1(4);
+  Random random2(4);
+  for (int i = 0; i < 1000; ++i) {
+    assert(random1.uniform(static_cast<int64_t>(3), static_cast<int64_t>(1000)) == random2.uniform(3, 1000)); // same as int for small ranges
+  }
+  const int64_t max = static_cast<int64_t>(1) << 40;
+  int64_t max_r = 0;
+  for (int i = 0; i < 1000; ++i) {
+    const int64_t r = random1.uniform(static_cast<int64_t>(0), max);
+    assert(0 <= r && r < max);
+    max_r = std::max(max_r, r);
+  }
+  assert(static_cast<int64_t>(1) << 39 < max_r);
+  assert(static_cast<int64_t>(1) << 32 < random1.round(static_cast<double>(max) + 0.5));
+}
+
+
+int main(int argc, char **argv) {
+
+  test_round();
+  test_uniform();
+  test_uniform64();
+  test_fill();
+  test_stream();
   
   return SUCCESS;
 }
@@ -0,0 +1,120 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#include <cassert>
+#include "../src/random.h"
+#include "../src/vec_util.h"
+#include "../src/dense_matrix.h"
+#include "../src/sgd_kernel.h"
+
+
+using namespace yskip;
+
+
+struct Model {
+  DenseMatrix input;
+  DenseMatrix output;
+  DenseMatrix squared_input;
+  DenseMatrix squared_output;
+  Model(const int row_num, const int col_num, const int state_size) : input(row_num, col_num), output(row_num, col_num), squared_input(row_num, state_size, 1.0e-8), squared_output(row_num, state_size, 1.0e-8) {};
+};
+
+
+bool equal(const DenseMatrix& m1, const DenseMatrix& m2) {
+
+  for (int i = 0; i < m1.row_num(); ++i) {
+    for (int j = 0; j < m1.col_num(); ++j) {
+      if (m1[i][j] != m2[i][j]) {
+	return false;
+      }
+    }
+  }
+  return true;
+}
+
+
+bool equal(const Model& m1, const Model& m2) {
+
+  return equal(m1.input, m2.input) && equal(m1.output, m2.output) && equal(m1.squared_input, m2.squared_input) && equal(m1.squared_output, m2.squared_output);
+}
+
+
+// a specialized kernel must give the same result as the generic kernel of the same instruction set
+void test_sgd_kernel(const char* isa, const int vec_size, const int optimizer) {
+
+  SgdFunction kernel = find_sgd_kernel(isa, vec_size, optimizer);
+  if (kernel == NULL) {
+    std::fprintf(stderr, "%s is not supported\n", isa);
+    return;
+  }
+  SgdFunction generic_kernel = find_sgd_kernel(isa, 1, optimizer);
+  assert(generic_kernel != NULL);
+
+  //
+  const int row_num = 10;
+  Random random(0);
+  const int state_size = std::max(1, optimizer_state_size(optimizer, vec_size));
+  Model m1(row_num, vec_size, state_size), m2(row_num, vec_size, state_size);
+  for (int i = 0; i < row_num; ++i) {
+    random.fill(m1.input[i], m1.input[i] + vec_size, static_cast<real_t>(-1.0), static_cast<real_t>(1.0));
+    random.fill(m1.output[i], m1.output[i] + vec_size, static_cast<real_t>(-1.0), static_cast<real_t>(1.0));
+    std::copy(m1.input[i], m1.input[i] + vec_size, m2.input[i]);
+    std::copy(m1.output[i], m1.output[i] + vec_size, m2.output[i]);
+  }
+  std::vector<real_t> grad(vec_size);
+  int neg_samples[5];
+  for (int n = 0; n < 20; ++n) {
+    const int t = random.uniform(0, row_num);
+    const int c = random.uniform(0, row_num);
+    random.fill(neg_samples, neg_samples + 5, 0, row_num);
+    kernel(0.1, t, c, neg_samples, 5, m1.input, m1.output, m1.squared_input, m1.squared_output, &grad[0]);
+    generic_kernel(0.1, t, c, neg_samples, 5, m2.input, m2.output, m2.squared_input, m2.squared_output, &grad[0]);
+    assert(equal(m1, m2));
+  }
+}
+
+
+// the kernel must match the update written with the functions of vec_util.h
+void test_generic(const int vec_size) {
+
+  SgdFunction kernel = sgd_kernel(vec_size);
+  const int row_num = 4;
+  Random random(1);
+  Model m(row_num, vec_size, vec_size);
+  for (int i = 0; i < row_num; ++i) {
+    random.fill(m.input[i], m.input[i] + vec_size, static_cast<real_t>(-1.0), static_cast<real_t>(1.0));
+    random.fill(m.output[i], m.output[i] + vec_size, static_cast<real_t>(-1.0), static_cast<real_t>(1.0));
+  }
+  Model m2(m);
+  std::vector<real_t> grad(vec_size), grad2(vec_size, 0.0);
+
+  //
+  const int neg_samples[] = {2, 3};
+  kernel(0.1, 0, 1, neg_samples, 2, m.input, m.output, m.squared_input, m.squared_output, &grad[0]);
+  const real_t* x = m2.input[0];
+  for (int j = 0; j < 3; ++j) {
+    const int v = j == 0 ? 1 : neg_samples[j - 1];
+    const double g = sigmoid(dot(x, x + vec_size, m2.output[v])) - (j == 0 ? 1.0 : 0.0);
+    adagrad_output(0.1, g, x, x + vec_size, m2.output[v], m2.squared_output[v], &grad2[0]);
+  }
+  adagrad_input(0.1, &grad2[0], &grad2[0] + vec_size, m2.squared_input[0], m2.input[0]);
+  assert(equal(m, m2));
+}
+
+
+int main() {
+
+  const char* isas[] = {"scalar", "sse", "avx2", "avx512"};
+  const int sizes[] = {100, 200, 300, 37};
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      for (int k = ADAGRAD; k <= SGD; ++k) {
+	test_sgd_kernel(isas[i], sizes[j], k);
+      }
+    }
+  }
+  test_generic(100);
+  test_generic(37);
+
+  return 0;
+}
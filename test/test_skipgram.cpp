@@ -86,10 +86,468 @@ void test_reduce_vocab() {
 }
 
 
+void test_encode() {
+
+  Random random(0);
+  Skipgram::Option option;
+  option.max_vocab_size     = 20;
+  option.unigram_table_size = 10;
+  Skipgram sg(option);
+  sg.update_unigram_table(tokenize("A B C"), random);
+
+  //
+  std::vector<int> encoded_text;
+  sg.encode(tokenize("C X A Y B"), encoded_text); // unknown words are dropped
+  assert(encoded_text.size() == 3);
+  assert(encoded_text[0] == 2);
+  assert(encoded_text[1] == 0);
+  assert(encoded_text[2] == 1);
+  sg.encode(tokenize("X Y"), encoded_text);
+  assert(encoded_text.empty());
+}
+
+
+// the span overloads do the same as those taking strings
+void test_spans() {
+
+  Skipgram::Option option;
+  option.max_vocab_size     = 5; // reduced on the way
+  option.unigram_table_size = 10;
+  option.vec_size           = 10;
+  Random random1(1), random2(1);
+  Skipgram sg(option, random1);
+  Skipgram sg2(option, random2);
+  std::vector<real_t> grad(sg.grad_size()), grad2(sg2.grad_size());
+
+  const char* lines[] = {"A B C C D B DE D", "  A  X Y ", "", "B C D E F G A B"};
+  std::vector<Span> tokens;
+  TrainBuffer buffer; // reused across the lines
+  for (int i = 0; i < 4; ++i) {
+    sg.train(tokenize(lines[i]), true, &grad[0], random1);
+    tokens.clear();
+    tokenize(lines[i], tokens);
+    sg2.train(tokens.data(), tokens.data() + tokens.size(), true, &grad2[0], random2, buffer);
+  }
+  assert(sg.vocab() == sg2.vocab());
+  for (uint32_t w = 0; w < sg.vocab().size(); ++w) {
+    for (int i = 0; i < sg.vec_size(); ++i) {
+      assert(sg.vec().input[w][i] == sg2.vec().input[w][i]);
+      assert(sg.vec().output[w][i] == sg2.vec().output[w][i]);
+    }
+  }
+
+  std::vector<int> encoded_text, encoded_text2;
+  tokens.clear();
+  tokenize("B Q A", tokens);
+  sg.encode(tokenize("B Q A"), encoded_text);
+  sg2.encode(tokens.data(), tokens.data() + tokens.size(), encoded_text2);
+  assert(encoded_text == encoded_text2);
+}
+
+
+// with a single context, the window update is the pair update with input and output swapped
+void test_sgd_window() {
+
+  Random random(0);
+  Skipgram::Option option;
+  option.max_vocab_size     = 20;
+  option.unigram_table_size = 10;
+  option.vec_size           = 20;
+  option.neg_sample_num     = 2;
+  Skipgram::Option window_option = option;
+  window_option.sgd_mode = Skipgram::WINDOW_SGD;
+  Random random1(1), random2(1);
+  Skipgram sg(option, random1);
+  Skipgram sg2(window_option, random2);
+  assert(sg.grad_size() == static_cast<size_t>(sg.vec_size()));
+  assert(sg.vec_size() <= sg2.grad_size());
+  sg.update_unigram_table(tokenize("A B C D"), random);
+  sg2.update_unigram_table(tokenize("A B C D"), random);
+  std::vector<real_t> grad(sg.grad_size()), grad2(sg2.grad_size());
+
+  //
+  std::vector<int> neg_samples = {2, 3};
+  sg.sgd(1, 0, neg_samples, &grad[0]);
+  sg2.sgd_window(0, std::vector<int>(1, 1), neg_samples, &grad2[0]);
+  for (int w = 0; w < 4; ++w) {
+    for (int i = 0; i < sg.vec_size(); ++i) {
+      assert(approx_equal(sg.vec().input[w][i], sg2.vec().input[w][i]));
+      assert(approx_equal(sg.vec().output[w][i], sg2.vec().output[w][i]));
+    }
+  }
+
+  //
+  sg2.train(tokenize("A B C D A B C D"), false, &grad2[0], random);
+}
+
+
+void test_optimizer(const int optimizer, const bool binary_mode) {
+
+  Random random(0);
+  Skipgram::Option option;
+  option.max_vocab_size     = 20;
+  option.unigram_table_size = 10;
+  option.vec_size           = 10;
+  option.optimizer          = optimizer;
+  Skipgram sg(option, random);
+  assert(sg.optimizer() == optimizer);
+  assert(sg.vec().input.col_num() == 10);
+  std::vector<real_t> grad(sg.grad_size());
+  std::vector<std::string> text = tokenize("A B C C D B DE D");
+  sg.update_unigram_table(text, random);
+  sg.set_decay_count(100);
+  for (int i = 0; i < 5; ++i) {
+    sg.train(text, false, &grad[0], random);
+  }
+  if (optimizer == SGD) {
+    assert(sg.learning_rate() < sg.eta());
+  }else {
+    assert(sg.learning_rate() == sg.eta());
+  }
+  assert(sg.save("tmp", binary_mode) == SUCCESS);
+
+  // the optimizer is taken from the model file
+  Skipgram sg2;
+  assert(sg2.load("tmp", binary_mode) == SUCCESS);
+  assert(sg2.optimizer() == optimizer);
+  assert(sg.vocab() == sg2.vocab());
+  assert(sg.counts() == sg2.counts());
+  for (int w = 0; w < sg.vocab().size(); ++w) { // text models only hold the rows of known words
+    for (int i = 0; i < sg.vec_size(); ++i) {
+      assert(approx_equal(sg.vec().input[w][i], sg2.vec().input[w][i]));
+      assert(approx_equal(sg.vec().output[w][i], sg2.vec().output[w][i]));
+    }
+  }
+  sg2.train(text, false, &grad[0], random);
+}
+
+
+// FP16/BF16 parameters are trained through converted rows and kept in the model files
+void test_storage(const int vector_storage, const int state_storage, const int sgd_mode, const bool binary_mode) {
+
+  Random random(0);
+  Skipgram::Option option;
+  option.max_vocab_size     = 20;
+  option.unigram_table_size = 10;
+  option.vec_size           = 10;
+  option.sgd_mode           = sgd_mode;
+  option.vector_storage     = vector_storage;
+  option.state_storage      = state_storage;
+  Skipgram sg(option, random);
+  assert(sg.vec().input.type() == vector_storage);
+  std::vector<real_t> grad(sg.grad_size());
+  std::vector<std::string> text = tokenize("A B C C D B DE D A A B");
+  sg.update_unigram_table(text, random);
+  for (int i = 0; i < 5; ++i) {
+    sg.train(text, false, &grad[0], random);
+  }
+  assert(sg.save("tmp", binary_mode) == SUCCESS);
+
+  //
+  Skipgram sg2;
+  assert(sg2.load("tmp", binary_mode) == SUCCESS);
+  assert(sg2.vector_storage() == vector_storage);
+  assert(sg2.state_storage() == state_storage);
+  assert(sg.vocab() == sg2.vocab());
+  std::vector<real_t> v(sg.vec_size()), v2(sg.vec_size());
+  for (int w = 0; w < sg.vocab().size(); ++w) {
+    sg.vec().input.get(w, &v[0]);
+    sg2.vec().input.get(w, &v2[0]);
+    for (int i = 0; i < sg.vec_size(); ++i) {
+      assert(std::isfinite(v[i]));
+      assert(approx_equal(v[i], v2[i]));
+    }
+  }
+  sg2.train(text, false, &grad[0], random);
+}
+
+
+// the interleaved layout and padded rows must train exactly like the packed separate layout and save the same files
+void test_layout(const int optimizer, const int sgd_mode, const int layout, const int row_alignment) {
+
+  Skipgram::Option option;
+  option.max_vocab_size     = 20;
+  option.unigram_table_size = 10;
+  option.vec_size           = 10;
+  option.optimizer          = optimizer;
+  option.sgd_mode           = sgd_mode;
+  Skipgram::Option interleaved_option = option;
+  interleaved_option.layout        = layout;
+  interleaved_option.row_alignment = row_alignment;
+  Random random1(1), random2(1);
+  Skipgram sg(option, random1);
+  Skipgram sg2(interleaved_option, random2);
+  assert(sg2.layout() == layout);
+  if (layout == Skipgram::INTERLEAVED) {
+    assert(optimizer == SGD || sg2.vec().input.stride() == 32);
+  }else {
+    assert(sg2.vec().input.stride() == (row_alignment == 0 ? 10 : 16));
+  }
+  std::vector<real_t> grad(sg.grad_size());
+  std::vector<std::string> text = tokenize("A B C C D B DE D A A B");
+  sg.update_unigram_table(text, random1);
+  sg2.update_unigram_table(text, random2);
+  for (int i = 0; i < 5; ++i) {
+    sg.train(text, false, &grad[0], random1);
+    sg2.train(text, false, &grad[0], random2);
+  }
+  for (int w = 0; w < sg.max_vocab_size(); ++w) {
+    for (int i = 0; i < sg.vec_size(); ++i) {
+      assert(sg.vec().input[w][i] == sg2.vec().input[w][i]);
+      assert(sg.vec().output[w][i] == sg2.vec().output[w][i]);
+    }
+  }
+
+  //
+  assert(sg.save("tmp", true) == SUCCESS);
+  assert(sg2.save("tmp2", true) == SUCCESS);
+  std::vector<char> bytes, bytes2;
+  FILE* is = fopen("tmp", "rb");
+  for (int c; (c = fgetc(is)) != EOF; bytes.push_back(c));
+  fclose(is);
+  is = fopen("tmp2", "rb");
+  for (int c; (c = fgetc(is)) != EOF; bytes2.push_back(c));
+  fclose(is);
+  assert(bytes == bytes2);
+
+  // neither the layout nor the padding is stored in the file
+  Skipgram sg3(interleaved_option);
+  assert(sg3.load("tmp", true) == SUCCESS);
+  assert(sg3.layout() == layout);
+  assert(sg3.vec().input.stride() == sg2.vec().input.stride());
+  assert(sg.vec().input == sg3.vec().input);
+  sg3.train(text, false, &grad[0], random1);
+}
+
+
+// with lazy initialization, only the rows of the vocabulary are materialized
+void test_lazy_init() {
+
+  Random random(0);
+  Skipgram::Option option;
+  option.max_vocab_size     = 3*SparseMatrix::CHUNK_ROWS;
+  option.unigram_table_size = 100;
+  option.vec_size           = 10;
+  option.lazy_init          = true;
+  Skipgram sg(option, random);
+  assert(sg.lazy_init());
+  assert(sg.vec().input.materialized_row_num() == 0);
+  std::vector<real_t> grad(sg.grad_size());
+  std::vector<std::string> text = tokenize("A B C C D B DE D A A B");
+  sg.update_unigram_table(text, random);
+  assert(sg.vec().input.materialized_row_num() == SparseMatrix::CHUNK_ROWS);
+  std::vector<real_t> v(sg.vec_size());
+  sg.vec().input.get(0, &v[0]);
+  assert(v[0] != 0.0 && std::fabs(v[0]) <= 0.5/sg.vec_size());
+  for (int i = 0; i < 5; ++i) {
+    sg.train(text, false, &grad[0], random);
+  }
+
+  // fill up the vocabulary to have it reduced
+  for (int i = 0; i < option.max_vocab_size; ++i) {
+    sg.update_unigram_table(std::to_string(i), random);
+  }
+  assert(sg.vocab().size() < option.max_vocab_size);
+  sg.train(text, false, &grad[0], random);
+
+  //
+  assert(sg.save("tmp", true) == SUCCESS);
+  Skipgram sg2(option);
+  assert(sg2.load("tmp", true) == SUCCESS);
+  assert(sg.vocab() == sg2.vocab());
+  assert(sg.vec().input == sg2.vec().input);
+  sg2.update_unigram_table(tokenize("X Y Z"), random);
+  sg2.train(tokenize("X Y Z A B"), false, &grad[0], random);
+
+  // the rows initialized after loading follow the seed of the run
+  Skipgram small(option, random);
+  small.update_unigram_table(text, random);
+  assert(small.save("tmp", false) == SUCCESS); // a text model has the rows of the vocabulary only
+  Random random1(1), random2(1), random3(2);
+  Skipgram sg3(option, random1), sg4(option, random2), sg5(option, random3);
+  assert(sg3.load("tmp", false) == SUCCESS && sg4.load("tmp", false) == SUCCESS && sg5.load("tmp", false) == SUCCESS);
+  const int w = option.max_vocab_size - 1;
+  assert(!sg3.vec().output.materialized(w));
+  std::vector<real_t> v3(sg.vec_size()), v4(sg.vec_size()), v5(sg.vec_size());
+  sg3.vec().output.get(w, &v3[0]);
+  sg4.vec().output.get(w, &v4[0]);
+  sg5.vec().output.get(w, &v5[0]);
+  assert(v3 == v4 && v3 != v5);
+}
+
+
+// the interleaved layout initializes every row up front, so it turns lazy initialization off
+void test_lazy_init_interleaved() {
+
+  Random random(0);
+  Skipgram::Option option;
+  option.max_vocab_size     = 3*SparseMatrix::CHUNK_ROWS;
+  option.unigram_table_size = 100;
+  option.vec_size           = 10;
+  option.lazy_init          = true;
+  option.layout             = Skipgram::INTERLEAVED;
+  Skipgram sg(option, random);
+  assert(!sg.lazy_init());
+  assert(sg.vec().input.materialized_row_num() == option.max_vocab_size);
+  assert(sg.vec().output.materialized_row_num() == option.max_vocab_size);
+}
+
+
+// an update of rows that have never been materialized initializes them before it reads them
+void test_lazy_init_untouched_rows() {
+
+  Random random(0);
+  Skipgram::Option option;
+  option.max_vocab_size     = 3*SparseMatrix::CHUNK_ROWS;
+  option.unigram_table_size = 100;
+  option.vec_size           = 10;
+  option.neg_sample_num     = 1;
+  option.optimizer          = SGD;
+  option.lazy_init          = true;
+  Skipgram sg(option, random);
+  sg.update_unigram_table(tokenize("A B"), random);
+  const int c = SparseMatrix::CHUNK_ROWS + 1;   // in chunks nobody has materialized
+  const int n = 2*SparseMatrix::CHUNK_ROWS + 1;
+  assert(!sg.vec().output.materialized(c) && !sg.vec().output.materialized(n));
+
+  std::vector<real_t> input0(sg.vec_size()), output0(sg.vec_size()), v(sg.vec_size());
+  sg.vec().input.get(0, &input0[0]);
+  sg.vec().output.get(c, &output0[0]); // the initial values
+  std::vector<real_t> grad(sg.grad_size());
+  sg.sgd(0, c, std::vector<int>(1, n), &grad[0]);
+  assert(sg.vec().output.materialized(c) && sg.vec().output.materialized(n));
+
+  // the output row moved a little from its initial values, not from zero, and the input row learned from it
+  sg.vec().output.get(c, &v[0]);
+  for (int i = 0; i < sg.vec_size(); ++i) {
+    assert(output0[i] != 0.0 && std::fabs(v[i] - output0[i]) < 0.1*std::fabs(output0[i]) + 1.0e-3);
+  }
+  sg.vec().input.get(0, &v[0]);
+  assert(v != input0);
+
+  // window updates too
+  Skipgram::Option window_option = option;
+  window_option.sgd_mode = Skipgram::WINDOW_SGD;
+  Skipgram sg2(window_option, random);
+  sg2.update_unigram_table(tokenize("A B"), random);
+  std::vector<real_t> grad2(sg2.grad_size());
+  sg2.sgd_window(0, std::vector<int>(1, c), std::vector<int>(1, n), &grad2[0]);
+  assert(sg2.vec().input.materialized(c) && sg2.vec().output.materialized(n));
+}
+
+
+// renumbering the words by frequency changes where their rows are, not what is trained
+void test_sort_vocab(const int layout) {
+
+  Random random(0);
+  Skipgram::Option option;
+  option.max_vocab_size     = 20;
+  option.unigram_table_size = 100;
+  option.vec_size           = 10;
+  option.layout             = layout;
+  option.huge_page_rows     = 4;
+  Skipgram sg(option, random);
+  std::vector<std::string> text = tokenize("A B C C D B DE D D A D");
+  sg.update_unigram_table(text, random);
+  std::vector<real_t> grad(sg.grad_size());
+  sg.train(text, false, &grad[0], random);
+  assert(sg.save("tmp", true) == SUCCESS);
+  assert(sg.load("tmp", true) == SUCCESS); // rebuilds the unigram table as sg2 does
+  Skipgram sg2(option);
+  assert(sg2.load("tmp", true) == SUCCESS);
+  sg2.sort_vocab();
+  assert(sg2.vocab().encode("D") == 0);
+  for (int w = 1; w < static_cast<int>(sg2.vocab().size()); ++w) {
+    assert(sg2.counts()[w] <= sg2.counts()[w - 1]);
+  }
+
+  //
+  Random random1(1), random2(1);
+  for (int i = 0; i < 3; ++i) {
+    sg.train(text, false, &grad[0], random1);
+    sg2.train(text, false, &grad[0], random2);
+  }
+  std::vector<real_t> v(sg.vec_size()), v2(sg.vec_size());
+  for (size_t i = 0; i < text.size(); ++i) {
+    const int w = sg.vocab().encode(text[i]);
+    const int w2 = sg2.vocab().encode(text[i]);
+    assert(sg.counts()[w] == sg2.counts()[w2]);
+    sg.vec().input.get(w, &v[0]);
+    sg2.vec().input.get(w2, &v2[0]);
+    assert(v == v2);
+    sg.vec().output.get(w, &v[0]);
+    sg2.vec().output.get(w2, &v2[0]);
+    assert(v == v2);
+  }
+}
+
+
+// binary models written before the format had a version
+void test_load_legacy_bin() {
+
+  Random random(0);
+  Skipgram::Option option;
+  option.max_vocab_size     = 20;
+  option.unigram_table_size = 10;
+  option.vec_size           = 10;
+  Skipgram sg(option, random);
+  sg.update_unigram_table(tokenize("A B C C D"), random);
+
+  //
+  FILE* os = fopen("tmp", "wb");
+  const int ints[] = {sg.max_vocab_size(), sg.vec_size(), sg.window_size(), sg.neg_sample_num()};
+  const real_t reals[] = {sg.alpha(), sg.subsampling_threshold(), sg.eta()};
+  const int unigram_table_size = 10;
+  const count_t total_count = sg.total_count();
+  DenseMatrix squared_grad(sg.max_vocab_size(), sg.vec_size(), 1.0e-8);
+  assert(fwrite(ints, sizeof(int), 4, os) == 4);
+  assert(fwrite(reals, sizeof(real_t), 3, os) == 3);
+  assert(fwrite(&unigram_table_size, sizeof(int), 1, os) == 1);
+  assert(sg.vocab().save(os, false) == SUCCESS);
+  assert(sg.vec().input.save(os) == SUCCESS);
+  assert(sg.vec().output.save(os) == SUCCESS);
+  assert(squared_grad.save(os) == SUCCESS);
+  assert(squared_grad.save(os) == SUCCESS);
+  assert(fwrite(&total_count, sizeof(count_t), 1, os) == 1);
+  assert(fwrite(&sg.counts()[0], sizeof(count_t), sg.max_vocab_size(), os) == static_cast<size_t>(sg.max_vocab_size()));
+  fclose(os);
+
+  //
+  Skipgram sg2;
+  assert(sg2.load("tmp", true) == SUCCESS);
+  assert(sg2.optimizer() == ADAGRAD);
+  assert(sg.vocab() == sg2.vocab());
+  assert(sg.counts() == sg2.counts());
+  assert(sg.vec().input == sg2.vec().input);
+}
+
+
 int main(int argc, const char** argv) {  
 
   test_reduce_vocab();
+  test_encode();
+  test_spans();
   test_save_load();
+  test_sgd_window();
+  for (int optimizer = ADAGRAD; optimizer <= SGD; ++optimizer) {
+    test_optimizer(optimizer, false);
+    test_optimizer(optimizer, true);
+  }
+  test_load_legacy_bin();
+  test_lazy_init();
+  test_lazy_init_interleaved();
+  test_lazy_init_untouched_rows();
+  test_sort_vocab(Skipgram::SEPARATE);
+  test_sort_vocab(Skipgram::INTERLEAVED);
+  for (int sgd_mode = Skipgram::PAIR_SGD; sgd_mode <= Skipgram::WINDOW_SGD; ++sgd_mode) {
+    test_storage(BF16, BF16, sgd_mode, true);
+    test_storage(FP16, BF16, sgd_mode, false);
+    test_storage(FP32, BF16, sgd_mode, true);
+    for (int optimizer = ADAGRAD; optimizer <= SGD; ++optimizer) {
+      test_layout(optimizer, sgd_mode, Skipgram::INTERLEAVED, 0);
+      test_layout(optimizer, sgd_mode, Skipgram::SEPARATE, 64);
+    }
+  }
    
   return SUCCESS;
 }
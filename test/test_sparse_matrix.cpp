@@ -10,20 +10,21 @@ using namespace yskip;
 void test_substitution_operator() {
 
   //
-  std::mt19937 mt;
+  Random random(0);
   SparseMatrix m1(9, 8);
   SparseMatrix m2(14, 15);
   for (int row = 0; row < m1.row_num(); ++row) {
     if (row%2 == 0) continue;
+    m1.materialize(row);
     for (int col = 0; col < m1.col_num(); ++col) {
-      m1[row][col] = random(-1.0, 1.0, mt);
+      m1[row][col] = random.uniform(-1.0, 1.0);
     }
   }
+  std::vector<real_t> v(m2.col_num());
   for (int row = 0; row < m2.row_num(); ++row) {
     if (row%3 == 0) continue;
-    for (int col = 0; col < m2.col_num(); ++col) {
-      m2[row][col] = random(-1.0, 1.0, mt);
-    }
+    random.fill(&v[0], &v[0] + m2.col_num(), static_cast<real_t>(-1.0), static_cast<real_t>(1.0));
+    m2.set(row, &v[0]);
   }
 
   //
@@ -31,7 +32,7 @@ void test_substitution_operator() {
   assert(m1.row_num() == m2.row_num());
   assert(m1.col_num() == m2.col_num());
   for (int row = 0; row < m2.row_num(); ++row) {
-    assert(m1[0].size() == m2.col_num());
+    assert(m1.materialized(row));
     for (int col = 0; col < m2.col_num(); ++col) {
       if (row%3 == 0) {
 	assert(m1[row][col] == 0.0);
@@ -43,13 +44,75 @@ void test_substitution_operator() {
 }
 
 
+// rows are materialized a chunk at a time, with values that do not depend on the order
+void test_materialize() {
+
+  const int n = 3*SparseMatrix::CHUNK_ROWS + 5;
+  SparseMatrix m1(n, 4), m2(n, 4);
+  m1.set_random(-1.0, 1.0, 7);
+  m2.set_random(-1.0, 1.0, 7);
+  assert(m1.materialized_row_num() == 0);
+  m1.materialize(2*SparseMatrix::CHUNK_ROWS + 1);
+  assert(m1.materialized(2*SparseMatrix::CHUNK_ROWS));
+  assert(!m1.materialized(0));
+  assert(m1.materialized_row_num() == SparseMatrix::CHUNK_ROWS);
+  m1.materialize(n - 1);
+  assert(m1.materialized_row_num() == SparseMatrix::CHUNK_ROWS + 5);
+  m2.materialize_all();
+  assert(m2.materialized_row_num() == n);
+
+  //
+  real_t v[4];
+  for (int row = 0; row < n; ++row) {
+    m1.get(row, v);
+    for (int col = 0; col < 4; ++col) {
+      assert(v[col] == m2[row][col]);
+      assert(-1.0 <= v[col] && v[col] < 1.0);
+    }
+  }
+  assert(m1[n - 1][3] != m1[n - 2][3]);
+
+  // the file does not depend on what is materialized
+  FILE* os = fopen("tmp", "wb");
+  assert(m1.save(os) == SUCCESS);
+  fclose(os);
+  SparseMatrix m3;
+  FILE* is = fopen("tmp", "rb");
+  assert(m3.load(is) == SUCCESS);
+  fclose(is);
+  assert(m3.materialized_row_num() == n);
+  assert(m3 == m2);
+}
+
+
+// rows after the reserved ones get fresh initial values
+void test_reduce() {
+
+  const int n = 2*SparseMatrix::CHUNK_ROWS;
+  SparseMatrix m(n, 2, 0.5);
+  m.materialize_all();
+  m[3][0] = 3.0;
+  m[n - 1][0] = 1.0;
+  std::unordered_set<int> reserved_rows;
+  reserved_rows.insert(3);
+  reserved_rows.insert(n - 1);
+  m.reduce(reserved_rows);
+  assert(m[0][0] == 3.0);
+  assert(m[1][0] == 1.0);
+  assert(m[2][0] == 0.5);
+  assert(m.materialized_row_num() == SparseMatrix::CHUNK_ROWS);
+  real_t v[2];
+  m.get(n - 1, v);
+  assert(v[0] == 0.5 && v[1] == 0.5);
+}
+
+
 int main() {
 
   SparseMatrix m(5, 3);
-  
-  DenseVector v(3);
-  v[0] = 1.0; v[1] = 2.0; v[2] = 1.0;
-  m[2].plus(2.0, v);
+
+  real_t v[] = {1.0, 2.0, 1.0};
+  m.set(2, v);
   assert(m.row_num() == 5);
   assert(m.col_num() == 3);
   assert(m[0][0] == 0.0);
@@ -58,15 +121,20 @@ int main() {
   assert(m[1][0] == 0.0);
   assert(m[1][1] == 0.0);
   assert(m[1][2] == 0.0);
-  assert(m[2][0] == 2.0);
-  assert(m[2][1] == 4.0);
-  assert(m[2][2] == 2.0);
+  assert(m[2][0] == 1.0);
+  assert(m[2][1] == 2.0);
+  assert(m[2][2] == 1.0);
 
   m.clear();
   assert(m.row_num() == 5);
   assert(m.col_num() == 3);
+  assert(m.materialized_row_num() == 0);
+  m.get(2, v);
+  assert(v[0] == 0.0);
 
   test_substitution_operator();
-  
+  test_materialize();
+  test_reduce();
+
   return SUCCESS;
 }
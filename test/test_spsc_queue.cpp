@@ -0,0 +1,94 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#include <cassert>
+#include <thread>
+#include <vector>
+#include "../src/spsc_queue.h"
+
+
+using namespace yskip;
+
+
+void test_fifo() {
+
+  SpscQueue<int> queue(3);
+  assert(queue.capacity() == 3);
+  assert(queue.empty());
+  int item;
+  assert(queue.pop(item) == false);
+  for (int round = 0; round < 3; ++round) { // wraps around
+    for (int i = 1; i <= 3; ++i) {
+      item = i;
+      assert(queue.push(item));
+    }
+    item = 4;
+    assert(queue.push(item) == false);
+    assert(item == 4);
+    assert(queue.empty() == false);
+    for (int i = 1; i <= 3; ++i) {
+      assert(queue.pop(item) && item == i);
+    }
+    assert(queue.pop(item) == false);
+    assert(queue.empty());
+  }
+}
+
+
+// buffers come back to the producer instead of being freed
+void test_swap() {
+
+  SpscQueue<std::vector<int>> queue(1);
+  std::vector<int> item(100, 1);
+  const int* data = item.data();
+  assert(queue.push(item));
+  assert(item.empty());
+  std::vector<int> received;
+  assert(queue.pop(received));
+  assert(received.data() == data);
+  received.clear();
+  assert(queue.pop(received) == false);
+  std::vector<int> next(1, 2);
+  assert(queue.push(next));
+  assert(queue.pop(received));
+  assert(received.size() == 1 && received[0] == 2);
+}
+
+
+void test_producer_consumer() {
+
+  SpscQueue<std::vector<int>> queue(2);
+  std::thread producer([&]() {
+      for (int i = 0; i < 100000; ++i) {
+	std::vector<int> item(3, i);
+	while (!queue.push(item)) {
+	  std::this_thread::yield();
+	}
+      }
+    });
+
+  //
+  std::vector<int> item;
+  int n = 0;
+  while (n < 100000) {
+    if (!queue.pop(item)) {
+      std::this_thread::yield();
+      continue;
+    }
+    assert(item.size() == 3);
+    assert(item[0] == n && item[2] == n);
+    ++n;
+  }
+  producer.join();
+  assert(queue.empty());
+}
+
+
+int main() {
+
+  test_fifo();
+  test_swap();
+  test_producer_consumer();
+
+  return SUCCESS;
+}
@@ -0,0 +1,86 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#include <cassert>
+#include <sys/stat.h>
+#include <vector>
+#include <string>
+#include "../src/text_corpus.h"
+
+
+using namespace yskip;
+
+
+void write_file(const std::string& path, const std::string& text) {
+
+  FILE* os = fopen(path.c_str(), "wb");
+  assert(os != NULL);
+  assert(fwrite(text.data(), sizeof(char), text.size(), os) == text.size());
+  fclose(os);
+}
+
+
+std::vector<std::string> read_lines(const std::vector<Span>& ranges) {
+
+  std::vector<std::string> lines;
+  Span line;
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    for (const char* s = ranges[i].begin; s != ranges[i].end; ) {
+      s = next_line(s, ranges[i].end, line);
+      lines.push_back(line.str());
+    }
+  }
+  return lines;
+}
+
+
+// the shards are the lines of the corpus in order, each line in exactly one shard
+void test_partition(const TextCorpus& corpus, const std::vector<std::string>& lines) {
+
+  for (int n = 1; n <= 12; ++n) {
+    std::vector<TextShard> shards;
+    corpus.partition(n, shards);
+    assert(shards.size() == static_cast<size_t>(n));
+    std::vector<std::string> all;
+    for (int i = 0; i < n; ++i) {
+      std::vector<std::string> shard_lines = read_lines(shards[i]);
+      all.insert(all.end(), shard_lines.begin(), shard_lines.end());
+    }
+    assert(all == lines);
+  }
+}
+
+
+int main() {
+
+  // the files of a directory are read in the order of their names; empty and hidden files add nothing
+  mkdir("tmp_corpus", 0755);
+  write_file("tmp_corpus/b", "D E\nF G H\nlast line without newline");
+  write_file("tmp_corpus/a", "A B\n\nC\n");
+  write_file("tmp_corpus/c", "");
+  write_file("tmp_corpus/.hidden", "X\n");
+  write_file("tmp_extra", "I J K\nL\n");
+  const std::vector<std::string> lines = {"A B", "", "C", "D E", "F G H", "last line without newline", "I J K", "L"};
+
+  TextCorpus corpus;
+  std::vector<const char*> paths = {"tmp_corpus", "tmp_extra"};
+  assert(corpus.open(paths) == SUCCESS);
+  assert(corpus.files().size() == 3);
+  assert(corpus.size() == 7 + 35 + 8);
+  assert(read_lines(corpus.files()) == lines);
+  test_partition(corpus, lines);
+
+  //
+  std::vector<Span> tokens;
+  Span line;
+  next_line(corpus.files()[1].begin, corpus.files()[1].end, line);
+  tokenize(line, tokens);
+  assert(tokens.size() == 2);
+  assert(tokens[0].str() == "D");
+  assert(tokens[1].str() == "E");
+
+  //
+  paths = {"tmp_missing"};
+  assert(corpus.open(paths) == FAILURE);
+  return SUCCESS;
+}
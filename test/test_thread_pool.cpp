@@ -0,0 +1,53 @@
+/*******************************************
+ * Copyright (C) 2017 Yahoo! JAPAN Research
+ *******************************************/
+#include <cassert>
+#include <atomic>
+#include "../src/thread_pool.h"
+
+
+using namespace yskip;
+
+
+void test_run() {
+
+  const int thread_num = 4;
+  ThreadPool pool(thread_num);
+  assert(pool.thread_num() == thread_num);
+
+  //
+  std::vector<int> counts(thread_num, 0);
+  for (int i = 0; i < 100; ++i) {
+    pool.run([&](const int id) { counts[id] += 1; });
+    pool.wait();
+    for (int j = 0; j < thread_num; ++j) {
+      assert(counts[j] == i + 1); // every worker ran exactly once per task
+    }
+  }
+}
+
+
+void test_barrier() {
+
+  ThreadPool pool(3);
+  std::atomic<int> sum(0);
+  std::vector<int> data(3000, 1);
+  for (int i = 0; i < 10; ++i) {
+    pool.run([&](const int id) {
+	for (int j = id*1000; j < (id+1)*1000; ++j) {
+	  sum += data[j];
+	}
+      });
+    pool.wait();
+    assert(sum == 3000*(i + 1));
+  }
+}
+
+
+int main() {
+
+  test_run();
+  test_barrier();
+
+  return SUCCESS;
+}
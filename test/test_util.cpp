@@ -2,13 +2,14 @@
  * Copyright (C) 2017 Yahoo! JAPAN Research
  *******************************************/
 #include <cassert>
+#include <algorithm>
 #include "../src/util.h"
 
 
 using namespace yskip;
 
 
-int test_tokenize() {
+void test_tokenize() {
 
   char text[] = "A BC DEF  G HI";
   std::vector<std::string> tokens = tokenize(text);
@@ -22,6 +23,49 @@ int test_tokenize() {
 }
 
 
+void test_tokenize_spans() {
+
+  const char text[] = " A BC DEF  G HI ";
+  std::vector<Span> tokens(1); // appended to
+  tokenize(text, tokens);
+  assert(tokens.size() == 6);
+  assert(tokens[1].str() == "A");
+  assert(tokens[2].str() == "BC");
+  assert(tokens[3].str() == "DEF");
+  assert(tokens[4].str() == "G");
+  assert(tokens[5].str() == "HI");
+  assert(tokens[3].data() == text + 6 && tokens[3].size() == 3);
+
+  tokens.clear();
+  tokenize("   ", tokens);
+  assert(tokens.empty());
+}
+
+
+// the hash depends on the bytes of the word only, and distinguishes words of every length class
+void test_word_hash() {
+
+  const char text[] = "abcdefghijklmnopqrstuvwxyz0123456789abcdefghij";
+  std::vector<uint64_t> hashes;
+  for (size_t len = 0; len < sizeof(text); ++len) {
+    const std::string word(text, len);
+    assert(word_hash(text, text + len) == word_hash(word.data(), word.data() + word.size()));
+    hashes.push_back(word_hash(text, text + len));
+  }
+  std::sort(hashes.begin(), hashes.end());
+  assert(std::unique(hashes.begin(), hashes.end()) == hashes.end());
+
+  // one byte differs at each position
+  for (size_t len = 1; len < sizeof(text); ++len) {
+    for (size_t i = 0; i < len; ++i) {
+      std::string word(text, len);
+      word[i] ^= 1;
+      assert(word_hash(word.data(), word.data() + len) != word_hash(text, text + len));
+    }
+  }
+}
+
+
 // int test_tokenize2() {
 
 //   //
@@ -64,5 +108,7 @@ int test_tokenize() {
 int main() {
 
   test_tokenize();
+  test_tokenize_spans();
+  test_word_hash();
   return SUCCESS;
 }
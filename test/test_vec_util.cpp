@@ -51,6 +51,156 @@ void test_mul_add(const int size) {
 }
 
 
+void test_kernels(const char* isa, const int size) {
+
+  const VecKernels* kernels = find_vec_kernels(isa);
+  if (kernels == NULL) {
+    std::fprintf(stderr, "%s is not supported\n", isa);
+    return;
+  }
+  const VecKernels* scalar_kernels = find_vec_kernels("scalar");
+
+  //
+  Random random(1);
+  const real_t a = random.uniform(static_cast<real_t>(-1.0), static_cast<real_t>(1.0));
+  std::vector<real_t> x(size + 1), y(size + 1), s(size + 1);
+  for (int i = 0; i < size + 1; ++i) {
+    x[i] = random.uniform(-1.0, 1.0);
+    y[i] = random.uniform(-1.0, 1.0);
+    s[i] = random.uniform(0.1, 2.0);
+  }
+  const real_t* px = &x[1]; // unaligned
+  const real_t* py = &y[1];
+  const real_t* ps = &s[1];
+  assert(approx_equal(kernels->dot(px, py, size), scalar_kernels->dot(px, py, size)));
+
+  //
+  std::vector<real_t> z1(y), z2(y);
+  kernels->axpy(a, px, &z1[1], size);
+  scalar_kernels->axpy(a, px, &z2[1], size);
+  for (int i = 0; i < size + 1; ++i) {
+    assert(approx_equal(z1[i], z2[i]));
+  }
+  kernels->mul_add(px, py, &z1[1], size);
+  scalar_kernels->mul_add(px, py, &z2[1], size);
+  for (int i = 0; i < size + 1; ++i) {
+    assert(approx_equal(z1[i], z2[i]));
+  }
+  kernels->mul_add2(a, px, py, &z1[1], size);
+  scalar_kernels->mul_add2(a, px, py, &z2[1], size);
+  for (int i = 0; i < size + 1; ++i) {
+    assert(approx_equal(z1[i], z2[i]));
+  }
+  kernels->adagrad(a, px, ps, &z1[1], size);
+  scalar_kernels->adagrad(a, px, ps, &z2[1], size);
+  for (int i = 0; i < size + 1; ++i) {
+    assert(approx_equal(z1[i], z2[i]));
+  }
+
+  //
+  const real_t* ys[] = {py, ps, px, &z1[1], &z2[1], py, ps};
+  real_t d1[7], d2[7];
+  kernels->dots(px, ys, 7, d1, size);
+  scalar_kernels->dots(px, ys, 7, d2, size);
+  for (int j = 0; j < 7; ++j) {
+    assert(approx_equal(d1[j], d2[j]));
+  }
+}
+
+
+// the fused kernels must give the same result as the sequence of kernels they replace
+void test_fused(const char* isa, const int size) {
+
+  const VecKernels* kernels = find_vec_kernels(isa);
+  if (kernels == NULL) {
+    return;
+  }
+
+  //
+  Random random(2);
+  const real_t g   = random.uniform(static_cast<real_t>(-1.0), static_cast<real_t>(1.0));
+  const real_t eta = 0.1;
+  std::vector<real_t> x(size + 1), o(size + 1), s(size + 1), grad(size + 1);
+  for (int i = 0; i < size + 1; ++i) {
+    x[i]    = random.uniform(-1.0, 1.0);
+    o[i]    = random.uniform(-1.0, 1.0);
+    s[i]    = random.uniform(0.1, 2.0);
+    grad[i] = random.uniform(-1.0, 1.0);
+  }
+
+  //
+  std::vector<real_t> o1(o), s1(s), grad1(grad);
+  std::vector<real_t> o2(o), s2(s), grad2(grad);
+  kernels->axpy(g, &o1[1], &grad1[1], size);
+  kernels->mul_add2(g*g, &x[1], &x[1], &s1[1], size);
+  kernels->adagrad(eta*g, &x[1], &s1[1], &o1[1], size);
+  kernels->update_output(g, g*g, eta*g, &x[1], &o2[1], &s2[1], &grad2[1], size);
+  for (int i = 0; i < size + 1; ++i) {
+    assert(o1[i] == o2[i]);
+    assert(s1[i] == s2[i]);
+    assert(grad1[i] == grad2[i]);
+  }
+
+  //
+  std::vector<real_t> x1(x), x2(x);
+  kernels->mul_add(&grad1[1], &grad1[1], &s1[1], size);
+  kernels->adagrad(eta, &grad1[1], &s1[1], &x1[1], size);
+  kernels->update_input(eta, &grad2[1], &s2[1], &x2[1], size);
+  for (int i = 0; i < size + 1; ++i) {
+    assert(x1[i] == x2[i]);
+    assert(s1[i] == s2[i]);
+  }
+}
+
+
+// the conversions must round exactly like the scalar functions
+void test_conversions(const char* isa) {
+
+  const VecKernels* kernels = find_vec_kernels(isa);
+  if (kernels == NULL) {
+    return;
+  }
+
+  // every finite half, odd length for the tails
+  std::vector<uint16_t> h;
+  for (uint32_t i = 0; i < 0x10000; ++i) {
+    if ((i & 0x7c00) != 0x7c00 || (i & 0x3ff) == 0) {
+      h.push_back(i);
+    }
+  }
+  h.push_back(0);
+  const int n = h.size();
+  std::vector<real_t> f(n);
+  kernels->fp16_to_fp32(&h[0], &f[0], n);
+  for (int i = 0; i < n; ++i) {
+    const real_t expected = scalar::half_to_float(h[i]);
+    assert(memcmp(&f[i], &expected, sizeof(real_t)) == 0);
+  }
+  std::vector<uint16_t> h2(n);
+  kernels->fp32_to_fp16(&f[0], &h2[0], n);
+  assert(h == h2);
+
+  // random floats of all magnitudes, including subnormal halves and overflow
+  Random random(3);
+  const int m = 10001;
+  std::vector<real_t> x(m);
+  for (int i = 0; i < m; ++i) {
+    x[i] = random.uniform(-1.0, 1.0)*std::pow(2.0, random.uniform(-30, 20));
+  }
+  std::vector<uint16_t> y(m), b(m);
+  kernels->fp32_to_fp16(&x[0], &y[0], m);
+  kernels->fp32_to_bf16(&x[0], &b[0], m);
+  std::vector<real_t> z(m);
+  kernels->bf16_to_fp32(&b[0], &z[0], m);
+  for (int i = 0; i < m; ++i) {
+    assert(y[i] == scalar::float_to_half(x[i]));
+    assert(b[i] == scalar::float_to_bf16(x[i]));
+    assert(z[i] == scalar::bf16_to_float(b[i]));
+    assert(std::fabs(z[i] - x[i]) <= std::fabs(x[i])/256.0);
+  }
+}
+
+
 int main() {
 
   test_mul_add(0);
@@ -61,5 +211,20 @@ int main() {
   test_mul_add(16);
   test_mul_add(23);
 
+  const char* isas[] = {"scalar", "sse", "avx2", "avx512"};
+  const int sizes[] = {0, 1, 7, 8, 15, 16, 17, 33, 100, 300};
+  for (int i = 1; i < 4; ++i) {
+    for (int j = 0; j < 10; ++j) {
+      test_kernels(isas[i], sizes[j]);
+    }
+  }
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j < 10; ++j) {
+      test_fused(isas[i], sizes[j]);
+    }
+    test_conversions(isas[i]);
+  }
+  std::fprintf(stderr, "selected kernels: %s\n", vec_kernels().name);
+
   return 0;
 }
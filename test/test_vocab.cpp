@@ -109,6 +109,83 @@ void test_reduce() {
 }
 
 
+void test_renumber() {
+
+  Vocab vocab(100);
+  vocab.add("A");
+  vocab.add("BB");
+  vocab.add("CCC");
+  const int new_index[] = {2, 0, 1};
+  vocab.renumber(std::vector<int>(new_index, new_index + 3));
+  assert(vocab.size() == 3);
+  assert(vocab.encode("A") == 2);
+  assert(vocab.encode("BB") == 0);
+  assert(vocab.encode("CCC") == 1);
+  assert(vocab.encode("B") == -1);
+  assert(vocab.all()[0] == "BB");
+  assert(vocab.add("D") == 3);
+  assert(strcmp(vocab.word(2), "A") == 0);
+  assert(strcmp(vocab.word(3), "D") == 0);
+}
+
+
+// words that collide in the table or share a prefix are told apart
+void test_collision() {
+
+  Vocab vocab(3);
+  assert(vocab.add("AB") == 0);
+  assert(vocab.add("A") == 1);
+  assert(vocab.add("ABC") == 2);
+  assert(vocab.encode("AB") == 0);
+  assert(vocab.encode("A") == 1);
+  assert(vocab.encode("ABC") == 2);
+  const char* abc = "ABC";
+  assert(vocab.encode(abc, abc + 2) == 0);
+  assert(strcmp(vocab.word(0), "AB") == 0);
+  vocab.clear();
+  assert(vocab.size() == 0);
+  assert(vocab.encode("A") == -1);
+  assert(vocab.add("C") == 0);
+  assert(strcmp(vocab.word(0), "C") == 0);
+
+  // a token of a mapped file may hold null characters
+  Vocab vocab2(10);
+  assert(vocab2.add("AB") == 0);
+  const char with_nul[] = {'A', 'B', '\0', 'C'};
+  assert(vocab2.encode(with_nul, with_nul + 4) == -1);
+  assert(vocab2.encode(with_nul, with_nul + 2) == 0);
+}
+
+
+// encode_batch() agrees with encode() over several batches, in a table small enough for long probes
+void test_encode_batch() {
+
+  Vocab vocab(200);
+  std::vector<std::string> words;
+  for (int i = 0; i < 100; ++i) {
+    words.push_back("w" + std::to_string(i));
+    assert(vocab.add(words.back()) == i);
+  }
+  words.push_back("unknown");
+  words.push_back("a word longer than sixteen bytes");
+  for (int i = 0; i < 100; i += 3) {
+    words.push_back("w" + std::to_string(i));
+  }
+  std::vector<int> indices;
+  vocab.encode_batch(words, indices);
+  assert(indices.size() == words.size());
+  for (size_t i = 0; i < words.size(); ++i) {
+    assert(indices[i] == vocab.encode(words[i]));
+  }
+  assert(indices[100] == -1);
+  assert(indices[101] == -1);
+  assert(indices[102] == 0);
+
+  vocab.encode_batch(std::vector<std::string>(), indices);
+  assert(indices.empty());
+}
+
+
 int main() {
 
   {
@@ -145,12 +222,25 @@ int main() {
     assert(vocab.encode("B") == vocab2.encode("B"));
     assert(vocab.encode("C") == vocab2.encode("C"));
     assert(vocab.encode("D") == vocab2.encode("D")); 
+
+    // older models store the table size in 32 bits
+    os = fopen("tmp", "wb");
+    assert(vocab.save(os, false) == SUCCESS);
+    fclose(os);
+    Vocab vocab3;
+    is = fopen("tmp", "rb");
+    assert(vocab3.load(is, false) == SUCCESS);
+    fclose(is);
+    assert(vocab == vocab3);
   }
 
   //
   //test_add();
   //test_encode();
   test_reduce();
+  test_renumber();
+  test_collision();
+  test_encode_batch();
   
   return SUCCESS;
 }